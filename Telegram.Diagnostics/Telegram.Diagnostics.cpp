@@ -1,6 +1,10 @@
 #include "stdafx.h"
 
+#include "clock.hpp"
+#include "sessionregistry.hpp"
 #include "tap.hpp"
+#include "tracing.hpp"
+#include "triggers.hpp"
 
 using PFN_INITIALIZE_XAML_DIAGNOSTICS_EX =
     decltype(&InitializeXamlDiagnosticsEx);
@@ -20,9 +24,7 @@ ATOM RegisterDialogClass(LPCTSTR lpszClassName, HINSTANCE hInstance) {
     return ::RegisterClass(&wndcls);
 }
 
-bool GetLoadedDllPath(DWORD processId,
-                      PCWSTR dllName,
-                      WCHAR resultDllPath[MAX_PATH]) {
+bool FindLoadedModule(DWORD processId, PCWSTR dllName, MODULEENTRY32& entry) {
     HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, processId);
     if (snapshot == INVALID_HANDLE_VALUE) {
         return false;
@@ -30,13 +32,12 @@ bool GetLoadedDllPath(DWORD processId,
 
     bool succeeded = false;
 
-    MODULEENTRY32 entry{
+    entry = {
         .dwSize = sizeof(entry),
     };
     if (Module32First(snapshot, &entry)) {
         do {
             if (_wcsicmp(entry.szModule, dllName) == 0) {
-                wcscpy_s(resultDllPath, MAX_PATH, entry.szExePath);
                 succeeded = true;
                 break;
             }
@@ -47,7 +48,100 @@ bool GetLoadedDllPath(DWORD processId,
     return succeeded;
 }
 
-HRESULT UwpInitializeXamlDiagnostics(DWORD pid, PCWSTR dllLocation) {
+bool GetLoadedDllPath(DWORD processId,
+                      PCWSTR dllName,
+                      WCHAR resultDllPath[MAX_PATH]) {
+    MODULEENTRY32 entry;
+    if (!FindLoadedModule(processId, dllName, entry)) {
+        return false;
+    }
+
+    wcscpy_s(resultDllPath, MAX_PATH, entry.szExePath);
+    return true;
+}
+
+// Runs in the target process, started there by setTraceLevel.
+DWORD WINAPI TraceLevelThreadProc(LPVOID parameter) {
+    SetTraceLevel(
+        static_cast<TraceLevel>(reinterpret_cast<uintptr_t>(parameter)));
+    return 0;
+}
+
+// Runs in the target process, started there by requestSnapshot. The event
+// is in the app's namespace, which for a packaged app only code inside it
+// can open by name.
+DWORD WINAPI SnapshotThreadProc(LPVOID) {
+    HANDLE event =
+        OpenEvent(EVENT_MODIFY_STATE, FALSE,
+                  SnapshotEventName(GetCurrentProcessId()).c_str());
+    if (!event) {
+        return GetLastError();
+    }
+
+    SetEvent(event);
+    CloseHandle(event);
+    return ERROR_SUCCESS;
+}
+
+// Starts threadProc, a function of this DLL, in the copy of the DLL that
+// the watcher in pid runs from, at the same offset.
+HRESULT RunInWatcher(DWORD pid,
+                     LPTHREAD_START_ROUTINE threadProc,
+                     LPVOID parameter) {
+    WCHAR location[MAX_PATH];
+    switch (GetModuleFileName(_Module.GetModuleInstance(), location,
+                              ARRAYSIZE(location))) {
+        case 0:
+        case ARRAYSIZE(location):
+            return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const PCWSTR fileName = wcsrchr(location, L'\\');
+
+    MODULEENTRY32 entry;
+    if (!FindLoadedModule(pid, fileName ? fileName + 1 : location, entry)) {
+        return HRESULT_FROM_WIN32(ERROR_MOD_NOT_FOUND);
+    }
+
+    const auto offset =
+        reinterpret_cast<const BYTE*>(threadProc) -
+        reinterpret_cast<const BYTE*>(_Module.GetModuleInstance());
+
+    HANDLE process = OpenProcess(
+        PROCESS_CREATE_THREAD | PROCESS_QUERY_INFORMATION |
+            PROCESS_VM_OPERATION | PROCESS_VM_WRITE | PROCESS_VM_READ,
+        FALSE, pid);
+    if (!process) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HANDLE thread = CreateRemoteThread(
+        process, nullptr, 0,
+        reinterpret_cast<LPTHREAD_START_ROUTINE>(entry.modBaseAddr + offset),
+        parameter, 0, nullptr);
+
+    HRESULT hr = S_OK;
+    if (thread) {
+        WaitForSingleObject(thread, 5000);
+
+        DWORD exitCode;
+        if (GetExitCodeThread(thread, &exitCode) && exitCode != STILL_ACTIVE &&
+            exitCode != ERROR_SUCCESS) {
+            hr = HRESULT_FROM_WIN32(exitCode);
+        }
+
+        CloseHandle(thread);
+    } else {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(process);
+    return hr;
+}
+
+HRESULT UwpInitializeXamlDiagnostics(DWORD pid,
+                                     PCWSTR dllLocation,
+                                     PCWSTR options) {
     const HMODULE wux(LoadLibraryEx(L"Windows.UI.Xaml.dll", nullptr,
                                     LOAD_LIBRARY_SEARCH_SYSTEM32));
     if (!wux) {
@@ -60,8 +154,37 @@ HRESULT UwpInitializeXamlDiagnostics(DWORD pid, PCWSTR dllLocation) {
         return HRESULT_FROM_WIN32(GetLastError());
     }
 
+    // The options reach the watcher through
+    // IXamlDiagnostics::GetInitializationData.
     return ixde(L"VisualDiagConnection1", pid, L"", dllLocation,
-                CLSID_Telegram_DiagnosticsTAP, nullptr);
+                CLSID_Telegram_DiagnosticsTAP, options);
+}
+
+// Microsoft.UI.Xaml.dll ships with the app or the Windows App SDK
+// framework package, not with the system, so use the copy the target has
+// loaded.
+HRESULT WinUIInitializeXamlDiagnostics(DWORD pid,
+                                       PCWSTR dllLocation,
+                                       PCWSTR options) {
+    WCHAR muxPath[MAX_PATH];
+    if (!GetLoadedDllPath(pid, L"Microsoft.UI.Xaml.dll", muxPath)) {
+        return HRESULT_FROM_WIN32(ERROR_MOD_NOT_FOUND);
+    }
+
+    const HMODULE mux(
+        LoadLibraryEx(muxPath, nullptr, LOAD_WITH_ALTERED_SEARCH_PATH));
+    if (!mux) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const auto ixde = reinterpret_cast<PFN_INITIALIZE_XAML_DIAGNOSTICS_EX>(
+        GetProcAddress(mux, "InitializeXamlDiagnosticsEx"));
+    if (!ixde) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return ixde(L"WinUIVisualDiagConnection1", pid, L"", dllLocation,
+                CLSID_Telegram_DiagnosticsWinUITAP, options);
 }
 
 }  // namespace
@@ -92,43 +215,19 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL,  // handle to DLL module
     return TRUE;
 }
 
-HRESULT WINAPI start(DWORD pid, DWORD framework) {
+HRESULT WINAPI startWithOptions(DWORD pid, DWORD framework, PCWSTR options) {
+    // The counter is the same in the target, which measures its attach
+    // latency from here.
+    std::wstring watcherOptions =
+        std::format(L"{};startTicks={}", options ? options : L"", QueryTicks());
+
     AllowSetForegroundWindow(pid);
 
     // Calling InitializeXamlDiagnosticsEx the second time will reset the
-    // existing element tree callbacks. Therefore, first check for existing
-    // windows for the target process.
-
-    struct EnumWindowsData {
-        DWORD pid;
-        BOOL found;
-    };
-
-    EnumWindowsData data = {pid, FALSE};
-
-    EnumWindows(
-        [](HWND hWnd, LPARAM lParam) -> BOOL {
-            EnumWindowsData& data = *reinterpret_cast<EnumWindowsData*>(lParam);
-
-            DWORD windowPid;
-            if (!GetWindowThreadProcessId(hWnd, &windowPid) ||
-                windowPid != data.pid) {
-                return TRUE;
-            }
-
-            WCHAR windowClass[16];
-            if (!GetClassName(hWnd, windowClass, ARRAYSIZE(windowClass)) ||
-                _wcsicmp(windowClass, L"Telegram.Diagnostics") != 0) {
-                return TRUE;
-            }
-
-            // data.found = TRUE;
-            // PostMessage(hWnd, CMainDlg::UWM_ACTIVATE_WINDOW, 0, 0);
-            return TRUE;
-        },
-        reinterpret_cast<LPARAM>(&data));
-
-    if (data.found) {
+    // existing element tree callbacks. Therefore, first check for an
+    // existing session in the target process.
+    SessionRegistry sessions;
+    if (sessions.Open() && sessions.Contains(pid)) {
         return S_OK;
     }
 
@@ -140,47 +239,91 @@ HRESULT WINAPI start(DWORD pid, DWORD framework) {
             return HRESULT_FROM_WIN32(GetLastError());
     }
 
-    enum Framework : DWORD {
-        kFrameworkUWP = 1,
-        kFrameworkWinUI,
-    };
+    // The watcher registers through a handle of its own, it can't open
+    // the registry by name from inside an AppContainer. Without it, the
+    // session works but can't be found.
+    HANDLE process = sessions.Handle()
+                         ? OpenProcess(PROCESS_DUP_HANDLE, FALSE, pid)
+                         : nullptr;
+    HANDLE remoteSessions = nullptr;
+    if (process &&
+        DuplicateHandle(GetCurrentProcess(), sessions.Handle(), process,
+                        &remoteSessions, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+        watcherOptions +=
+            std::format(L";sessionRegistry={}",
+                        reinterpret_cast<uintptr_t>(remoteSessions));
+    }
 
+    HRESULT hr;
     switch (framework) {
-        case kFrameworkUWP:
-            return UwpInitializeXamlDiagnostics(pid, location);
+        case session::kFrameworkUWP:
+            hr = UwpInitializeXamlDiagnostics(pid, location,
+                                              watcherOptions.c_str());
+            break;
+
+        case session::kFrameworkWinUI:
+            hr = WinUIInitializeXamlDiagnostics(pid, location,
+                                                watcherOptions.c_str());
+            break;
+
+        default:
+            hr = E_INVALIDARG;
+            break;
     }
 
-    return E_INVALIDARG;
+    if (remoteSessions && FAILED(hr)) {
+        DuplicateHandle(process, remoteSessions, nullptr, nullptr, 0, FALSE,
+                        DUPLICATE_CLOSE_SOURCE);
+    }
+
+    if (process) {
+        CloseHandle(process);
+    }
+
+    return hr;
 }
 
-BOOL WINAPI isDebugging(DWORD pid) {
-    struct EnumWindowsData {
-        DWORD pid;
-        BOOL found;
-    };
+HRESULT WINAPI start(DWORD pid, DWORD framework) {
+    return startWithOptions(pid, framework, nullptr);
+}
 
-    EnumWindowsData data = {pid, FALSE};
+// Changes the trace level of the watcher running in pid, without
+// restarting it.
+HRESULT WINAPI setTraceLevel(DWORD pid, DWORD level) {
+    if (level > static_cast<DWORD>(TraceLevel::kVerbose)) {
+        return E_INVALIDARG;
+    }
 
-    EnumWindows(
-        [](HWND hWnd, LPARAM lParam) -> BOOL {
-            EnumWindowsData& data = *reinterpret_cast<EnumWindowsData*>(lParam);
+    return RunInWatcher(
+        pid, TraceLevelThreadProc,
+        reinterpret_cast<LPVOID>(static_cast<uintptr_t>(level)));
+}
 
-            DWORD windowPid;
-            if (!GetWindowThreadProcessId(hWnd, &windowPid) ||
-                windowPid != data.pid) {
-                return TRUE;
-            }
+// Asks the watcher running in pid for a snapshot report. Subject to its
+// triggerCooldown like any other trigger.
+HRESULT WINAPI requestSnapshot(DWORD pid) {
+    return RunInWatcher(pid, SnapshotThreadProc, nullptr);
+}
 
-            WCHAR windowClass[16];
-            if (!GetClassName(hWnd, windowClass, ARRAYSIZE(windowClass)) ||
-                _wcsicmp(windowClass, L"Telegram.Diagnostics") != 0) {
-                return TRUE;
-            }
+BOOL WINAPI isDebugging(DWORD pid) {
+    SessionRegistry sessions;
+    return sessions.Open() && sessions.Contains(pid);
+}
+
+// Copies up to capacity of the running sessions to sessions, and sets
+// count to how many there are.
+HRESULT WINAPI querySessions(session::Info* sessions,
+                             DWORD capacity,
+                             DWORD* count) {
+    if (!count || (capacity && !sessions)) {
+        return E_INVALIDARG;
+    }
 
-            data.found = TRUE;
-            return FALSE;
-        },
-        reinterpret_cast<LPARAM>(&data));
+    SessionRegistry registry;
+    if (!registry.Open()) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-    return data.found;
+    *count = static_cast<DWORD>(registry.Query(sessions, capacity));
+    return S_OK;
 }
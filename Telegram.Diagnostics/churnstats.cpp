@@ -0,0 +1,194 @@
+#include "stdafx.h"
+
+#include "churnstats.hpp"
+
+#include "clock.hpp"
+
+namespace {
+
+void Increment(std::atomic<uint32_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+}
+
+// Keeps out sorted by adds plus removes, dropping the smallest once full.
+size_t InsertTop(ChurnStats::Churner* out,
+                 size_t count,
+                 size_t maxChurners,
+                 const ChurnStats::Churner& churner) {
+    const uint64_t total = uint64_t{churner.adds} + churner.removes;
+
+    size_t i = count < maxChurners ? count++ : maxChurners;
+    while (i > 0 && uint64_t{out[i - 1].adds} + out[i - 1].removes < total) {
+        if (i < maxChurners) {
+            out[i] = out[i - 1];
+        }
+        i--;
+    }
+
+    if (i < maxChurners) {
+        out[i] = churner;
+    }
+
+    return count;
+}
+
+}  // namespace
+
+void ChurnStats::ElementAdded(uint32_t typeId,
+                              InstanceHandle subtree,
+                              uint32_t subtreePathId,
+                              int64_t now) {
+    Count(typeId, subtree, subtreePathId, now, true);
+}
+
+void ChurnStats::ElementRemoved(uint32_t typeId,
+                                InstanceHandle subtree,
+                                uint32_t subtreePathId,
+                                int64_t now) {
+    Count(typeId, subtree, subtreePathId, now, false);
+}
+
+ChurnStats::Counters& ChurnStats::Current(int64_t now) {
+    uint32_t current = m_current.load(std::memory_order_relaxed);
+    Counters* counters = &m_windows[current];
+
+    const int64_t start = counters->start.load(std::memory_order_relaxed);
+    if (start && now - start < kWindowSeconds * TicksPerSecond()) {
+        return *counters;
+    }
+
+    // The first window only starts with the first element.
+    if (start) {
+        counters->end.store(now, std::memory_order_relaxed);
+        current ^= 1;
+        counters = &m_windows[current];
+    }
+
+    counters->end.store(0, std::memory_order_relaxed);
+    for (auto& counter : counters->typeAdds) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto& counter : counters->typeRemoves) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kMaxSubtrees; i++) {
+        counters->subtrees[i].store(0, std::memory_order_relaxed);
+        counters->subtreeAdds[i].store(0, std::memory_order_relaxed);
+        counters->subtreeRemoves[i].store(0, std::memory_order_relaxed);
+    }
+    counters->start.store(now, std::memory_order_relaxed);
+
+    m_current.store(current, std::memory_order_release);
+    return *counters;
+}
+
+void ChurnStats::Count(uint32_t typeId,
+                       InstanceHandle subtree,
+                       uint32_t subtreePathId,
+                       int64_t now,
+                       bool added) {
+    Counters& counters = Current(now);
+
+    if (typeId < TreeStats::kMaxTypes) {
+        Increment(added ? counters.typeAdds[typeId]
+                        : counters.typeRemoves[typeId]);
+    }
+
+    if (!subtree) {
+        return;
+    }
+
+    // Handles are aligned pointers, mix the bits before taking the slot.
+    size_t slot = (subtree * 0x9E3779B97F4A7C15ull >> 32) % kMaxSubtrees;
+    size_t probes = 0;
+    for (;;) {
+        const InstanceHandle key =
+            counters.subtrees[slot].load(std::memory_order_relaxed);
+        if (key == subtree) {
+            break;
+        }
+
+        if (!key) {
+            counters.subtreePathIds[slot].store(subtreePathId,
+                                                std::memory_order_relaxed);
+            counters.subtrees[slot].store(subtree, std::memory_order_release);
+            break;
+        }
+
+        if (++probes == kMaxSubtrees) {
+            return;
+        }
+
+        slot = (slot + 1) % kMaxSubtrees;
+    }
+
+    Increment(added ? counters.subtreeAdds[slot]
+                    : counters.subtreeRemoves[slot]);
+}
+
+const ChurnStats::Counters& ChurnStats::Get(Window window) const {
+    const uint32_t current = m_current.load(std::memory_order_acquire);
+    return m_windows[window == Window::kCurrent ? current : current ^ 1];
+}
+
+int64_t ChurnStats::WindowStart(Window window) const {
+    return Get(window).start.load(std::memory_order_relaxed);
+}
+
+int64_t ChurnStats::WindowEnd(Window window) const {
+    return Get(window).end.load(std::memory_order_relaxed);
+}
+
+size_t ChurnStats::TopTypes(Window window,
+                            Churner* out,
+                            size_t maxChurners) const {
+    const Counters& counters = Get(window);
+
+    size_t count = 0;
+    for (uint32_t typeId = 0; typeId < TreeStats::kMaxTypes; typeId++) {
+        const Churner churner{
+            .key = typeId,
+            .pathId = PathTable::kInvalidId,
+            .adds = counters.typeAdds[typeId].load(std::memory_order_relaxed),
+            .removes =
+                counters.typeRemoves[typeId].load(std::memory_order_relaxed),
+        };
+
+        if (churner.adds || churner.removes) {
+            count = InsertTop(out, count, maxChurners, churner);
+        }
+    }
+
+    return count;
+}
+
+size_t ChurnStats::TopSubtrees(Window window,
+                               Churner* out,
+                               size_t maxChurners) const {
+    const Counters& counters = Get(window);
+
+    size_t count = 0;
+    for (size_t slot = 0; slot < kMaxSubtrees; slot++) {
+        const InstanceHandle subtree =
+            counters.subtrees[slot].load(std::memory_order_acquire);
+        if (!subtree) {
+            continue;
+        }
+
+        const Churner churner{
+            .key = subtree,
+            .pathId =
+                counters.subtreePathIds[slot].load(std::memory_order_relaxed),
+            .adds = counters.subtreeAdds[slot].load(std::memory_order_relaxed),
+            .removes =
+                counters.subtreeRemoves[slot].load(std::memory_order_relaxed),
+        };
+
+        if (churner.adds || churner.removes) {
+            count = InsertTop(out, count, maxChurners, churner);
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "treestats.hpp"
+
+// Element adds and removes per type and per tracked subtree, counted over
+// fixed windows of kWindowSeconds. Heavy churn in a list usually means item
+// templates are rebuilt instead of recycled.
+//
+// Two windows are kept, the one being counted and the last completed one,
+// each in fixed-size arrays: types by TreeStats type id, subtrees in a small
+// open-addressed table keyed by their root. Subtrees past kMaxSubtrees in a
+// window are only counted by type.
+//
+// Counting is writer only. Readers rank the counters themselves, lock-free
+// from any thread, so the writer never sorts anything. A reader racing with
+// the end of a window may see counts of the window that replaces it.
+class ChurnStats {
+   public:
+    static constexpr int64_t kWindowSeconds = 10;
+    static constexpr size_t kMaxSubtrees = 256;
+
+    struct Churner {
+        // Type id or subtree root.
+        uint64_t key;
+        // Path of the subtree root, kInvalidId for types.
+        uint32_t pathId;
+        uint32_t adds;
+        uint32_t removes;
+    };
+
+    enum class Window {
+        kCurrent,
+        kPrevious,
+    };
+
+    ChurnStats() = default;
+
+    ChurnStats(const ChurnStats&) = delete;
+    ChurnStats& operator=(const ChurnStats&) = delete;
+
+    // Writer only. subtree is 0 for elements above the subtree depth.
+    void ElementAdded(uint32_t typeId,
+                      InstanceHandle subtree,
+                      uint32_t subtreePathId,
+                      int64_t now);
+    void ElementRemoved(uint32_t typeId,
+                        InstanceHandle subtree,
+                        uint32_t subtreePathId,
+                        int64_t now);
+
+    // Any thread. Start and end ticks of a window. The current window has
+    // no end yet, and both are 0 before the first element.
+    int64_t WindowStart(Window window) const;
+    int64_t WindowEnd(Window window) const;
+
+    // Any thread. Copy up to maxChurners of the busiest types or subtrees,
+    // by adds plus removes, and return how many were copied.
+    size_t TopTypes(Window window, Churner* out, size_t maxChurners) const;
+    size_t TopSubtrees(Window window, Churner* out, size_t maxChurners) const;
+
+   private:
+    struct Counters {
+        std::atomic<int64_t> start{0};
+        std::atomic<int64_t> end{0};
+        std::atomic<uint32_t> typeAdds[TreeStats::kMaxTypes]{};
+        std::atomic<uint32_t> typeRemoves[TreeStats::kMaxTypes]{};
+        std::atomic<InstanceHandle> subtrees[kMaxSubtrees]{};
+        std::atomic<uint32_t> subtreePathIds[kMaxSubtrees]{};
+        std::atomic<uint32_t> subtreeAdds[kMaxSubtrees]{};
+        std::atomic<uint32_t> subtreeRemoves[kMaxSubtrees]{};
+    };
+
+    Counters& Current(int64_t now);
+    const Counters& Get(Window window) const;
+    void Count(uint32_t typeId,
+               InstanceHandle subtree,
+               uint32_t subtreePathId,
+               int64_t now,
+               bool added);
+
+    Counters m_windows[2];
+    std::atomic<uint32_t> m_current{0};
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+// QueryPerformanceCounter ticks. Consistent across threads and processes on
+// the same machine, so they are used for every timestamp the watcher
+// records.
+inline int64_t QueryTicks() {
+    LARGE_INTEGER ticks;
+    QueryPerformanceCounter(&ticks);
+    return ticks.QuadPart;
+}
+
+inline int64_t TicksPerSecond() {
+    static const int64_t frequency = [] {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return frequency.QuadPart;
+    }();
+
+    return frequency;
+}
+
+inline int64_t TicksToMicroseconds(int64_t ticks) {
+    return ticks * 1000000 / TicksPerSecond();
+}
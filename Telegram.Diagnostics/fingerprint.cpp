@@ -0,0 +1,111 @@
+#include "stdafx.h"
+
+#include "fingerprint.hpp"
+
+namespace {
+
+constexpr uint64_t kFnvOffset = 0xCBF29CE484222325ull;
+constexpr uint64_t kFnvPrime = 0x100000001B3ull;
+
+uint64_t Mix(uint64_t value) {
+    // splitmix64 finalizer.
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value;
+}
+
+void HashWord(uint64_t& hash, uint64_t word) {
+    for (int i = 0; i < 8; i++) {
+        hash ^= word & 0xFF;
+        hash *= kFnvPrime;
+        word >>= 8;
+    }
+}
+
+// FNV-1a of the path without its "[n]" parts.
+uint64_t NormalizedPathHash(std::wstring_view path) {
+    uint64_t hash = kFnvOffset;
+
+    for (size_t i = 0; i < path.size(); i++) {
+        if (path[i] == L'[') {
+            size_t end = i + 1;
+            while (end < path.size() && path[end] >= L'0' &&
+                   path[end] <= L'9') {
+                end++;
+            }
+
+            if (end > i + 1 && end < path.size() && path[end] == L']') {
+                i = end;
+                continue;
+            }
+        }
+
+        hash ^= static_cast<uint16_t>(path[i]);
+        hash *= kFnvPrime;
+    }
+
+    return hash;
+}
+
+// Sorts and removes duplicates, returns the new count.
+size_t SortUnique(uint64_t* values, size_t count) {
+    std::sort(values, values + count);
+    return std::unique(values, values + count) - values;
+}
+
+}  // namespace
+
+CycleFingerprint ComputeCycleFingerprint(const PathTable& paths,
+                                         const HistoryItem* items,
+                                         size_t count) {
+    if (count > CycleFingerprint::kMaxEvents) {
+        items += count - CycleFingerprint::kMaxEvents;
+        count = CycleFingerprint::kMaxEvents;
+    }
+
+    uint64_t participants[CycleFingerprint::kMaxEvents];
+    uint64_t transitions[CycleFingerprint::kMaxEvents];
+    size_t participantCount = 0;
+    size_t transitionCount = 0;
+
+    uint64_t previous = 0;
+    for (size_t i = 0; i < count; i++) {
+        const std::wstring_view path = paths.Get(items[i].pathId);
+        if (path.empty()) {
+            continue;
+        }
+
+        const uint64_t participant = Mix(NormalizedPathHash(path) ^
+                                         static_cast<uint64_t>(items[i].kind));
+        participants[participantCount++] = participant;
+
+        if (previous && previous != participant) {
+            transitions[transitionCount++] =
+                Mix(previous * 0x9E3779B97F4A7C15ull ^ participant);
+        }
+
+        previous = participant;
+    }
+
+    participantCount = SortUnique(participants, participantCount);
+    transitionCount = SortUnique(transitions, transitionCount);
+
+    uint64_t hash = kFnvOffset;
+    HashWord(hash, CycleFingerprint::kVersion);
+    HashWord(hash, participantCount);
+    for (size_t i = 0; i < participantCount; i++) {
+        HashWord(hash, participants[i]);
+    }
+
+    HashWord(hash, transitionCount);
+    for (size_t i = 0; i < transitionCount; i++) {
+        HashWord(hash, transitions[i]);
+    }
+
+    return {.hash = Mix(hash),
+            .participants = static_cast<uint32_t>(participantCount),
+            .transitions = static_cast<uint32_t>(transitionCount)};
+}
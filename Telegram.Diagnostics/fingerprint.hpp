@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+
+#include "history.hpp"
+#include "pathtable.hpp"
+
+// Identifies a layout cycle independently of the process it happened in,
+// so reports of the same cycle from different users can be bucketed by a
+// single value.
+//
+// Handles and event counts vary from run to run, so only the shape of the
+// cycle is hashed: the set of participants (event kind and path with the
+// "[childIndex]" parts removed, as item indices depend on scrolling and
+// data) and the set of transitions between consecutive participants. Both
+// are sets, so how many times the cycle went around doesn't matter.
+struct CycleFingerprint {
+    // Bump when the hashed content changes, fingerprints of different
+    // versions don't compare.
+    static constexpr unsigned int kVersion = 1;
+    // Only the most recent events are hashed.
+    static constexpr size_t kMaxEvents = 256;
+
+    uint64_t hash;
+    uint32_t participants;
+    uint32_t transitions;
+};
+
+// items are oldest first. Doesn't allocate.
+CycleFingerprint ComputeCycleFingerprint(const PathTable& paths,
+                                         const HistoryItem* items,
+                                         size_t count);
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+
+#include "flamegraph.hpp"
+
+#include "clock.hpp"
+
+FlameGraph::FlameGraph() : m_maxGapTicks(TicksPerSecond() / 60) {
+    m_segments[0] = std::make_unique<Node[]>(kNodesPerSegment);
+
+    Node& root = Get(kRoot);
+    root.parent = kNone;
+    root.frameId = PathTable::kInvalidId;
+    root.depth = 0;
+    m_size.store(1, std::memory_order_release);
+}
+
+uint32_t FlameGraph::Child(uint32_t parent, std::wstring_view frame) {
+    Node& parentNode = Get(parent);
+    if (parentNode.depth == kMaxDepth) {
+        return parent;
+    }
+
+    const uint32_t frameId = m_frames.Intern(frame);
+    if (frameId == PathTable::kInvalidId) {
+        return parent;
+    }
+
+    const uint64_t key = uint64_t{parent} << 32 | frameId;
+    auto find = m_index.find(key);
+    if (find != m_index.end()) {
+        return find->second;
+    }
+
+    const uint32_t id = m_size.load(std::memory_order_relaxed);
+    const uint32_t segment = id / kNodesPerSegment;
+    if (segment >= kMaxSegments) {
+        return parent;
+    }
+
+    if (!m_segments[segment]) {
+        m_segments[segment] = std::make_unique<Node[]>(kNodesPerSegment);
+    }
+
+    Node& node = Get(id);
+    node.parent = parent;
+    node.frameId = frameId;
+    node.depth = parentNode.depth + 1;
+    node.nextSibling.store(
+        parentNode.firstChild.load(std::memory_order_relaxed),
+        std::memory_order_relaxed);
+
+    // Publishes the node and the segment pointer, then makes it reachable.
+    m_size.store(id + 1, std::memory_order_release);
+    parentNode.firstChild.store(id, std::memory_order_release);
+
+    m_index.emplace(key, id);
+    return id;
+}
+
+void FlameGraph::Count(uint32_t node, int64_t now) {
+    Node& counted = Get(node);
+
+    // Single writer, no need for read-modify-write.
+    counted.events.store(counted.events.load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+
+    if (m_lastTicks) {
+        const int64_t gap =
+            std::clamp<int64_t>(now - m_lastTicks, 0, m_maxGapTicks);
+        counted.ticks.store(counted.ticks.load(std::memory_order_relaxed) +
+                                static_cast<uint64_t>(gap),
+                            std::memory_order_relaxed);
+    }
+
+    m_lastTicks = now;
+}
+
+size_t FlameGraph::Write(JsonLinesWriter& out, FlameWeight weight) const {
+    // Frames of the current node and its ancestors, outermost first.
+    uint32_t stack[kMaxDepth];
+    size_t lines = 0;
+
+    uint32_t id = Get(kRoot).firstChild.load(std::memory_order_acquire);
+    while (id != kNone) {
+        const Node& node = Get(id);
+        stack[node.depth - 1] = node.frameId;
+
+        const uint64_t value =
+            weight == FlameWeight::kTime
+                ? TicksToMicroseconds(static_cast<int64_t>(
+                      node.ticks.load(std::memory_order_relaxed)))
+                : node.events.load(std::memory_order_relaxed);
+        if (value) {
+            for (uint32_t i = 0; i < node.depth; i++) {
+                if (i) {
+                    out.Raw(";");
+                }
+                out.Text(m_frames.Get(stack[i]));
+            }
+
+            out.Raw(" ");
+            out.Number(value);
+            out.Raw("\n");
+            lines++;
+        }
+
+        // Depth first: the first child, else the next sibling of the node
+        // or of its closest ancestor that has one.
+        uint32_t next = node.firstChild.load(std::memory_order_acquire);
+        for (uint32_t up = id; next == kNone && up != kRoot;
+             up = Get(up).parent) {
+            next = Get(up).nextSibling.load(std::memory_order_acquire);
+        }
+
+        id = next;
+    }
+
+    return lines;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+
+#include "jsonlineswriter.hpp"
+#include "pathtable.hpp"
+#include "settings.hpp"
+
+// SizeChanged activity rolled up per element path, for flame graphs.
+//
+// Paths are kept as a trie whose nodes are the elements' names, without the
+// [index] parts FindPathToRoot adds, so the items of a list share one
+// stack. Elements remember their node, which makes counting an event a
+// couple of stores, and writing the whole graph a single walk of the trie
+// in the folded-stack format flamegraph.pl, speedscope and others read:
+//
+//     Frame;Grid;ListView (Messages);ListViewItem 1234
+//
+// Like PathTable, nodes are append-only and never move, and the writer
+// publishes them before linking them in, so Write() runs lock-free from any
+// thread. Nodes past the memory budget or kMaxDepth are counted on their
+// deepest ancestor that fits.
+class FlameGraph {
+   public:
+    static constexpr uint32_t kRoot = 0;
+    static constexpr uint32_t kMaxDepth = 128;
+
+    FlameGraph();
+
+    FlameGraph(const FlameGraph&) = delete;
+    FlameGraph& operator=(const FlameGraph&) = delete;
+
+    // Writer only. The node for an element named frame below parent.
+    uint32_t Child(uint32_t parent, std::wstring_view frame);
+
+    // Writer only. Counts an event, and the time since the previous one up
+    // to a frame at 60 Hz, which is roughly the layout work that led to it.
+    void Count(uint32_t node, int64_t now);
+
+    // Any thread. Writes a line for each stack with a non-zero weight and
+    // returns how many were written.
+    size_t Write(JsonLinesWriter& out, FlameWeight weight) const;
+
+   private:
+    struct Node {
+        uint32_t parent;
+        uint32_t frameId;
+        uint32_t depth;
+        // Children are linked newest first.
+        std::atomic<uint32_t> firstChild{kNone};
+        std::atomic<uint32_t> nextSibling{kNone};
+        std::atomic<uint64_t> events{0};
+        std::atomic<uint64_t> ticks{0};
+    };
+
+    static constexpr uint32_t kNone = UINT32_MAX;
+    static constexpr uint32_t kNodesPerSegment = 4096;
+    static constexpr uint32_t kMaxSegments = 64;
+
+    Node& Get(uint32_t id) const {
+        return m_segments[id / kNodesPerSegment][id % kNodesPerSegment];
+    }
+
+    // Element names, interned once however many stacks they appear in.
+    PathTable m_frames;
+    std::unique_ptr<Node[]> m_segments[kMaxSegments];
+    std::atomic<uint32_t> m_size{0};
+
+    // Writer-only state. Keyed by parent node and frame id.
+    std::unordered_map<uint64_t, uint32_t> m_index;
+    const int64_t m_maxGapTicks;
+    int64_t m_lastTicks = 0;
+};
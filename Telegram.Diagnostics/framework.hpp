@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../common/sessioninfo.h"
+#include "winrt.hpp"
+
+// The XAML frameworks the watcher can attach to. Both expose the same
+// diagnostics interfaces (xamlom.h) and the same element model under
+// different namespaces, so the watcher is a template over one of these and
+// each gets its own code with no runtime switch.
+
+struct UwpFramework {
+    // As passed to start().
+    static constexpr session::Framework kId = session::kFrameworkUWP;
+
+    using Application = wux::Application;
+    using FrameworkElement = wux::FrameworkElement;
+    using SizeChangedEventArgs = wux::SizeChangedEventArgs;
+    using UnhandledExceptionEventArgs = wux::UnhandledExceptionEventArgs;
+    // EffectiveViewportChanged was added in 1809, not every element has it.
+    using ViewportElement = wux::IFrameworkElement7;
+    using DispatcherQueue = winrt::Windows::System::DispatcherQueue;
+    using DispatcherQueuePriority =
+        winrt::Windows::System::DispatcherQueuePriority;
+};
+
+struct WinUIFramework {
+    static constexpr session::Framework kId = session::kFrameworkWinUI;
+
+    using Application = mux::Application;
+    using FrameworkElement = mux::FrameworkElement;
+    using SizeChangedEventArgs = mux::SizeChangedEventArgs;
+    using UnhandledExceptionEventArgs = mux::UnhandledExceptionEventArgs;
+    using ViewportElement = mux::FrameworkElement;
+    using DispatcherQueue = winrt::Microsoft::UI::Dispatching::DispatcherQueue;
+    using DispatcherQueuePriority =
+        winrt::Microsoft::UI::Dispatching::DispatcherQueuePriority;
+};
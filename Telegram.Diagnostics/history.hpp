@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+#include "../common/traceformat.h"
+
+using EventKind = trace::EventKind;
+
+constexpr std::string_view EventKindName(EventKind kind) {
+    switch (kind) {
+        case EventKind::kSizeChanged:
+            return "SizeChanged";
+        case EventKind::kEffectiveViewportChanged:
+            return "EffectiveViewportChanged";
+        case EventKind::kLoaded:
+            return "Loaded";
+        case EventKind::kUnloaded:
+            return "Unloaded";
+        case EventKind::kLayoutUpdated:
+            return "LayoutUpdated";
+    }
+
+    return "Unknown";
+}
+
+// One recorded event. Trivially copyable so it can live in seqlock slots
+// and be delta-encoded by the archive.
+struct HistoryItem {
+    int64_t timestamp;
+    InstanceHandle handle;
+    uint32_t pathId;
+    // In the watcher's StackTable, StackTable::kInvalidId unless stacks are
+    // captured for the event.
+    uint32_t stackId;
+    // Set by the HistoryFolder on the last event of a run that repeated:
+    // the run's last `period` events, up to this one, happened `repeats`
+    // more times after it.
+    uint32_t repeats;
+    EventKind kind;
+    uint8_t period;
+};
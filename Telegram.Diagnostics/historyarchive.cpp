@@ -0,0 +1,202 @@
+#include "stdafx.h"
+
+#include "historyarchive.hpp"
+
+#include "../common/lz.h"
+
+namespace {
+
+uint64_t ZigZag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^
+           static_cast<uint64_t>(value >> 63);
+}
+
+int64_t UnZigZag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+uint8_t* WriteVarint(uint8_t* p, uint64_t value) {
+    while (value >= 0x80) {
+        *p++ = static_cast<uint8_t>(value | 0x80);
+        value >>= 7;
+    }
+
+    *p++ = static_cast<uint8_t>(value);
+    return p;
+}
+
+bool ReadVarint(const uint8_t*& p, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const uint8_t byte = *p++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}  // namespace
+
+HistoryArchive::HistoryArchive() {
+    m_work = CreateThreadpoolWork(CompressCallback, this, nullptr);
+}
+
+HistoryArchive::~HistoryArchive() {
+    if (m_work) {
+        WaitForThreadpoolWorkCallbacks(m_work, TRUE);
+        CloseThreadpoolWork(m_work);
+    }
+}
+
+void HistoryArchive::Push(const HistoryItem& item) {
+    if (m_openCount == kBlockRecords) {
+        bool sealed = false;
+        {
+            std::scoped_lock lock(m_mutex);
+
+            // The front block may be being encoded, the others are free.
+            if (m_sealedSize < kSealedBlocks) {
+                RawBlock& block =
+                    m_sealed[(m_sealedFirst + m_sealedSize) % kSealedBlocks];
+                memcpy(block.items, m_open, sizeof(m_open));
+                m_sealedSize++;
+                sealed = true;
+            } else {
+                m_droppedBlocks++;
+            }
+
+            m_sealedCount += kBlockRecords;
+        }
+
+        m_openCount = 0;
+
+        if (sealed && m_work) {
+            SubmitThreadpoolWork(m_work);
+        }
+    }
+
+    m_open[m_openCount++] = item;
+}
+
+void HistoryArchive::ReplaceBack(const HistoryItem& item) {
+    if (m_openCount == 0) {
+        Push(item);
+        return;
+    }
+
+    m_open[m_openCount - 1] = item;
+}
+
+void CALLBACK HistoryArchive::CompressCallback(PTP_CALLBACK_INSTANCE,
+                                               PVOID context,
+                                               PTP_WORK) {
+    static_cast<HistoryArchive*>(context)->CompressSealed();
+}
+
+void HistoryArchive::CompressSealed() {
+    // Callbacks of the same work object can run concurrently.
+    std::scoped_lock compressLock(m_compressMutex);
+
+    while (true) {
+        // Only the worker holding m_compressMutex removes sealed blocks, so
+        // the front stays put while it's being encoded outside m_mutex.
+        const RawBlock* block;
+        {
+            std::scoped_lock lock(m_mutex);
+            if (m_sealedSize == 0) {
+                return;
+            }
+
+            block = &m_sealed[m_sealedFirst];
+        }
+
+        CompressedBlock compressed = Encode(*block);
+
+        std::scoped_lock lock(m_mutex);
+
+        m_sealedFirst = (m_sealedFirst + 1) % kSealedBlocks;
+        m_sealedSize--;
+
+        m_compressedBytes += compressed.data.size();
+        m_blocks.push_back(std::move(compressed));
+
+        while (m_compressedBytes > kMaxCompressedBytes && !m_blocks.empty()) {
+            m_compressedBytes -= m_blocks.front().data.size();
+            m_blocks.pop_front();
+        }
+    }
+}
+
+HistoryArchive::CompressedBlock HistoryArchive::Encode(const RawBlock& block) {
+    // Consecutive records are mostly the same few elements, so deltas
+    // against the previous record are small and repeat, which is what the
+    // LZ pass then folds.
+    uint8_t encoded[kMaxEncodedBytes];
+    uint8_t* p = encoded;
+
+    HistoryItem previous{};
+    for (const auto& item : block.items) {
+        p = WriteVarint(p, ZigZag(item.timestamp - previous.timestamp));
+        p = WriteVarint(p, ZigZag(static_cast<int64_t>(item.handle -
+                                                       previous.handle)));
+        p = WriteVarint(p, ZigZag(static_cast<int64_t>(item.pathId) -
+                                  static_cast<int64_t>(previous.pathId)));
+        p = WriteVarint(p, ZigZag(static_cast<int64_t>(item.stackId) -
+                                  static_cast<int64_t>(previous.stackId)));
+        // Mostly 0, so not a delta.
+        p = WriteVarint(p, item.repeats);
+        *p++ = static_cast<uint8_t>(item.kind);
+        *p++ = item.period;
+        previous = item;
+    }
+
+    const size_t encodedSize = p - encoded;
+
+    CompressedBlock compressed{.count = kBlockRecords, .data = {}};
+    compressed.data.resize(lz::CompressBound(encodedSize));
+    compressed.data.resize(lz::Compress(encoded, encodedSize,
+                                        compressed.data.data(),
+                                        compressed.data.size()));
+    compressed.data.shrink_to_fit();
+    return compressed;
+}
+
+bool HistoryArchive::Decode(const CompressedBlock& block,
+                            HistoryItem* items,
+                            size_t& count) {
+    size_t encodedSize;
+    if (!lz::Decompress(block.data.data(), block.data.size(), m_decodeBytes,
+                        sizeof(m_decodeBytes), encodedSize)) {
+        return false;
+    }
+
+    const uint8_t* p = m_decodeBytes;
+    const uint8_t* end = m_decodeBytes + encodedSize;
+
+    HistoryItem previous{};
+    for (count = 0; count < block.count && count < kBlockRecords; count++) {
+        uint64_t timestamp, handle, pathId, stackId, repeats;
+        if (!ReadVarint(p, end, timestamp) || !ReadVarint(p, end, handle) ||
+            !ReadVarint(p, end, pathId) || !ReadVarint(p, end, stackId) ||
+            !ReadVarint(p, end, repeats) || end - p < 2) {
+            return false;
+        }
+
+        HistoryItem& item = items[count];
+        item.timestamp = previous.timestamp + UnZigZag(timestamp);
+        item.handle = previous.handle + UnZigZag(handle);
+        item.pathId =
+            static_cast<uint32_t>(previous.pathId + UnZigZag(pathId));
+        item.stackId =
+            static_cast<uint32_t>(previous.stackId + UnZigZag(stackId));
+        item.repeats = static_cast<uint32_t>(repeats);
+        item.kind = static_cast<EventKind>(*p++);
+        item.period = *p++;
+        previous = item;
+    }
+
+    return true;
+}
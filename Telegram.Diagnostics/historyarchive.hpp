@@ -0,0 +1,127 @@
+#pragma once
+
+#include "history.hpp"
+
+#include <deque>
+
+// Holds history older than the live ring in compressed blocks.
+//
+// Records are appended to an open block as they are pushed to the ring.
+// Once the block is full it is sealed and handed to a thread pool worker,
+// which delta-encodes node ids and timestamps and runs an LZ pass over the
+// result. Blocks are only decompressed when the history is dumped, and the
+// oldest ones are dropped once the compressed size exceeds the budget.
+//
+// A block is smaller than the ring, so every record that isn't archived
+// yet is still in the ring: a dump is the archive followed by the ring
+// entries from ArchivedCount() on.
+//
+// Sealed blocks wait for the compressor in a fixed ring, so that Push()
+// never allocates: the crash handler pushes the events a folder still
+// holds. If the compressor falls kSealedBlocks behind, newly sealed blocks
+// are dropped and counted.
+class HistoryArchive {
+   public:
+    static constexpr size_t kBlockRecords = 128;
+    static constexpr size_t kSealedBlocks = 8;
+    static constexpr size_t kMaxCompressedBytes = 512 * 1024;
+    // Five varints, the kind and the period per record: 10 + 10 + 5 + 5 +
+    // 5 + 1 + 1 bytes at most.
+    static constexpr size_t kMaxEncodedBytes = kBlockRecords * 37;
+
+    HistoryArchive();
+    ~HistoryArchive();
+
+    HistoryArchive(const HistoryArchive&) = delete;
+    HistoryArchive& operator=(const HistoryArchive&) = delete;
+
+    // Writer only, mirrors SeqlockRing::Push and ReplaceBack.
+    void Push(const HistoryItem& item);
+    void ReplaceBack(const HistoryItem& item);
+
+    // Any thread. Calls visit(const HistoryItem&) for every archived record
+    // still held, oldest first, and returns the number of records ever
+    // sealed into blocks. Blocks the compressor while it runs but doesn't
+    // allocate.
+    template <typename Visitor>
+    uint64_t ForEach(Visitor&& visit) {
+        std::scoped_lock lock(m_mutex);
+
+        for (const auto& block : m_blocks) {
+            size_t count;
+            if (!Decode(block, m_decoded, count)) {
+                continue;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                visit(m_decoded[i]);
+            }
+        }
+
+        for (size_t i = 0; i < m_sealedSize; i++) {
+            const auto& block = m_sealed[(m_sealedFirst + i) % kSealedBlocks];
+            for (const auto& item : block.items) {
+                visit(item);
+            }
+        }
+
+        return m_sealedCount;
+    }
+
+    // Any thread.
+    size_t CompressedBytes() {
+        std::scoped_lock lock(m_mutex);
+        return m_compressedBytes;
+    }
+
+    // Any thread. Blocks sealed while the compressor was kSealedBlocks
+    // behind.
+    uint64_t DroppedBlocks() {
+        std::scoped_lock lock(m_mutex);
+        return m_droppedBlocks;
+    }
+
+   private:
+    struct RawBlock {
+        HistoryItem items[kBlockRecords];
+    };
+
+    struct CompressedBlock {
+        uint32_t count;
+        std::vector<uint8_t> data;
+    };
+
+    static void CALLBACK CompressCallback(PTP_CALLBACK_INSTANCE instance,
+                                          PVOID context,
+                                          PTP_WORK work);
+    void CompressSealed();
+
+    static CompressedBlock Encode(const RawBlock& block);
+    bool Decode(const CompressedBlock& block,
+                HistoryItem* items,
+                size_t& count);
+
+    // Writer-only open block.
+    HistoryItem m_open[kBlockRecords];
+    size_t m_openCount = 0;
+
+    PTP_WORK m_work = nullptr;
+
+    // Held by a worker for its whole drain of m_sealed.
+    std::mutex m_compressMutex;
+
+    // Guards everything below.
+    std::mutex m_mutex;
+    RawBlock m_sealed[kSealedBlocks];
+    size_t m_sealedFirst = 0;
+    size_t m_sealedSize = 0;
+    std::deque<CompressedBlock> m_blocks;
+    size_t m_compressedBytes = 0;
+    uint64_t m_sealedCount = 0;
+    uint64_t m_droppedBlocks = 0;
+
+    // Decode buffers, preallocated so that dumping from a crash handler
+    // doesn't need the heap.
+    HistoryItem m_decoded[kBlockRecords];
+    uint8_t m_decodeBytes[kMaxEncodedBytes];
+};
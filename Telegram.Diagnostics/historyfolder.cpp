@@ -0,0 +1,68 @@
+#include "stdafx.h"
+
+#include "historyfolder.hpp"
+
+uint32_t HistoryFolder::FindPeriod(const HistoryItem& item) const {
+    const uint64_t available = std::min<uint64_t>(m_recorded, kMaxPeriod);
+
+    // A repeat of events that are already folded would nest, and the last
+    // event can't close two runs.
+    for (uint32_t distance = 1; distance <= available; distance++) {
+        const HistoryItem& recent = Recent(distance);
+        if (recent.period) {
+            return 0;
+        }
+
+        if (SameEvent(item, recent)) {
+            return distance;
+        }
+    }
+
+    return 0;
+}
+
+size_t UnfoldHistory(const HistoryItem* items,
+                     size_t count,
+                     HistoryItem* out,
+                     size_t maxCount) {
+    // Backwards from the most recent event, filling out from its end.
+    size_t written = 0;
+    auto emit = [&](const HistoryItem& item) {
+        if (written == maxCount) {
+            return false;
+        }
+
+        HistoryItem& copy = out[maxCount - ++written];
+        copy = item;
+        copy.period = 0;
+        copy.repeats = 0;
+        return true;
+    };
+
+    for (size_t i = count; i-- > 0;) {
+        const HistoryItem& item = items[i];
+
+        // The repeats come after the first time around, which is the run's
+        // events themselves, next in this loop. A run whose start was
+        // evicted repeats what is left of it.
+        const size_t period = std::min<size_t>(item.period, i + 1);
+        for (uint32_t repeat = 0; period && repeat < item.repeats; repeat++) {
+            for (size_t j = 0; j < period; j++) {
+                if (!emit(items[i - j])) {
+                    break;
+                }
+            }
+
+            if (written == maxCount) {
+                break;
+            }
+        }
+
+        if (!emit(item)) {
+            break;
+        }
+    }
+
+    memmove(out, out + maxCount - written, written * sizeof(HistoryItem));
+    return written;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+
+#include "history.hpp"
+
+// Folds repeating runs of events before they reach the history, so that a
+// layout cycle takes its period in the ring instead of all of it, and the
+// events that led up to it stay.
+//
+// An event that matches the one period events back, for the shortest such
+// period up to kMaxPeriod, is held instead of recorded, and so are the
+// events after it while they go on repeating the last period recorded
+// ones. Once a whole period has repeated, the last recorded event gets
+// that period and a repeat count, which then goes up by one for each
+// further repeat. Held events are recorded as they are when the run
+// breaks, or on Flush().
+//
+// Events are the same if their element, path and kind are, their
+// timestamps and stacks are those of the first time around.
+class HistoryFolder {
+   public:
+    static constexpr uint32_t kMaxPeriod = 16;
+
+    // Writer only. Calls push(const HistoryItem&) for each event that is
+    // recorded and replaceBack(const HistoryItem&) when the repeat count of
+    // the last one changes.
+    template <typename Push, typename ReplaceBack>
+    void Append(const HistoryItem& item,
+                Push&& push,
+                ReplaceBack&& replaceBack) {
+        if (m_period && !SameEvent(item, Recent(m_period - m_heldCount))) {
+            Flush(push);
+        }
+
+        if (!m_period) {
+            m_period = FindPeriod(item);
+            if (!m_period) {
+                Record(item, push);
+                return;
+            }
+        }
+
+        m_held[m_heldCount++] = item;
+        if (m_heldCount < m_period) {
+            return;
+        }
+
+        m_heldCount = 0;
+
+        HistoryItem& back = m_recent[(m_recorded - 1) % kMaxPeriod];
+        if (!back.period) {
+            back.period = static_cast<uint8_t>(m_period);
+            back.repeats = 0;
+        }
+
+        if (back.repeats < UINT32_MAX) {
+            back.repeats++;
+        }
+
+        replaceBack(back);
+    }
+
+    // Writer only. Records the held events, which ends the current run.
+    template <typename Push>
+    void Flush(Push&& push) {
+        const uint32_t count = m_heldCount;
+        m_period = 0;
+        m_heldCount = 0;
+
+        for (uint32_t i = 0; i < count; i++) {
+            Record(m_held[i], push);
+        }
+    }
+
+    // Writer only. Whether nothing is held, so that the last recorded event
+    // is the last one appended.
+    bool Idle() const { return m_period == 0; }
+
+    // Writer only. The last recorded event was replaced in the history.
+    void ReplacedBack(const HistoryItem& item) {
+        if (m_recorded) {
+            m_recent[(m_recorded - 1) % kMaxPeriod] = item;
+        }
+    }
+
+   private:
+    static bool SameEvent(const HistoryItem& a, const HistoryItem& b) {
+        return a.handle == b.handle && a.pathId == b.pathId &&
+               a.kind == b.kind;
+    }
+
+    // The recorded event distance back, 1 for the last one.
+    const HistoryItem& Recent(uint32_t distance) const {
+        return m_recent[(m_recorded - distance) % kMaxPeriod];
+    }
+
+    template <typename Push>
+    void Record(const HistoryItem& item, Push& push) {
+        m_recent[m_recorded++ % kMaxPeriod] = item;
+        push(item);
+    }
+
+    // The shortest period item would start a repeat of, 0 if none.
+    uint32_t FindPeriod(const HistoryItem& item) const;
+
+    // The last recorded events, as recorded.
+    HistoryItem m_recent[kMaxPeriod]{};
+    uint64_t m_recorded = 0;
+
+    // Of the current run, 0 if there is none.
+    uint32_t m_period = 0;
+    // Events of the current repeat, not recorded yet.
+    HistoryItem m_held[kMaxPeriod];
+    uint32_t m_heldCount = 0;
+};
+
+// Expands folded repeats in items, oldest first, back into the events they
+// stand for, and copies the most recent maxCount of those to out. Returns
+// how many were copied. Doesn't allocate.
+size_t UnfoldHistory(const HistoryItem* items,
+                     size_t count,
+                     HistoryItem* out,
+                     size_t maxCount);
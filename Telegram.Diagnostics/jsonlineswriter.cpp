@@ -0,0 +1,344 @@
+#include "stdafx.h"
+
+#include "jsonlineswriter.hpp"
+
+#include "stringkernels.hpp"
+
+namespace {
+
+// Decodes the code point at value[i], advancing i past a surrogate pair.
+uint32_t NextCodePoint(std::wstring_view value, size_t& i) {
+    uint32_t c = value[i];
+
+    if (c >= 0xD800 && c <= 0xDBFF && i + 1 < value.size() &&
+        value[i + 1] >= 0xDC00 && value[i + 1] <= 0xDFFF) {
+        c = 0x10000 + ((c - 0xD800) << 10) + (value[i + 1] - 0xDC00);
+        i++;
+    } else if (c >= 0xD800 && c <= 0xDFFF) {
+        // Lone surrogate.
+        c = 0xFFFD;
+    }
+
+    return c;
+}
+
+}  // namespace
+
+JsonLinesWriter::JsonLinesWriter(std::wstring filePath, size_t capacity)
+    : m_filePath(std::move(filePath)),
+      m_capacity(capacity),
+      // Default-initialized on purpose, so the pages aren't touched until a
+      // report is actually written.
+      m_buffer(new char[capacity]) {}
+
+JsonLinesWriter::~JsonLinesWriter() {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+    }
+}
+
+void JsonLinesWriter::Reset() {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    m_size = 0;
+    m_failed = false;
+}
+
+void JsonLinesWriter::Reset(std::wstring filePath) {
+    Reset();
+    m_filePath = std::move(filePath);
+}
+
+void JsonLinesWriter::BeginLine() {
+    m_nesting = 0;
+    Open('{');
+}
+
+void JsonLinesWriter::EndLine() {
+    Close('}');
+    Put('\n');
+}
+
+void JsonLinesWriter::BeginArray(std::string_view key) {
+    Key(key);
+    Open('[');
+}
+
+void JsonLinesWriter::EndArray() {
+    Close(']');
+}
+
+void JsonLinesWriter::BeginObject(std::string_view key) {
+    Key(key);
+    Open('{');
+}
+
+void JsonLinesWriter::BeginObject() {
+    Separator();
+    Open('{');
+}
+
+void JsonLinesWriter::EndObject() {
+    Close('}');
+}
+
+void JsonLinesWriter::Value(uint64_t value) {
+    Separator();
+    PutUnsigned(value);
+}
+
+void JsonLinesWriter::Value(double value) {
+    Separator();
+
+    if (!std::isfinite(value)) {
+        Raw("null");
+        return;
+    }
+
+    const bool negative = value < 0;
+    value = std::abs(value);
+
+    // Past 2^53 there are no decimals left anyway.
+    if (value >= 9007199254740992.0) {
+        if (negative) {
+            Put('-');
+        }
+        PutUnsigned(static_cast<uint64_t>(value));
+        return;
+    }
+
+    const uint64_t hundredths = static_cast<uint64_t>(value * 100 + 0.5);
+    if (negative && hundredths) {
+        Put('-');
+    }
+    PutUnsigned(hundredths / 100);
+
+    const uint64_t fraction = hundredths % 100;
+    if (fraction) {
+        Put('.');
+        Put(static_cast<char>('0' + fraction / 10));
+        if (fraction % 10) {
+            Put(static_cast<char>('0' + fraction % 10));
+        }
+    }
+}
+
+void JsonLinesWriter::Value(std::wstring_view value) {
+    Separator();
+    StringBegin();
+    StringPart(value);
+    StringEnd();
+}
+
+void JsonLinesWriter::Separator() {
+    if (m_nesting == 0) {
+        return;
+    }
+
+    if (!m_first[m_nesting - 1]) {
+        Put(',');
+    }
+
+    m_first[m_nesting - 1] = false;
+}
+
+void JsonLinesWriter::Open(char c) {
+    Put(c);
+
+    // Not meant to go deeper, past kMaxNesting levels share a flag.
+    if (m_nesting < kMaxNesting) {
+        m_nesting++;
+    }
+
+    m_first[m_nesting - 1] = true;
+}
+
+void JsonLinesWriter::Close(char c) {
+    Put(c);
+
+    if (m_nesting) {
+        m_nesting--;
+    }
+}
+
+void JsonLinesWriter::Key(std::string_view key) {
+    Separator();
+
+    Put('"');
+    Raw(key);
+    Put('"');
+    Put(':');
+}
+
+void JsonLinesWriter::Field(std::string_view key, std::string_view value) {
+    Key(key);
+    Put('"');
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            Put('\\');
+        }
+
+        Put(c);
+    }
+    Put('"');
+}
+
+void JsonLinesWriter::Field(std::string_view key, std::wstring_view value) {
+    Key(key);
+    StringBegin();
+    StringPart(value);
+    StringEnd();
+}
+
+void JsonLinesWriter::Field(std::string_view key, uint64_t value) {
+    Key(key);
+    PutUnsigned(value);
+}
+
+void JsonLinesWriter::Field(std::string_view key, int64_t value) {
+    Key(key);
+
+    if (value < 0) {
+        Put('-');
+        PutUnsigned(0 - static_cast<uint64_t>(value));
+    } else {
+        PutUnsigned(static_cast<uint64_t>(value));
+    }
+}
+
+void JsonLinesWriter::HexField(std::string_view key, uint64_t value) {
+    Key(key);
+
+    char digits[16];
+    const size_t count = FormatHex(value, digits);
+
+    Put('"');
+    Put('0');
+    Put('x');
+    Raw({digits + 16 - count, count});
+    Put('"');
+}
+
+void JsonLinesWriter::RawField(std::string_view key, std::string_view value) {
+    Key(key);
+    Raw(value);
+}
+
+void JsonLinesWriter::StringPart(std::wstring_view value) {
+    for (size_t i = 0; i < value.size(); i++) {
+        // Paths are mostly plain ASCII, copied a run at a time.
+        const size_t plain = PlainAsciiLength(value.substr(i));
+        if (plain) {
+            PutAscii(value.substr(i, plain));
+            i += plain;
+            if (i == value.size()) {
+                break;
+            }
+        }
+
+        const uint32_t c = NextCodePoint(value, i);
+
+        if (c == '"' || c == '\\') {
+            Put('\\');
+            Put(static_cast<char>(c));
+        } else if (c < 0x20) {
+            Raw("\\u00");
+            Put("0123456789abcdef"[c >> 4]);
+            Put("0123456789abcdef"[c & 0xF]);
+        } else {
+            PutUtf8(c);
+        }
+    }
+}
+
+void JsonLinesWriter::Text(std::wstring_view value) {
+    for (size_t i = 0; i < value.size(); i++) {
+        PutUtf8(NextCodePoint(value, i));
+    }
+}
+
+void JsonLinesWriter::PutAscii(std::wstring_view value) {
+    while (!value.empty()) {
+        if (m_size == m_capacity) {
+            Flush();
+        }
+
+        const size_t count = std::min(value.size(), m_capacity - m_size);
+        NarrowAscii(value.data(), count, m_buffer.get() + m_size);
+        m_size += count;
+        value.remove_prefix(count);
+    }
+}
+
+void JsonLinesWriter::PutUtf8(uint32_t c) {
+    if (c < 0x80) {
+        Put(static_cast<char>(c));
+    } else if (c < 0x800) {
+        Put(static_cast<char>(0xC0 | (c >> 6)));
+        Put(static_cast<char>(0x80 | (c & 0x3F)));
+    } else if (c < 0x10000) {
+        Put(static_cast<char>(0xE0 | (c >> 12)));
+        Put(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+        Put(static_cast<char>(0x80 | (c & 0x3F)));
+    } else {
+        Put(static_cast<char>(0xF0 | (c >> 18)));
+        Put(static_cast<char>(0x80 | ((c >> 12) & 0x3F)));
+        Put(static_cast<char>(0x80 | ((c >> 6) & 0x3F)));
+        Put(static_cast<char>(0x80 | (c & 0x3F)));
+    }
+}
+
+void JsonLinesWriter::PutUnsigned(uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        Put(digits[--count]);
+    }
+}
+
+void JsonLinesWriter::Raw(std::string_view value) {
+    for (char c : value) {
+        Put(c);
+    }
+}
+
+bool JsonLinesWriter::Finish() {
+    Flush();
+
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    return !m_failed;
+}
+
+void JsonLinesWriter::Flush() {
+    if (m_size == 0) {
+        return;
+    }
+
+    if (m_file == INVALID_HANDLE_VALUE && !m_failed) {
+        m_file = CreateFile(m_filePath.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                            nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+        m_failed = m_file == INVALID_HANDLE_VALUE;
+    }
+
+    DWORD written;
+    if (m_file != INVALID_HANDLE_VALUE &&
+        !WriteFile(m_file, m_buffer.get(), static_cast<DWORD>(m_size),
+                   &written, nullptr)) {
+        m_failed = true;
+    }
+
+    m_size = 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Formats JSON Lines into a buffer allocated up front, for code that must
+// not touch the heap, like the crash handler. Strings are converted from
+// UTF-16 and escaped in place, numbers are formatted by hand without the
+// CRT's locale machinery. The file is created on the first flush, so a
+// report that fits in the buffer is written with a single WriteFile.
+class JsonLinesWriter {
+   public:
+    JsonLinesWriter(std::wstring filePath, size_t capacity);
+    ~JsonLinesWriter();
+
+    JsonLinesWriter(const JsonLinesWriter&) = delete;
+    JsonLinesWriter& operator=(const JsonLinesWriter&) = delete;
+
+    // Truncates the file on the next flush and starts over.
+    void Reset();
+    // Same, writing to filePath from now on.
+    void Reset(std::wstring filePath);
+
+    void BeginLine();
+    void EndLine();
+
+    void Field(std::string_view key, std::string_view value);
+    void Field(std::string_view key, std::wstring_view value);
+    void Field(std::string_view key, uint64_t value);
+    void Field(std::string_view key, int64_t value);
+    void HexField(std::string_view key, uint64_t value);
+    // value must already be valid JSON (an object, array or literal).
+    void RawField(std::string_view key, std::string_view value);
+
+    // Nested values. BeginObject() without a key and Value() are for array
+    // elements.
+    void BeginArray(std::string_view key);
+    void EndArray();
+    void BeginObject(std::string_view key);
+    void BeginObject();
+    void EndObject();
+    void Value(uint64_t value);
+    // Rounded to two decimals, null if not finite.
+    void Value(double value);
+    void Value(std::wstring_view value);
+
+    // Low-level pieces for values the helpers above don't cover.
+    void Key(std::string_view key);
+    void StringBegin() { Put('"'); }
+    void StringEnd() { Put('"'); }
+    void StringPart(std::wstring_view value);
+    void Raw(std::string_view value);
+
+    // Plain text, for files that aren't JSON: UTF-8 without escaping, and
+    // numbers outside of a field.
+    void Text(std::wstring_view value);
+    void Number(uint64_t value) { PutUnsigned(value); }
+
+    // Writes out whatever is buffered and closes the file.
+    bool Finish();
+
+   private:
+    void Put(char c) {
+        if (m_size == m_capacity) {
+            Flush();
+        }
+
+        m_buffer[m_size++] = c;
+    }
+
+    void Separator();
+    void Open(char c);
+    void Close(char c);
+    void PutUnsigned(uint64_t value);
+    // value must be ASCII.
+    void PutAscii(std::wstring_view value);
+    void PutUtf8(uint32_t c);
+    void Flush();
+
+    std::wstring m_filePath;
+    const size_t m_capacity;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_size = 0;
+    // Whether nothing was written yet in the current object or array, for
+    // each nesting level.
+    static constexpr size_t kMaxNesting = 8;
+    bool m_first[kMaxNesting]{};
+    size_t m_nesting = 0;
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    bool m_failed = false;
+};
@@ -0,0 +1,68 @@
+#include "stdafx.h"
+
+#include "latencyhistogram.hpp"
+
+#include "clock.hpp"
+
+namespace {
+
+// Without the overflow of ticks * 1000000000 past a few minutes' worth.
+uint64_t TicksToNanoseconds(uint64_t ticks) {
+    const uint64_t frequency = static_cast<uint64_t>(TicksPerSecond());
+    return ticks / frequency * 1000000000 +
+           ticks % frequency * 1000000000 / frequency;
+}
+
+}  // namespace
+
+uint64_t LatencyHistogram::BucketUpperBound(uint32_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+
+    if (index == kBuckets - 1) {
+        return UINT64_MAX;
+    }
+
+    const uint32_t shift = (index - kSubBuckets) / kSubBuckets;
+    const uint64_t subBucket = (index - kSubBuckets) % kSubBuckets;
+    return ((kSubBuckets + subBucket + 1) << shift) - 1;
+}
+
+LatencyHistogram::Summary LatencyHistogram::Summarize() const {
+    uint64_t counts[kBuckets];
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < kBuckets; i++) {
+        counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+        count += counts[i];
+    }
+
+    const uint64_t maxTicks = m_maxTicks.load(std::memory_order_relaxed);
+
+    // The value at a rank, 1-based, capped by the maximum seen.
+    auto valueAt = [&](uint64_t rank) -> uint64_t {
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < kBuckets; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(BucketUpperBound(i), maxTicks);
+            }
+        }
+
+        return maxTicks;
+    };
+
+    Summary summary{};
+    summary.count = count;
+    if (count) {
+        summary.p50Nanoseconds = TicksToNanoseconds(valueAt((count + 1) / 2));
+        summary.p99Nanoseconds =
+            TicksToNanoseconds(valueAt(count - count / 100));
+        summary.maxNanoseconds = TicksToNanoseconds(maxTicks);
+        summary.totalMicroseconds =
+            TicksToNanoseconds(m_totalTicks.load(std::memory_order_relaxed)) /
+            1000;
+    }
+
+    return summary;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+// Durations in QueryPerformanceCounter ticks, counted in log-linear buckets
+// as in HdrHistogram: 8 linear sub-buckets per power of two, so any value
+// is known within 12.5%, from a single tick up to hours, in a few KB.
+//
+// Record() is a handful of relaxed loads and stores, no read-modify-write:
+// each histogram must have a single writer at a time, which the callers
+// get from the lock they already hold. Readers summarize lock-free from
+// any thread and may see a record half applied.
+class LatencyHistogram {
+   public:
+    static constexpr uint32_t kSubBucketBits = 3;
+    static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+    // Values of 2^(kMaxExponent + 1) ticks and more share the last bucket.
+    static constexpr uint32_t kMaxExponent = 39;
+    static constexpr uint32_t kBuckets =
+        kSubBuckets + (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    struct Summary {
+        uint64_t count;
+        // Upper bounds of the buckets the percentiles fall in, in ns.
+        uint64_t p50Nanoseconds;
+        uint64_t p99Nanoseconds;
+        uint64_t maxNanoseconds;
+        uint64_t totalMicroseconds;
+    };
+
+    LatencyHistogram() = default;
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Single writer.
+    void Record(int64_t ticks) {
+        const uint64_t value = ticks > 0 ? static_cast<uint64_t>(ticks) : 0;
+
+        auto& bucket = m_buckets[BucketIndex(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_relaxed);
+        m_totalTicks.store(m_totalTicks.load(std::memory_order_relaxed) + value,
+                           std::memory_order_relaxed);
+        if (value > m_maxTicks.load(std::memory_order_relaxed)) {
+            m_maxTicks.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Any thread.
+    Summary Summarize() const;
+
+   private:
+    static uint32_t BucketIndex(uint64_t value) {
+        if (value < kSubBuckets) {
+            return static_cast<uint32_t>(value);
+        }
+
+        const uint32_t exponent = std::bit_width(value) - 1;
+        if (exponent > kMaxExponent) {
+            return kBuckets - 1;
+        }
+
+        const uint32_t shift = exponent - kSubBucketBits;
+        return kSubBuckets + shift * kSubBuckets +
+               static_cast<uint32_t>((value >> shift) & (kSubBuckets - 1));
+    }
+
+    // The largest value that lands in bucket index.
+    static uint64_t BucketUpperBound(uint32_t index);
+
+    std::atomic<uint64_t> m_buckets[kBuckets]{};
+    std::atomic<uint64_t> m_totalTicks{0};
+    std::atomic<uint64_t> m_maxTicks{0};
+};
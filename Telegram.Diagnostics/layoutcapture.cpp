@@ -0,0 +1,153 @@
+#include "stdafx.h"
+
+#include "layoutcapture.hpp"
+
+namespace {
+
+// Only the most recent events are looked at, as for the fingerprint.
+constexpr size_t kMaxItems = 256;
+
+bool IsZero(const double (&values)[4]) {
+    return values[0] == 0 && values[1] == 0 && values[2] == 0 &&
+           values[3] == 0;
+}
+
+void WritePair(JsonLinesWriter& report,
+               std::string_view key,
+               double first,
+               double second) {
+    report.BeginArray(key);
+    report.Value(first);
+    report.Value(second);
+    report.EndArray();
+}
+
+std::string_view AlignmentName(int32_t alignment, bool horizontal) {
+    switch (alignment) {
+        case 0:
+            return horizontal ? "Left" : "Top";
+        case 1:
+            return "Center";
+        case 2:
+            return horizontal ? "Right" : "Bottom";
+    }
+
+    return "Stretch";
+}
+
+}  // namespace
+
+size_t SelectParticipants(const HistoryItem* items,
+                          size_t count,
+                          LayoutProperties* out,
+                          size_t maxCount) {
+    if (count > kMaxItems) {
+        items += count - kMaxItems;
+        count = kMaxItems;
+    }
+
+    struct Candidate {
+        InstanceHandle handle;
+        uint32_t pathId;
+        uint32_t events;
+        // Of the most recent event, higher is more recent.
+        size_t last;
+    };
+
+    Candidate candidates[kMaxItems];
+    size_t candidateCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        Candidate* candidate = nullptr;
+        for (size_t j = 0; j < candidateCount; j++) {
+            if (candidates[j].handle == items[i].handle) {
+                candidate = &candidates[j];
+                break;
+            }
+        }
+
+        if (!candidate) {
+            candidate = &candidates[candidateCount++];
+            *candidate = {.handle = items[i].handle,
+                          .pathId = items[i].pathId,
+                          .events = 0,
+                          .last = i};
+        }
+
+        candidate->pathId = items[i].pathId;
+        candidate->events++;
+        candidate->last = i;
+    }
+
+    const size_t selected = std::min(candidateCount, maxCount);
+    std::partial_sort(candidates, candidates + selected,
+                      candidates + candidateCount,
+                      [](const Candidate& a, const Candidate& b) {
+                          if (a.events != b.events) {
+                              return a.events > b.events;
+                          }
+                          return a.last > b.last;
+                      });
+
+    for (size_t i = 0; i < selected; i++) {
+        out[i] = LayoutProperties{.handle = candidates[i].handle,
+                                  .pathId = candidates[i].pathId,
+                                  .events = candidates[i].events,
+                                  .hr = E_PENDING};
+    }
+
+    return selected;
+}
+
+void WriteLayoutProperties(JsonLinesWriter& report,
+                           const LayoutProperties& properties,
+                           bool pathKnown) {
+    report.BeginLine();
+    report.Field("type", std::string_view("layout"));
+    report.HexField("handle", properties.handle);
+    if (pathKnown) {
+        report.Field("path", uint64_t{properties.pathId});
+    }
+    report.Field("events", uint64_t{properties.events});
+
+    if (FAILED(properties.hr)) {
+        report.HexField("error", static_cast<uint32_t>(properties.hr));
+        report.EndLine();
+        return;
+    }
+
+    WritePair(report, "actual", properties.actualWidth,
+              properties.actualHeight);
+
+    // NaN is Auto, written as null.
+    if (!std::isnan(properties.width) || !std::isnan(properties.height)) {
+        WritePair(report, "size", properties.width, properties.height);
+    }
+    if (properties.minWidth != 0 || properties.minHeight != 0) {
+        WritePair(report, "min", properties.minWidth, properties.minHeight);
+    }
+    // Likewise, infinity is no maximum.
+    if (std::isfinite(properties.maxWidth) ||
+        std::isfinite(properties.maxHeight)) {
+        WritePair(report, "max", properties.maxWidth, properties.maxHeight);
+    }
+
+    if (!IsZero(properties.margin)) {
+        report.BeginArray("margin");
+        for (double value : properties.margin) {
+            report.Value(value);
+        }
+        report.EndArray();
+    }
+
+    if (properties.horizontalAlignment != 3) {
+        report.Field("hAlign",
+                     AlignmentName(properties.horizontalAlignment, true));
+    }
+    if (properties.verticalAlignment != 3) {
+        report.Field("vAlign",
+                     AlignmentName(properties.verticalAlignment, false));
+    }
+
+    report.EndLine();
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+
+#include "history.hpp"
+#include "jsonlineswriter.hpp"
+
+// The layout properties of a cycle participant, read when a report is
+// written and never before, so they cost nothing while the app runs.
+struct LayoutProperties {
+    InstanceHandle handle;
+    uint32_t pathId;
+    // Events of the element among the ones participants were picked from.
+    uint32_t events;
+    // S_OK once read. Reading fails for elements removed since, and is
+    // skipped for elements of another thread than a crash report's and
+    // for elements whose UI thread didn't answer a snapshot in time.
+    HRESULT hr;
+    double width;
+    double height;
+    double minWidth;
+    double minHeight;
+    double maxWidth;
+    double maxHeight;
+    double margin[4];
+    // HorizontalAlignment and VerticalAlignment, the same values in both
+    // frameworks.
+    int32_t horizontalAlignment;
+    int32_t verticalAlignment;
+    double actualWidth;
+    double actualHeight;
+};
+
+// Picks up to maxCount distinct elements from items, the ones with the
+// most events first and, among those, the most recent. Only handle,
+// pathId and events are set, hr is E_PENDING. Doesn't allocate.
+size_t SelectParticipants(const HistoryItem* items,
+                          size_t count,
+                          LayoutProperties* out,
+                          size_t maxCount);
+
+// Must run on the element's UI thread. Both frameworks' FrameworkElement
+// have the same properties.
+template <typename FrameworkElement>
+void ReadLayoutProperties(const FrameworkElement& element,
+                          LayoutProperties& properties) {
+    const auto margin = element.Margin();
+
+    properties.width = element.Width();
+    properties.height = element.Height();
+    properties.minWidth = element.MinWidth();
+    properties.minHeight = element.MinHeight();
+    properties.maxWidth = element.MaxWidth();
+    properties.maxHeight = element.MaxHeight();
+    properties.margin[0] = margin.Left;
+    properties.margin[1] = margin.Top;
+    properties.margin[2] = margin.Right;
+    properties.margin[3] = margin.Bottom;
+    properties.horizontalAlignment =
+        static_cast<int32_t>(element.HorizontalAlignment());
+    properties.verticalAlignment =
+        static_cast<int32_t>(element.VerticalAlignment());
+    properties.actualWidth = element.ActualWidth();
+    properties.actualHeight = element.ActualHeight();
+    properties.hr = S_OK;
+}
+
+// A "layout" report line. Properties at their default value (Auto size, no
+// minimum, no maximum, no margin, Stretch) are left out.
+void WriteLayoutProperties(JsonLinesWriter& report,
+                           const LayoutProperties& properties,
+                           bool pathKnown);
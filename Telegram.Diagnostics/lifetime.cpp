@@ -0,0 +1,213 @@
+#include "stdafx.h"
+
+#include "lifetime.hpp"
+
+#include "clock.hpp"
+#include "tracing.hpp"
+
+namespace {
+
+constexpr uint8_t kTypeUnknown = 0;
+constexpr uint8_t kTypeTransient = 1;
+constexpr uint8_t kTypeOther = 2;
+
+// Whether name is one of the items of the comma separated list.
+bool ListContains(std::wstring_view list, std::wstring_view name) {
+    while (!list.empty()) {
+        size_t end = list.find(L',');
+        if (list.substr(0, end) == name) {
+            return true;
+        }
+
+        list.remove_prefix(end == list.npos ? list.size() : end + 1);
+    }
+
+    return false;
+}
+
+size_t AgeBucket(uint32_t seconds) {
+    return std::min<size_t>(std::bit_width(seconds),
+                            LifetimeTracker::kAgeBuckets - 1);
+}
+
+}  // namespace
+
+LifetimeTracker::LifetimeTracker(const PathTable& paths,
+                                 const Settings& settings)
+    : m_paths(paths),
+      m_transientTypes(settings.transientTypes),
+      m_leakTicks(int64_t{settings.leakAge} * TicksPerSecond()),
+      m_summaryIntervalTicks(int64_t{settings.lifetimeSummary} *
+                             TicksPerSecond()),
+      m_startTicks(QueryTicks()),
+      m_nextSummary(m_startTicks + m_summaryIntervalTicks) {}
+
+bool LifetimeTracker::IsTransientType(uint32_t typeId,
+                                      std::wstring_view typeName) {
+    if (typeId == PathTable::kInvalidId) {
+        return ListContains(m_transientTypes, typeName);
+    }
+
+    if (typeId >= m_typeKinds.size()) {
+        m_typeKinds.resize(typeId + 1, kTypeUnknown);
+    }
+
+    if (m_typeKinds[typeId] == kTypeUnknown) {
+        m_typeKinds[typeId] = ListContains(m_transientTypes, typeName)
+                                  ? kTypeTransient
+                                  : kTypeOther;
+    }
+
+    return m_typeKinds[typeId] == kTypeTransient;
+}
+
+uint32_t LifetimeTracker::SecondOf(int64_t ticks) const {
+    return static_cast<uint32_t>((ticks - m_startTicks) / TicksPerSecond());
+}
+
+void LifetimeTracker::ElementAdded(int64_t addedTicks) {
+    m_elementsBySecond[SecondOf(addedTicks)]++;
+}
+
+void LifetimeTracker::ElementRemoved(int64_t addedTicks) {
+    auto find = m_elementsBySecond.find(SecondOf(addedTicks));
+    if (find != m_elementsBySecond.end() && --find->second == 0) {
+        m_elementsBySecond.erase(find);
+    }
+}
+
+uint32_t LifetimeTracker::TransientRootAdded(InstanceHandle root,
+                                             uint32_t pathId,
+                                             int64_t addedTicks) {
+    const uint32_t generation =
+        m_generation.load(std::memory_order_relaxed) + 1;
+    m_generation.store(generation, std::memory_order_relaxed);
+
+    m_transientRoots[root] = TransientRoot{.addedTicks = addedTicks,
+                                           .pathId = pathId,
+                                           .generation = generation,
+                                           .size = 0,
+                                           .reported = false};
+    return generation;
+}
+
+void LifetimeTracker::TransientRootRemoved(InstanceHandle root) {
+    m_transientRoots.erase(root);
+}
+
+void LifetimeTracker::TransientSizeChanged(InstanceHandle root,
+                                           int32_t delta) {
+    auto find = m_transientRoots.find(root);
+    if (find == m_transientRoots.end()) {
+        return;
+    }
+
+    uint32_t& size = find->second.size;
+    if (delta < 0 && size < static_cast<uint32_t>(-delta)) {
+        size = 0;
+    } else {
+        size += delta;
+    }
+}
+
+void LifetimeTracker::MaybeSummarize(int64_t now) {
+    if (m_summaryIntervalTicks == 0 || now < m_nextSummary) {
+        return;
+    }
+
+    m_nextSummary = now + m_summaryIntervalTicks;
+    Summarize(now);
+}
+
+void LifetimeTracker::Summarize(int64_t now) {
+    const uint32_t nowSecond = SecondOf(now);
+    const uint32_t leakSeconds =
+        static_cast<uint32_t>(m_leakTicks / TicksPerSecond());
+
+    uint32_t ageCounts[kAgeBuckets]{};
+    uint32_t elements = 0;
+    uint32_t old = 0;
+    for (const auto& [second, count] : m_elementsBySecond) {
+        const uint32_t age = nowSecond - std::min(second, nowSecond);
+        ageCounts[AgeBucket(age)] += count;
+        elements += count;
+        if (age >= leakSeconds) {
+            old += count;
+        }
+    }
+
+    for (size_t i = 0; i < kAgeBuckets; i++) {
+        m_ageCounts[i].store(ageCounts[i], std::memory_order_relaxed);
+    }
+
+    // Largest first, same insertion as TreeStats::LargestRoots.
+    Suspect suspects[kMaxSuspects]{};
+    size_t suspectCount = 0;
+    size_t totalSuspects = 0;
+    size_t newSuspects = 0;
+    for (auto& [handle, root] : m_transientRoots) {
+        if (now - root.addedTicks < m_leakTicks) {
+            continue;
+        }
+
+        totalSuspects++;
+        if (!root.reported) {
+            root.reported = true;
+            newSuspects++;
+            Trace(TraceLevel::kInfo,
+                  L"Possible leak: {} alive {} s, {} elements, generation {} "
+                  L"of {}",
+                  m_paths.Get(root.pathId),
+                  (now - root.addedTicks) / TicksPerSecond(), root.size,
+                  root.generation, Generation());
+        }
+
+        const Suspect suspect{.handle = handle,
+                              .addedTicks = root.addedTicks,
+                              .pathId = root.pathId,
+                              .generation = root.generation,
+                              .size = root.size};
+
+        size_t i = suspectCount < kMaxSuspects ? suspectCount++ : kMaxSuspects;
+        while (i > 0 && suspects[i - 1].size < suspect.size) {
+            if (i < kMaxSuspects) {
+                suspects[i] = suspects[i - 1];
+            }
+            i--;
+        }
+
+        if (i < kMaxSuspects) {
+            suspects[i] = suspect;
+        }
+    }
+
+    for (size_t i = 0; i < kMaxSuspects; i++) {
+        m_suspects[i].Store(suspects[i]);
+    }
+
+    m_summaryTicks.store(now, std::memory_order_relaxed);
+
+    Trace(TraceLevel::kInfo,
+          L"Lifetime: {} elements, {} alive over {} s, generation {}, {} "
+          L"leak suspects ({} new)",
+          elements, old, leakSeconds, Generation(), totalSuspects, newSuspects);
+}
+
+size_t LifetimeTracker::LeakSuspects(Suspect* out, size_t maxSuspects) const {
+    size_t count = 0;
+
+    for (const auto& cell : m_suspects) {
+        if (count == maxSuspects) {
+            break;
+        }
+
+        // Published sorted, a summary only runs every few seconds.
+        Suspect suspect;
+        if ((cell.TryLoad(suspect) || cell.TryLoad(suspect)) &&
+            suspect.handle) {
+            out[count++] = suspect;
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pathtable.hpp"
+#include "seqlock.hpp"
+#include "settings.hpp"
+
+// Element lifetimes and leak suspects.
+//
+// Every tracked element is stamped with the time it was added and with the
+// current generation, which advances each time a transient subtree (a
+// popup, dialog, flyout or tooltip, see Settings::transientTypes) is
+// opened. A transient subtree that is still alive after leakAge seconds,
+// often while several newer ones have come and gone, is a leak suspect.
+//
+// Live elements are counted per second of addition rather than one by one,
+// so a summary (the age histogram and the suspect list) costs one pass over
+// the distinct seconds and the open transient subtrees, whatever the size
+// of the tree. Summaries run every lifetimeSummary seconds on the writer
+// and are published for lock-free readers, like TreeStats.
+class LifetimeTracker {
+   public:
+    // Bucket 0 counts elements younger than a second, bucket i
+    // [2^(i-1), 2^i) seconds and the last one everything older.
+    static constexpr size_t kAgeBuckets = 20;
+    static constexpr size_t kMaxSuspects = 32;
+
+    struct Suspect {
+        InstanceHandle handle;
+        int64_t addedTicks;
+        uint32_t pathId;
+        uint32_t generation;
+        uint32_t size;
+    };
+
+    LifetimeTracker(const PathTable& paths, const Settings& settings);
+
+    LifetimeTracker(const LifetimeTracker&) = delete;
+    LifetimeTracker& operator=(const LifetimeTracker&) = delete;
+
+    // Writer only.
+    bool IsTransientType(uint32_t typeId, std::wstring_view typeName);
+    void ElementAdded(int64_t addedTicks);
+    void ElementRemoved(int64_t addedTicks);
+    // Starts a new generation and returns it.
+    uint32_t TransientRootAdded(InstanceHandle root,
+                                uint32_t pathId,
+                                int64_t addedTicks);
+    void TransientRootRemoved(InstanceHandle root);
+    void TransientSizeChanged(InstanceHandle root, int32_t delta);
+    void MaybeSummarize(int64_t now);
+
+    // Any thread.
+    uint32_t Generation() const {
+        return m_generation.load(std::memory_order_relaxed);
+    }
+
+    // The rest is as of the last summary, taken at SummaryTicks().
+    int64_t SummaryTicks() const {
+        return m_summaryTicks.load(std::memory_order_relaxed);
+    }
+
+    uint32_t ElementsOfAge(size_t bucket) const {
+        return bucket < kAgeBuckets
+                   ? m_ageCounts[bucket].load(std::memory_order_relaxed)
+                   : 0;
+    }
+
+    // Copies up to maxSuspects leak suspects, largest subtree first, and
+    // returns how many were copied.
+    size_t LeakSuspects(Suspect* out, size_t maxSuspects) const;
+
+   private:
+    struct TransientRoot {
+        int64_t addedTicks;
+        uint32_t pathId;
+        uint32_t generation;
+        uint32_t size;
+        bool reported;
+    };
+
+    uint32_t SecondOf(int64_t ticks) const;
+    void Summarize(int64_t now);
+
+    const PathTable& m_paths;
+    const std::wstring m_transientTypes;
+    const int64_t m_leakTicks;
+    const int64_t m_summaryIntervalTicks;
+    const int64_t m_startTicks;
+
+    std::atomic<uint32_t> m_generation{0};
+    std::atomic<int64_t> m_summaryTicks{0};
+    std::atomic<uint32_t> m_ageCounts[kAgeBuckets]{};
+    SeqlockCell<Suspect> m_suspects[kMaxSuspects];
+
+    // Writer-only state.
+    int64_t m_nextSummary;
+    // Live elements by the second they were added in, since m_startTicks.
+    std::map<uint32_t, uint32_t> m_elementsBySecond;
+    std::unordered_map<InstanceHandle, TransientRoot> m_transientRoots;
+    // Indexed by type id: 0 unknown, 1 transient, 2 not transient.
+    std::vector<uint8_t> m_typeKinds;
+};
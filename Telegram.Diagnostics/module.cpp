@@ -2,6 +2,7 @@
 
 #include "simplefactory.hpp"
 #include "tap.hpp"
+#include "tracing.hpp"
 #include "winrt.hpp"
 
 _Use_decl_annotations_ STDAPI DllGetClassObject(REFCLSID rclsid,
@@ -9,7 +10,12 @@ _Use_decl_annotations_ STDAPI DllGetClassObject(REFCLSID rclsid,
                                                 LPVOID* ppv) try {
     if (rclsid == CLSID_Telegram_DiagnosticsTAP) {
         *ppv = nullptr;
-        return winrt::make<SimpleFactory<ExplorerTAP>>().as(riid, ppv);
+        return winrt::make<SimpleFactory<ExplorerTAP<UwpFramework>>>().as(
+            riid, ppv);
+    } else if (rclsid == CLSID_Telegram_DiagnosticsWinUITAP) {
+        *ppv = nullptr;
+        return winrt::make<SimpleFactory<ExplorerTAP<WinUIFramework>>>().as(
+            riid, ppv);
     } else {
         return CLASS_E_CLASSNOTAVAILABLE;
     }
@@ -21,6 +27,8 @@ _Use_decl_annotations_ STDAPI DllCanUnloadNow() {
     if (winrt::get_module_lock()) {
         return S_FALSE;
     } else {
+        // The formatter thread keeps the module loaded until it's stopped.
+        StopTracing();
         return S_OK;
     }
 }
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+
+// A std::mutex that knows which thread holds it. For code that may run
+// while its own thread is inside the lock, like a handler raised from a
+// locked section, and so can't even try to lock it: try_lock on a
+// std::mutex the calling thread owns is undefined.
+class OwnedMutex {
+   public:
+    void lock() {
+        m_mutex.lock();
+        m_owner.store(GetCurrentThreadId(), std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        if (!m_mutex.try_lock()) {
+            return false;
+        }
+
+        m_owner.store(GetCurrentThreadId(), std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        m_owner.store(0, std::memory_order_relaxed);
+        m_mutex.unlock();
+    }
+
+    // Any thread. A thread always sees its own stores, and no thread has
+    // id 0, so this is exact for the calling thread whatever others do.
+    bool OwnedByThisThread() const {
+        return m_owner.load(std::memory_order_relaxed) == GetCurrentThreadId();
+    }
+
+   private:
+    std::mutex m_mutex;
+    std::atomic<DWORD> m_owner{0};
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <iterator>
+#include <string_view>
+
+#include "stringkernels.hpp"
+
+// Long, always identical prefixes of Unigram's tree, written in short form
+// in reports.
+struct PathAbbreviation {
+    std::wstring_view longForm;
+    std::wstring_view shortForm;
+};
+
+inline constexpr PathAbbreviation kPathAbbreviations[] = {
+    {L"RootPage/LayoutRoot (Grid)[0]/Navigation (SplitView)/Grid[1]/"
+     L"ContentRoot (Grid)[0]/Border/Frame/ContentPresenter/",
+     L"RootPage/.../"},
+    {L"MainPage/Grid[4]/MasterDetail (MasterDetailView)/AdaptivePanel "
+     L"(MasterDetailPanel)[1]/DetailHeaderPresenter2 (Grid)[3]/"
+     L"DetailPresenter (Grid)/Frame/ContentPresenter/",
+     L"MainPage/.../"},
+    {L"MainPage/Grid[4]/MasterDetail (MasterDetailView)/AdaptivePanel "
+     L"(MasterDetailPanel)[2]/MasterFrame (ContentControl)/ContentPresenter/"
+     L"Grid[1]/rpMasterTitlebar (Pivot)/RootElement (Grid)[1]/Grid/"
+     L"ScrollViewer (ScrollViewer)/Grid/ScrollContentPresenter "
+     L"(ScrollContentPresenter)/Panel (PivotPanel)/PivotLayoutElement "
+     L"(Grid)[5]/PivotItemPresenter (ItemsPresenter)/Grid/PivotItem",
+     L"MainPage/.../PivotItem"},
+};
+
+// Calls output(std::wstring_view) with consecutive pieces of path, where
+// the first occurrence of each long form is replaced by its short form.
+// Doesn't allocate.
+template <typename Output>
+void ForEachAbbreviatedPart(std::wstring_view path, Output&& output) {
+    struct Match {
+        size_t position;
+        const PathAbbreviation* abbreviation;
+    };
+
+    Match matches[std::size(kPathAbbreviations)];
+    size_t count = 0;
+
+    for (const auto& abbreviation : kPathAbbreviations) {
+        const size_t position = Find(path, abbreviation.longForm);
+        if (position == path.npos) {
+            continue;
+        }
+
+        // Insertion sort by position, there are only a handful.
+        size_t i = count++;
+        while (i > 0 && matches[i - 1].position > position) {
+            matches[i] = matches[i - 1];
+            i--;
+        }
+
+        matches[i] = {.position = position, .abbreviation = &abbreviation};
+    }
+
+    size_t cursor = 0;
+    for (size_t i = 0; i < count; i++) {
+        const auto& match = matches[i];
+        if (match.position < cursor) {
+            continue;
+        }
+
+        output(path.substr(cursor, match.position - cursor));
+        output(match.abbreviation->shortForm);
+        cursor = match.position + match.abbreviation->longForm.size();
+    }
+
+    output(path.substr(cursor));
+}
@@ -0,0 +1,69 @@
+#include "stdafx.h"
+
+#include "pathtable.hpp"
+
+uint32_t PathTable::Intern(std::wstring_view path) {
+    auto find = m_index.find(path);
+    if (find != m_index.end()) {
+        return find->second;
+    }
+
+    const uint32_t id = m_size.load(std::memory_order_relaxed);
+    const uint32_t segment = id / kEntriesPerSegment;
+    if (segment >= kMaxSegments ||
+        m_totalChars + path.size() > kMaxChars) {
+        CountDropped();
+        return kInvalidId;
+    }
+
+    if (!m_segments[segment]) {
+        m_segments[segment] = std::make_unique<Entry[]>(kEntriesPerSegment);
+    }
+
+    const wchar_t* data = AllocateChars(path);
+
+    m_segments[segment][id % kEntriesPerSegment] =
+        Entry{.data = data, .length = static_cast<uint32_t>(path.size())};
+    m_index.emplace(std::wstring_view{data, path.size()}, id);
+
+    // Publishes the entry, its characters and the segment pointer.
+    m_size.store(id + 1, std::memory_order_release);
+
+    return id;
+}
+
+std::wstring_view PathTable::Get(uint32_t id) const {
+    if (id >= Size()) {
+        return {};
+    }
+
+    const Entry& entry =
+        m_segments[id / kEntriesPerSegment][id % kEntriesPerSegment];
+    return {entry.data, entry.length};
+}
+
+const wchar_t* PathTable::AllocateChars(std::wstring_view path) {
+    m_totalChars += path.size();
+
+    // Long paths get an allocation of their own instead of wasting the tail
+    // of the current chunk.
+    if (path.size() > kCharsPerChunk / 4) {
+        auto& chunk = m_chunks.emplace_back(
+            std::make_unique<wchar_t[]>(path.size()));
+        std::copy(path.begin(), path.end(), chunk.get());
+        return chunk.get();
+    }
+
+    if (!m_chunk || kCharsPerChunk - m_chunkUsed < path.size()) {
+        m_chunk = m_chunks
+                      .emplace_back(
+                          std::make_unique<wchar_t[]>(kCharsPerChunk))
+                      .get();
+        m_chunkUsed = 0;
+    }
+
+    wchar_t* data = m_chunk + m_chunkUsed;
+    std::copy(path.begin(), path.end(), data);
+    m_chunkUsed += path.size();
+    return data;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Append-only table of interned element paths.
+//
+// Intern() must be serialized by the caller. Get() may be called from any
+// thread without locking: an entry and the characters it points to are
+// written once, before the table size that covers it is published, and are
+// never moved or freed while the table is alive. This is what lets history
+// records carry a 32-bit id instead of a string, and lets crash and export
+// code resolve those ids while the UI thread keeps interning.
+class PathTable {
+   public:
+    static constexpr uint32_t kInvalidId = UINT32_MAX;
+
+    static constexpr uint32_t kEntriesPerSegment = 4096;
+    static constexpr uint32_t kMaxSegments = 64;
+    // Ids are always below this.
+    static constexpr uint32_t kMaxEntries = kEntriesPerSegment * kMaxSegments;
+
+    PathTable() = default;
+
+    PathTable(const PathTable&) = delete;
+    PathTable& operator=(const PathTable&) = delete;
+
+    // Writer only. Returns kInvalidId once the memory budget is exhausted,
+    // and counts the path as dropped.
+    uint32_t Intern(std::wstring_view path);
+
+    // Any thread. Returns an empty view for ids that aren't published.
+    std::wstring_view Get(uint32_t id) const;
+
+    uint32_t Size() const { return m_size.load(std::memory_order_acquire); }
+    // Any thread. Paths that didn't fit, recorded with kInvalidId.
+    uint64_t Dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+   private:
+    struct Entry {
+        const wchar_t* data;
+        uint32_t length;
+    };
+
+    static constexpr size_t kCharsPerChunk = 64 * 1024;
+    static constexpr size_t kMaxChars = 4 * 1024 * 1024;
+
+    const wchar_t* AllocateChars(std::wstring_view path);
+
+    void CountDropped() {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<Entry[]> m_segments[kMaxSegments];
+    std::atomic<uint32_t> m_size{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    // Writer-only state.
+    std::unordered_map<std::wstring_view, uint32_t> m_index;
+    std::vector<std::unique_ptr<wchar_t[]>> m_chunks;
+    wchar_t* m_chunk = nullptr;
+    size_t m_chunkUsed = 0;
+    size_t m_totalChars = 0;
+};
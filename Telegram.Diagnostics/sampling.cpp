@@ -0,0 +1,51 @@
+#include "stdafx.h"
+
+#include "sampling.hpp"
+
+#include "clock.hpp"
+#include "tracing.hpp"
+
+OverheadGovernor::OverheadGovernor(unsigned int budgetMicroseconds)
+    : m_budgetMicroseconds(budgetMicroseconds) {}
+
+void OverheadGovernor::Charge(int64_t start, int64_t end) {
+    if (!m_windowStart) {
+        m_windowStart = start;
+    }
+
+    m_windowTicks += end - start;
+
+    const int64_t elapsed = end - m_windowStart;
+    if (elapsed < TicksPerSecond()) {
+        return;
+    }
+
+    // Normalize to one second, a window stretched by an idle period
+    // shouldn't look cheaper than it was.
+    const int64_t spent =
+        TicksToMicroseconds(m_windowTicks) * TicksPerSecond() / elapsed;
+    m_lastWindowMicroseconds.store(static_cast<uint32_t>(spent),
+                                   std::memory_order_relaxed);
+
+    // Back off quickly and recover slowly: double the interval while over
+    // budget, halve it only once there is plenty of headroom, so the
+    // interval doesn't oscillate around the budget.
+    uint32_t interval = m_interval.load(std::memory_order_relaxed);
+    if (m_budgetMicroseconds) {
+        if (spent > m_budgetMicroseconds && interval < kMaxInterval) {
+            interval *= 2;
+        } else if (spent < m_budgetMicroseconds / 4 && interval > 1) {
+            interval /= 2;
+        }
+    }
+
+    if (interval != m_interval.load(std::memory_order_relaxed)) {
+        Trace(TraceLevel::kInfo, L"Sampling 1 in {}, {} us spent last second",
+              interval, spent);
+    }
+
+    m_interval.store(interval, std::memory_order_relaxed);
+
+    m_windowStart = end;
+    m_windowTicks = 0;
+}
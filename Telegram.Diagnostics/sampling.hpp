@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Keeps the watcher's own UI thread time under a per-second budget by
+// adapting the 1-in-N interval at which events are recorded. Callers keep
+// exact event counts regardless, only the expensive part (path walk and
+// history push) is sampled, so the shape of a layout storm survives even
+// when most of its events are skipped.
+class OverheadGovernor {
+   public:
+    static constexpr uint32_t kMaxInterval = 4096;
+
+    // A budget of 0 disables sampling.
+    explicit OverheadGovernor(unsigned int budgetMicroseconds);
+
+    // Writer only. count is the 1-based number of events seen so far for
+    // the sampling key (an element or a subtree).
+    bool ShouldRecord(uint32_t count) const {
+        return (count - 1) % m_interval.load(std::memory_order_relaxed) == 0;
+    }
+
+    // Writer only. Charges watcher work from start to end, both in ticks,
+    // and re-evaluates the interval once per second.
+    void Charge(int64_t start, int64_t end);
+
+    // Any thread.
+    uint32_t Interval() const {
+        return m_interval.load(std::memory_order_relaxed);
+    }
+
+    // Any thread. Time charged during the last completed window.
+    uint32_t LastWindowMicroseconds() const {
+        return m_lastWindowMicroseconds.load(std::memory_order_relaxed);
+    }
+
+   private:
+    const int64_t m_budgetMicroseconds;
+    int64_t m_windowStart = 0;
+    int64_t m_windowTicks = 0;
+    std::atomic<uint32_t> m_interval{1};
+    std::atomic<uint32_t> m_lastWindowMicroseconds{0};
+};
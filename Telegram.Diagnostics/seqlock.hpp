@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Sequence-locked value. Writes must be serialized by the caller, reads are
+// lock-free from any thread and never delay the writer. A read that races
+// with a write observes an odd or changed sequence number and is retried.
+//
+// The payload is stored as atomic words rather than a plain T, so that a
+// racing read is a well-defined (if torn) read that is then discarded
+// instead of a data race. Word stores are release and word loads acquire,
+// which orders them against the sequence number without standalone fences;
+// on x86 and ARM64 both compile to plain moves.
+template <typename T>
+class SeqlockCell {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+   public:
+    void Store(const T& value) {
+        uint64_t words[kWords]{};
+        memcpy(words, &value, sizeof(T));
+
+        const uint32_t seq = m_seq.load(std::memory_order_relaxed);
+        m_seq.store(seq + 1, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < kWords; i++) {
+            m_words[i].store(words[i], std::memory_order_release);
+        }
+
+        m_seq.store(seq + 2, std::memory_order_release);
+    }
+
+    bool TryLoad(T& value) const {
+        const uint32_t seq1 = m_seq.load(std::memory_order_acquire);
+        if (seq1 & 1) {
+            return false;
+        }
+
+        uint64_t words[kWords];
+        for (size_t i = 0; i < kWords; i++) {
+            words[i] = m_words[i].load(std::memory_order_acquire);
+        }
+
+        if (m_seq.load(std::memory_order_relaxed) != seq1) {
+            return false;
+        }
+
+        memcpy(&value, words, sizeof(T));
+        return true;
+    }
+
+    T Load() const {
+        T value;
+        while (!TryLoad(value)) {
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+
+        return value;
+    }
+
+   private:
+    static constexpr size_t kWords = (sizeof(T) + 7) / 8;
+
+    std::atomic<uint32_t> m_seq{0};
+    std::atomic<uint64_t> m_words[kWords]{};
+};
+
+// Fixed-capacity ring of the most recent Capacity items. Same contract as
+// SeqlockCell: one writer at a time, any number of lock-free readers.
+// Each slot remembers the absolute index it holds, so a reader that falls
+// behind the writer skips overwritten slots instead of returning them out
+// of order.
+template <typename T, size_t Capacity>
+class SeqlockRing {
+    static_assert(Capacity > 0);
+
+   public:
+    static constexpr size_t kCapacity = Capacity;
+
+    // Writer only.
+    void Push(const T& item) {
+        const uint64_t index = m_count.load(std::memory_order_relaxed);
+        m_slots[index % Capacity].Store({.index = index, .item = item});
+        m_count.store(index + 1, std::memory_order_release);
+    }
+
+    // Writer only. Overwrites the most recent item in place.
+    void ReplaceBack(const T& item) {
+        const uint64_t index = m_count.load(std::memory_order_relaxed);
+        if (index == 0) {
+            Push(item);
+            return;
+        }
+
+        m_slots[(index - 1) % Capacity].Store(
+            {.index = index - 1, .item = item});
+    }
+
+    // Writer only, so the slot can't be torn.
+    bool Back(T& item) const {
+        const uint64_t index = m_count.load(std::memory_order_relaxed);
+        if (index == 0) {
+            return false;
+        }
+
+        item = m_slots[(index - 1) % Capacity].Load().item;
+        return true;
+    }
+
+    // Total number of items ever pushed.
+    uint64_t Count() const { return m_count.load(std::memory_order_acquire); }
+
+    // Any thread. Copies up to maxItems of the most recent items, starting
+    // no earlier than fromIndex, oldest first, and returns how many were
+    // copied. Slots overwritten during the copy are dropped rather than
+    // waited for.
+    size_t Snapshot(T* out, size_t maxItems, uint64_t fromIndex = 0) const {
+        const uint64_t end = Count();
+        uint64_t begin = end > Capacity ? end - Capacity : 0;
+        if (end - begin > maxItems) {
+            begin = end - maxItems;
+        }
+
+        if (begin < fromIndex) {
+            begin = fromIndex;
+        }
+
+        size_t copied = 0;
+        for (uint64_t index = begin; index < end; index++) {
+            Slot slot;
+            if (!m_slots[index % Capacity].TryLoad(slot) &&
+                !m_slots[index % Capacity].TryLoad(slot)) {
+                continue;
+            }
+
+            if (slot.index == index) {
+                out[copied++] = slot.item;
+            }
+        }
+
+        return copied;
+    }
+
+   private:
+    struct Slot {
+        uint64_t index;
+        T item;
+    };
+
+    SeqlockCell<Slot> m_slots[Capacity];
+    std::atomic<uint64_t> m_count{0};
+};
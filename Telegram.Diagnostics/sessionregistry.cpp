@@ -0,0 +1,234 @@
+#include "stdafx.h"
+
+#include "sessionregistry.hpp"
+
+namespace {
+
+// Versioned, a registry laid out differently is a different object.
+constexpr wchar_t kRegistryName[] = L"Local\\Telegram.Diagnostics.Sessions.1";
+
+uint64_t ToUInt64(const FILETIME& time) {
+    return (uint64_t{time.dwHighDateTime} << 32) | time.dwLowDateTime;
+}
+
+uint64_t ProcessCreateTime(HANDLE process) {
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(process, &creation, &exit, &kernel, &user)) {
+        return 0;
+    }
+
+    return ToUInt64(creation);
+}
+
+// Where the search for pid's slot starts. Pids are multiples of 4.
+uint32_t HomeSlot(DWORD pid) {
+    return (pid / 4) % session::kMaxSessions;
+}
+
+uint64_t ReadCounter(HANDLE process, uint64_t address) {
+    uint64_t value;
+    if (!ReadProcessMemory(process, reinterpret_cast<LPCVOID>(address),
+                           &value, sizeof(value), nullptr)) {
+        return 0;
+    }
+
+    return value;
+}
+
+}  // namespace
+
+SessionRegistry::~SessionRegistry() {
+    if (m_registered) {
+        m_registered->published.store(0, std::memory_order_release);
+        m_registered->owner.store(0, std::memory_order_release);
+    }
+
+    if (m_view) {
+        UnmapViewOfFile(m_view);
+    }
+
+    if (m_mapping) {
+        CloseHandle(m_mapping);
+    }
+}
+
+bool SessionRegistry::Open() {
+    // Zeroed on creation, all slots free.
+    HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr,
+                                       PAGE_READWRITE, 0, sizeof(Slots),
+                                       kRegistryName);
+    if (!mapping) {
+        return false;
+    }
+
+    if (!Attach(mapping)) {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    return true;
+}
+
+bool SessionRegistry::Attach(HANDLE mapping) {
+    // Fails for anything but a section at least this large, so a bad
+    // handle value in the options isn't taken over.
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                               sizeof(Slots));
+    if (!view) {
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_view = static_cast<Slots*>(view);
+    return true;
+}
+
+bool SessionRegistry::Contains(DWORD pid) {
+    if (!m_view || !pid) {
+        return false;
+    }
+
+    const uint32_t home = HomeSlot(pid);
+    for (uint32_t i = 0; i < session::kMaxSessions; i++) {
+        Slot& slot = m_view->slots[(home + i) % session::kMaxSessions];
+        Record record;
+        if (slot.owner.load(std::memory_order_relaxed) == pid &&
+            ReadLive(slot, record)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t SessionRegistry::Query(session::Info* out, size_t capacity) {
+    if (!m_view) {
+        return 0;
+    }
+
+    size_t count = 0;
+    for (Slot& slot : m_view->slots) {
+        Record record;
+        if (!ReadLive(slot, record)) {
+            continue;
+        }
+
+        if (count < capacity) {
+            session::Info& info = out[count];
+            info = {.pid = record.pid,
+                    .framework = record.framework,
+                    .attachTime = record.attachTime};
+
+            // A watcher of another build may lay its counters out
+            // differently.
+            HANDLE process =
+                record.statsSize == sizeof(WatcherStats)
+                    ? OpenProcess(PROCESS_VM_READ, FALSE, record.pid)
+                    : nullptr;
+            if (process) {
+                const uint64_t stats = record.statsAddress;
+                info.eventsSeen = ReadCounter(
+                    process, stats + offsetof(WatcherStats, eventsSeen));
+                info.eventsRecorded = ReadCounter(
+                    process, stats + offsetof(WatcherStats, eventsRecorded));
+                info.attachReplayedUs = ReadCounter(
+                    process, stats + offsetof(WatcherStats, attachReplayedUs));
+                info.attachSyncedUs = ReadCounter(
+                    process, stats + offsetof(WatcherStats, attachSyncedUs));
+                CloseHandle(process);
+            }
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+bool SessionRegistry::Register(session::Framework framework,
+                               const WatcherStats* stats) {
+    if (!m_view || m_registered) {
+        return false;
+    }
+
+    const DWORD pid = GetCurrentProcessId();
+    const uint64_t createTime = ProcessCreateTime(GetCurrentProcess());
+
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+
+    const uint32_t home = HomeSlot(pid);
+    for (uint32_t i = 0; i < session::kMaxSessions; i++) {
+        Slot& slot = m_view->slots[(home + i) % session::kMaxSessions];
+
+        uint32_t owner = slot.owner.load(std::memory_order_acquire);
+        if (owner == pid) {
+            // The watcher of the other framework, or one of a process
+            // that had this pid before, whose slot is ours to take.
+            if (slot.published.load(std::memory_order_acquire) &&
+                slot.record.createTime == createTime) {
+                continue;
+            }
+
+            slot.published.store(0, std::memory_order_relaxed);
+        } else if (owner ||
+                   !slot.owner.compare_exchange_strong(
+                       owner, pid, std::memory_order_acquire)) {
+            continue;
+        }
+
+        slot.record = {.pid = pid,
+                       .framework = framework,
+                       .createTime = createTime,
+                       .attachTime = ToUInt64(now),
+                       .statsAddress = reinterpret_cast<uint64_t>(stats),
+                       .statsSize = sizeof(WatcherStats)};
+        slot.published.store(1, std::memory_order_release);
+
+        m_registered = &slot;
+        return true;
+    }
+
+    return false;
+}
+
+bool SessionRegistry::ReadLive(Slot& slot, Record& record) {
+    const uint32_t pid = slot.owner.load(std::memory_order_acquire);
+    if (!pid || !slot.published.load(std::memory_order_acquire)) {
+        return false;
+    }
+
+    record = slot.record;
+
+    // Torn by a watcher taking the slot over meanwhile.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.owner.load(std::memory_order_relaxed) != pid ||
+        !slot.published.load(std::memory_order_relaxed) ||
+        record.pid != pid) {
+        return false;
+    }
+
+    bool live;
+    HANDLE process =
+        OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (process) {
+        DWORD exitCode;
+        live = ProcessCreateTime(process) == record.createTime &&
+               GetExitCodeProcess(process, &exitCode) &&
+               exitCode == STILL_ACTIVE;
+        CloseHandle(process);
+    } else {
+        // Can't tell if it's still there, but a pid that doesn't exist
+        // fails with ERROR_INVALID_PARAMETER.
+        live = GetLastError() != ERROR_INVALID_PARAMETER;
+    }
+
+    if (!live) {
+        slot.published.store(0, std::memory_order_relaxed);
+        uint32_t owner = pid;
+        slot.owner.compare_exchange_strong(owner, 0,
+                                           std::memory_order_release);
+    }
+
+    return live;
+}
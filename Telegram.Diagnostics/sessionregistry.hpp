@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "../common/sessioninfo.h"
+#include "stats.hpp"
+
+// The watchers running in this logon session, in named shared memory, so
+// that telling whether a process is being inspected is a lookup, and the
+// launcher can list every session with its counters.
+//
+// A packaged app can't open named objects outside its AppContainer, so the
+// registry is created by start() in the launcher's process, which passes a
+// duplicate of its handle to the target with the watcher options. Each
+// watcher registers itself in a slot, the first free one from a slot
+// picked by its pid. Slots of processes that died without unregistering
+// are freed by the next launcher that looks at them.
+class SessionRegistry {
+   public:
+    SessionRegistry() = default;
+    ~SessionRegistry();
+
+    SessionRegistry(const SessionRegistry&) = delete;
+    SessionRegistry& operator=(const SessionRegistry&) = delete;
+
+    // Launcher side. Creates the registry, or opens it if it exists.
+    bool Open();
+    // Watcher side. Maps the handle that start() passed, and takes it over
+    // if that works.
+    bool Attach(HANDLE mapping);
+
+    HANDLE Handle() const { return m_mapping; }
+
+    // Launcher side. Whether a watcher runs in pid.
+    bool Contains(DWORD pid);
+    // Launcher side. Copies up to capacity sessions to out and returns how
+    // many there are, counters read from each target if it allows it.
+    size_t Query(session::Info* out, size_t capacity);
+
+    // Watcher side, once. Unregisters when destroyed.
+    bool Register(session::Framework framework, const WatcherStats* stats);
+
+   private:
+    struct Record {
+        uint32_t pid;
+        session::Framework framework;
+        // FILETIMEs. The creation time tells a reused pid apart.
+        uint64_t createTime;
+        uint64_t attachTime;
+        // Of the watcher's WatcherStats in the target, and its size, which
+        // has to match for the launcher to read it.
+        uint64_t statsAddress;
+        uint64_t statsSize;
+    };
+
+    struct Slot {
+        // 0 if free. Claimed by a watcher with a compare-exchange, record
+        // is only valid while published is set.
+        std::atomic<uint32_t> owner;
+        std::atomic<uint32_t> published;
+        Record record;
+    };
+
+    struct Slots {
+        Slot slots[session::kMaxSessions];
+    };
+
+    // Shared between processes, which only works without a lock.
+    static_assert(std::atomic<uint32_t>::is_always_lock_free);
+
+    // Launcher side. Copies the slot's record if it's published and its
+    // process is still the one that registered, and frees the slot if that
+    // process is gone.
+    bool ReadLive(Slot& slot, Record& record);
+
+    HANDLE m_mapping = nullptr;
+    Slots* m_view = nullptr;
+    Slot* m_registered = nullptr;
+};
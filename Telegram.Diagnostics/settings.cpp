@@ -0,0 +1,190 @@
+#include "stdafx.h"
+
+#include "settings.hpp"
+
+namespace {
+
+std::wstring_view Trim(std::wstring_view value) {
+    while (!value.empty() && iswspace(value.front())) {
+        value.remove_prefix(1);
+    }
+
+    while (!value.empty() && iswspace(value.back())) {
+        value.remove_suffix(1);
+    }
+
+    return value;
+}
+
+bool ParseUInt(std::wstring_view value, unsigned int& result) {
+    if (value.empty() || value.size() > 9) {
+        return false;
+    }
+
+    unsigned int parsed = 0;
+    for (wchar_t c : value) {
+        if (c < L'0' || c > L'9') {
+            return false;
+        }
+
+        parsed = parsed * 10 + (c - L'0');
+    }
+
+    result = parsed;
+    return true;
+}
+
+// Values out of [min, max] are clamped into it.
+bool ParseUIntClamped(std::wstring_view value,
+                      unsigned int min,
+                      unsigned int max,
+                      unsigned int& result) {
+    unsigned int parsed;
+    if (!ParseUInt(value, parsed)) {
+        return false;
+    }
+
+    result = std::clamp(parsed, min, max);
+    return true;
+}
+
+bool ParseInt64(std::wstring_view value, int64_t& result) {
+    if (value.empty() || value.size() > 18) {
+        return false;
+    }
+
+    int64_t parsed = 0;
+    for (wchar_t c : value) {
+        if (c < L'0' || c > L'9') {
+            return false;
+        }
+
+        parsed = parsed * 10 + (c - L'0');
+    }
+
+    result = parsed;
+    return true;
+}
+
+// "size,viewport,loaded,unloaded,layout", unknown names are skipped.
+uint32_t ParseEventKinds(std::wstring_view value) {
+    uint32_t kinds = 0;
+
+    while (!value.empty()) {
+        size_t end = value.find(L',');
+        auto name = Trim(value.substr(0, end));
+        value.remove_prefix(end == value.npos ? value.size() : end + 1);
+
+        if (name == L"size") {
+            kinds |= Settings::EventKindBit(EventKind::kSizeChanged);
+        } else if (name == L"viewport") {
+            kinds |=
+                Settings::EventKindBit(EventKind::kEffectiveViewportChanged);
+        } else if (name == L"loaded") {
+            kinds |= Settings::EventKindBit(EventKind::kLoaded);
+        } else if (name == L"unloaded") {
+            kinds |= Settings::EventKindBit(EventKind::kUnloaded);
+        } else if (name == L"layout") {
+            kinds |= Settings::EventKindBit(EventKind::kLayoutUpdated);
+        }
+    }
+
+    return kinds;
+}
+
+void ApplyOption(Settings& settings,
+                 std::wstring_view key,
+                 std::wstring_view value) {
+    if (key == L"startTicks") {
+        ParseInt64(value, settings.startTicks);
+    } else if (key == L"sessionRegistry") {
+        ParseInt64(value, settings.sessionRegistry);
+    } else if (key == L"budget") {
+        ParseUInt(value, settings.budgetMicroseconds);
+    } else if (key == L"sampling") {
+        if (value == L"element") {
+            settings.samplingScope = SamplingScope::kElement;
+        } else if (value == L"subtree") {
+            settings.samplingScope = SamplingScope::kSubtree;
+        }
+    } else if (key == L"subtreeDepth") {
+        ParseUInt(value, settings.subtreeDepth);
+    } else if (key == L"events") {
+        settings.eventKinds = ParseEventKinds(value);
+    } else if (key == L"trace") {
+        if (value == L"off") {
+            settings.traceLevel = TraceLevel::kOff;
+        } else if (value == L"error") {
+            settings.traceLevel = TraceLevel::kError;
+        } else if (value == L"info") {
+            settings.traceLevel = TraceLevel::kInfo;
+        } else if (value == L"verbose") {
+            settings.traceLevel = TraceLevel::kVerbose;
+        }
+    } else if (key == L"transientTypes") {
+        settings.transientTypes = value;
+    } else if (key == L"leakAge") {
+        ParseUInt(value, settings.leakAge);
+    } else if (key == L"lifetimeSummary") {
+        ParseUInt(value, settings.lifetimeSummary);
+    } else if (key == L"snapshotInterval") {
+        ParseUInt(value, settings.snapshotInterval);
+    } else if (key == L"triggerRate") {
+        ParseUInt(value, settings.triggerRate);
+    } else if (key == L"triggerPeriod") {
+        ParseUInt(value, settings.triggerPeriod);
+    } else if (key == L"triggerCooldown") {
+        ParseUInt(value, settings.triggerCooldown);
+    } else if (key == L"flameGraph") {
+        if (value == L"off") {
+            settings.flameGraph = FlameWeight::kOff;
+        } else if (value == L"count") {
+            settings.flameGraph = FlameWeight::kCount;
+        } else if (value == L"time") {
+            settings.flameGraph = FlameWeight::kTime;
+        }
+    } else if (key == L"captureStacks") {
+        unsigned int enabled;
+        if (ParseUInt(value, enabled)) {
+            settings.captureStacks = enabled != 0;
+        }
+    } else if (key == L"foldHistory") {
+        unsigned int enabled;
+        if (ParseUInt(value, enabled)) {
+            settings.foldHistory = enabled != 0;
+        }
+    } else if (key == L"rollingTrace") {
+        unsigned int enabled;
+        if (ParseUInt(value, enabled)) {
+            settings.rollingTrace = enabled != 0;
+        }
+    } else if (key == L"rollingTraceFileSize") {
+        ParseUIntClamped(value, 1, Settings::kMaxRollingTraceFileSize,
+                         settings.rollingTraceFileSize);
+    } else if (key == L"rollingTraceFiles") {
+        ParseUIntClamped(value, 1, Settings::kMaxRollingTraceFiles,
+                         settings.rollingTraceFiles);
+    }
+}
+
+}  // namespace
+
+Settings Settings::Parse(std::wstring_view options) {
+    Settings settings;
+
+    while (!options.empty()) {
+        size_t end = options.find(L';');
+        auto option = options.substr(0, end);
+        options.remove_prefix(end == options.npos ? options.size() : end + 1);
+
+        size_t separator = option.find(L'=');
+        if (separator == option.npos) {
+            continue;
+        }
+
+        ApplyOption(settings, Trim(option.substr(0, separator)),
+                    Trim(option.substr(separator + 1)));
+    }
+
+    return settings;
+}
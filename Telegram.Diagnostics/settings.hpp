@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "history.hpp"
+#include "tracing.hpp"
+
+enum class SamplingScope {
+    // Every element gets its own 1-in-N counter.
+    kElement,
+    // Elements share the counter of their ancestor at subtreeDepth, so one
+    // busy list is sampled as a whole instead of item by item.
+    kSubtree,
+};
+
+// What the flame graph of SizeChanged activity weighs stacks by, see
+// FlameGraph.
+enum class FlameWeight {
+    kOff,
+    kCount,
+    // Time since the previous event.
+    kTime,
+};
+
+// Options passed by the launcher through InitializeXamlDiagnosticsEx and
+// read back with IXamlDiagnostics::GetInitializationData, formatted as
+// "key=value;key=value". Unknown keys and malformed values are ignored.
+struct Settings {
+    // QueryPerformanceCounter ticks at which start() ran in the launcher,
+    // added to the options by start() itself to measure attach latency.
+    int64_t startTicks = 0;
+    // Handle to the session registry in this process, duplicated here and
+    // added to the options by start(). See SessionRegistry.
+    int64_t sessionRegistry = 0;
+
+    // UI thread time the watcher may spend per second before it starts
+    // sampling events. 0 disables sampling and records everything, which is
+    // the default: sampling drops events from the history, so it's opt-in.
+    unsigned int budgetMicroseconds = 0;
+    SamplingScope samplingScope = SamplingScope::kElement;
+    unsigned int subtreeDepth = 12;
+
+    // Events to subscribe to, one bit per EventKind.
+    uint32_t eventKinds = EventKindBit(EventKind::kSizeChanged);
+
+    // Initial level. The launcher can change it later with setTraceLevel.
+    TraceLevel traceLevel = TraceLevel::kOff;
+
+    // Element types (without namespace) whose subtrees are expected to be
+    // short-lived, comma separated. One still open after leakAge seconds is
+    // reported as a possible leak by the summary that runs every
+    // lifetimeSummary seconds, 0 disables it.
+    std::wstring transientTypes =
+        L"Popup,ContentDialog,FlyoutPresenter,MenuFlyoutPresenter,ToolTip";
+    unsigned int leakAge = 120;
+    unsigned int lifetimeSummary = 10;
+
+    // Seconds between snapshots of the tree, which a crash report diffs
+    // the tree against. 0 disables them.
+    unsigned int snapshotInterval = 60;
+
+    // Snapshot reports written while the app runs, see SnapshotTriggers:
+    // when an element or subtree raises triggerRate events within a second
+    // (0 disables it), every triggerPeriod seconds (0 disables it), and on
+    // request. At most one per triggerCooldown seconds.
+    unsigned int triggerRate = 0;
+    unsigned int triggerPeriod = 0;
+    unsigned int triggerCooldown = 30;
+
+    // Written next to every report as LayoutFlame.folded, or
+    // LayoutSnapshot-<n>.folded.
+    FlameWeight flameGraph = FlameWeight::kCount;
+
+    // Capture the call stack of every recorded SizeChanged event, see
+    // StackTable. A few microseconds per event, charged to the budget.
+    bool captureStacks = false;
+
+    // Keep runs of up to 16 events that repeat once in the history, with a
+    // repeat count, see HistoryFolder.
+    bool foldHistory = true;
+
+    // Stream every recorded event to LayoutTrace-<n>.bin files in the
+    // LocalFolder, reusing rollingTraceFiles files of rollingTraceFileSize
+    // MB each. Both are clamped to at least 1 and at most the limits below.
+    bool rollingTrace = false;
+    unsigned int rollingTraceFileSize = 16;
+    unsigned int rollingTraceFiles = 4;
+    static constexpr unsigned int kMaxRollingTraceFileSize = 4096;
+    static constexpr unsigned int kMaxRollingTraceFiles = 256;
+
+    static constexpr uint32_t EventKindBit(EventKind kind) {
+        return 1u << static_cast<uint32_t>(kind);
+    }
+
+    bool Captures(EventKind kind) const {
+        return (eventKinds & EventKindBit(kind)) != 0;
+    }
+
+    static Settings Parse(std::wstring_view options);
+};
@@ -0,0 +1,165 @@
+#include "stdafx.h"
+
+#include "stacktable.hpp"
+
+#include "stringkernels.hpp"
+
+extern "C" IMAGE_DOS_HEADER __ImageBase;
+
+namespace {
+
+uint64_t HashFrames(std::span<void* const> frames) {
+    uint64_t hash = frames.size();
+    for (void* frame : frames) {
+        // splitmix64 finalizer over the running hash and each address.
+        hash ^= reinterpret_cast<uintptr_t>(frame);
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+        hash ^= hash >> 31;
+    }
+
+    return hash;
+}
+
+}  // namespace
+
+StackTable::StackTable() {
+    const auto* image = reinterpret_cast<const uint8_t*>(&__ImageBase);
+    const auto* headers = reinterpret_cast<const IMAGE_NT_HEADERS*>(
+        image + __ImageBase.e_lfanew);
+
+    m_moduleBegin = reinterpret_cast<uintptr_t>(image);
+    m_moduleEnd = m_moduleBegin + headers->OptionalHeader.SizeOfImage;
+}
+
+uint32_t StackTable::Capture() {
+    void* captured[kCaptureFrames];
+    const uint32_t count =
+        RtlCaptureStackBackTrace(0, kCaptureFrames, captured, nullptr);
+
+    // The watcher's frames come first: this function, the event handler
+    // and the delegate that called it.
+    uint32_t first = 0;
+    while (first < count &&
+           reinterpret_cast<uintptr_t>(captured[first]) >= m_moduleBegin &&
+           reinterpret_cast<uintptr_t>(captured[first]) < m_moduleEnd) {
+        first++;
+    }
+
+    return Intern({captured + first, count - first});
+}
+
+uint32_t StackTable::Intern(std::span<void* const> frames) {
+    frames = frames.first(std::min<size_t>(frames.size(), kMaxFrames));
+
+    const uint64_t hash = HashFrames(frames);
+    auto find = m_index.find(hash);
+    if (find != m_index.end()) {
+        Entry& entry = GetEntry(find->second);
+        if (!std::equal(frames.begin(), frames.end(), entry.frames,
+                        entry.frames + entry.frameCount)) {
+            CountDropped();
+            return kInvalidId;
+        }
+
+        entry.events.store(entry.events.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+        return find->second;
+    }
+
+    const uint32_t id = m_size.load(std::memory_order_relaxed);
+    const uint32_t segment = id / kStacksPerSegment;
+    if (segment >= kMaxSegments) {
+        CountDropped();
+        return kInvalidId;
+    }
+
+    if (!m_segments[segment]) {
+        m_segments[segment] = std::make_unique<Entry[]>(kStacksPerSegment);
+    }
+
+    Entry& entry = GetEntry(id);
+    entry.frameCount = static_cast<uint32_t>(frames.size());
+    std::copy(frames.begin(), frames.end(), entry.frames);
+    entry.events.store(1, std::memory_order_relaxed);
+    m_index.emplace(hash, id);
+
+    // Publishes the entry and the segment pointer.
+    m_size.store(id + 1, std::memory_order_release);
+
+    return id;
+}
+
+std::span<void* const> StackTable::Get(uint32_t id) const {
+    if (id >= Size()) {
+        return {};
+    }
+
+    const Entry& entry = GetEntry(id);
+    return {entry.frames, entry.frameCount};
+}
+
+void StackTable::Write(JsonLinesWriter& report, uint32_t id) const {
+    const auto frames = Get(id);
+
+    report.BeginLine();
+    report.Field("type", std::string_view("stack"));
+    report.Field("id", uint64_t{id});
+    if (!frames.empty()) {
+        report.Field("events",
+                     GetEntry(id).events.load(std::memory_order_relaxed));
+    }
+    report.BeginArray("frames");
+
+    // Frames of a stack are mostly in a few modules, in runs.
+    HMODULE module = nullptr;
+    wchar_t frame[MAX_PATH + 24];
+    size_t nameLength = 0;
+
+    constexpr DWORD kFlags = GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+                             GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT;
+
+    // Appends "0x" and value in hex, returns the new end.
+    auto appendHex = [](wchar_t* out, uint64_t value) {
+        char digits[16];
+        const size_t count = FormatHex(value, digits);
+
+        *out++ = L'0';
+        *out++ = L'x';
+        return std::copy(digits + 16 - count, digits + 16, out);
+    };
+
+    for (void* address : frames) {
+        HMODULE frameModule;
+        if (!GetModuleHandleExW(kFlags, static_cast<LPCWSTR>(address),
+                                &frameModule)) {
+            // Unloaded since, or code outside of any image.
+            const wchar_t* end =
+                appendHex(frame, reinterpret_cast<uintptr_t>(address));
+            report.Value(std::wstring_view(frame, end - frame));
+            module = nullptr;
+            continue;
+        }
+
+        if (frameModule != module) {
+            module = frameModule;
+
+            wchar_t buffer[MAX_PATH];
+            const std::wstring_view path(
+                buffer, GetModuleFileNameW(module, buffer, MAX_PATH));
+            const std::wstring_view name = path.substr(path.rfind(L'\\') + 1);
+
+            std::copy(name.begin(), name.end(), frame);
+            nameLength = name.size();
+            frame[nameLength++] = L'+';
+        }
+
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(address) -
+                                 reinterpret_cast<uintptr_t>(module);
+        const wchar_t* end = appendHex(frame + nameLength, offset);
+        report.Value(std::wstring_view(frame, end - frame));
+    }
+
+    report.EndArray();
+    report.EndLine();
+}
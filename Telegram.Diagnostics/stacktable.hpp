@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <unordered_map>
+
+#include "jsonlineswriter.hpp"
+
+// Deduplicated call stacks, so that history records can say which code was
+// running when an event was raised with a 32-bit id.
+//
+// A stack is the return addresses of the capturing thread, without the
+// watcher's own frames, and is stored once however many events share it.
+// Like PathTable, entries are written before the size that covers them is
+// published and never move, so readers resolve ids lock-free from any
+// thread. Past kMaxStacks, new stacks are only counted as dropped.
+class StackTable {
+   public:
+    static constexpr uint32_t kInvalidId = UINT32_MAX;
+    static constexpr uint32_t kMaxFrames = 24;
+
+    static constexpr uint32_t kStacksPerSegment = 256;
+    static constexpr uint32_t kMaxSegments = 32;
+    // Ids are always below this.
+    static constexpr uint32_t kMaxStacks = kStacksPerSegment * kMaxSegments;
+
+    StackTable();
+
+    StackTable(const StackTable&) = delete;
+    StackTable& operator=(const StackTable&) = delete;
+
+    // Writer only. Captures the calling thread's stack and counts an event
+    // for it.
+    uint32_t Capture();
+
+    // Writer only. Same, for frames captured elsewhere.
+    uint32_t Intern(std::span<void* const> frames);
+
+    // Any thread. Empty for ids that aren't published.
+    std::span<void* const> Get(uint32_t id) const;
+
+    // Any thread. Writes a "stack" report line, each frame as module+offset
+    // so that it can be symbolized offline. Doesn't allocate.
+    void Write(JsonLinesWriter& report, uint32_t id) const;
+
+    uint32_t Size() const { return m_size.load(std::memory_order_acquire); }
+    uint64_t Dropped() const {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+   private:
+    struct Entry {
+        uint32_t frameCount;
+        std::atomic<uint64_t> events{0};
+        void* frames[kMaxFrames];
+    };
+
+    // What RtlCaptureStackBackTrace is asked for, to have kMaxFrames left
+    // once the watcher's frames are skipped.
+    static constexpr uint32_t kCaptureFrames = 48;
+
+    Entry& GetEntry(uint32_t id) const {
+        return m_segments[id / kStacksPerSegment][id % kStacksPerSegment];
+    }
+
+    void CountDropped() {
+        m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<Entry[]> m_segments[kMaxSegments];
+    std::atomic<uint32_t> m_size{0};
+    std::atomic<uint64_t> m_dropped{0};
+
+    // The watcher's own image, whose frames are left out.
+    uintptr_t m_moduleBegin = 0;
+    uintptr_t m_moduleEnd = 0;
+
+    // Writer-only state. Keyed by the hash of the frames.
+    std::unordered_map<uint64_t, uint32_t> m_index;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+
+#include "latencyhistogram.hpp"
+
+// Watcher entry points whose own duration is measured.
+enum class WatcherCallback : uint32_t {
+    // OnVisualTreeChange.
+    kTreeChange,
+    // The event handlers subscribed on elements.
+    kElementEvent,
+    // A batch of deferred subscriptions after the initial replay.
+    kSubscribe,
+    // The UnhandledException handler, report included.
+    kCrashReport,
+    kSnapshot,
+    kCount,
+};
+
+constexpr std::string_view WatcherCallbackName(WatcherCallback callback) {
+    switch (callback) {
+        case WatcherCallback::kTreeChange:
+            return "treeChange";
+        case WatcherCallback::kElementEvent:
+            return "elementEvent";
+        case WatcherCallback::kSubscribe:
+            return "subscribe";
+        case WatcherCallback::kCrashReport:
+            return "crashReport";
+        case WatcherCallback::kSnapshot:
+            return "snapshot";
+        case WatcherCallback::kCount:
+            break;
+    }
+
+    return "unknown";
+}
+
+// Counters published for stats readers and the crash report. Written by the
+// watcher under its writer mutex, read lock-free from any thread.
+struct WatcherStats {
+    // Every event that reached a handler, sampled or not.
+    std::atomic<uint64_t> eventsSeen{0};
+    // Events that were written to the history.
+    std::atomic<uint64_t> eventsRecorded{0};
+    // Attach latency from start() in the launcher (or from the watcher's
+    // creation if the launcher didn't say) to the end of the initial tree
+    // replay, and to the last deferred subscription. 0 until reached.
+    std::atomic<uint64_t> attachReplayedUs{0};
+    std::atomic<uint64_t> attachSyncedUs{0};
+
+    // Time spent in each callback, recorded with the lock that serializes
+    // it held: the writer mutex, or the report or snapshot mutex.
+    LatencyHistogram latency[static_cast<size_t>(WatcherCallback::kCount)];
+
+    LatencyHistogram& Latency(WatcherCallback callback) {
+        return latency[static_cast<size_t>(callback)];
+    }
+};
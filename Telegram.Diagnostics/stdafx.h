@@ -5,10 +5,15 @@
 // STL
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
 #include <format>
 #include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
-#include <shared_mutex>
+#include <span>
 #include <string_view>
 #include <unordered_map>
 #include <vector>
@@ -60,7 +65,11 @@ extern CAppModule _Module;
 
 #include <winrt/windows.foundation.collections.h>
 #include <winrt/windows.foundation.h>
+#include <winrt/windows.system.h>
 #include <winrt/windows.ui.core.h>
 #include <winrt/windows.ui.xaml.h>
 #include <winrt/windows.ui.xaml.hosting.h>
 #include <winrt/windows.ui.xaml.media.h>
+
+#include <winrt/microsoft.ui.dispatching.h>
+#include <winrt/microsoft.ui.xaml.h>
@@ -0,0 +1,213 @@
+#include "stdafx.h"
+
+#include "stringkernels.hpp"
+
+#if (defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)) && \
+    WCHAR_MAX == 0xFFFF
+#define STRING_KERNELS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr size_t kNpos = std::wstring_view::npos;
+
+#ifdef STRING_KERNELS_SSE2
+
+// Eight code units per block.
+constexpr size_t kBlock = 8;
+
+__m128i Load(const wchar_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+// Two bits per code unit, set where the units of a and b are equal.
+unsigned int EqualMask(__m128i a, __m128i b) {
+    return static_cast<unsigned int>(
+        _mm_movemask_epi8(_mm_cmpeq_epi16(a, b)));
+}
+
+#endif
+
+}  // namespace
+
+bool StartsWith(std::wstring_view text, std::wstring_view prefix) {
+    if (prefix.size() > text.size()) {
+        return false;
+    }
+
+    const wchar_t* a = text.data();
+    const wchar_t* b = prefix.data();
+    size_t i = 0;
+
+#ifdef STRING_KERNELS_SSE2
+    for (; i + kBlock <= prefix.size(); i += kBlock) {
+        if (EqualMask(Load(a + i), Load(b + i)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+
+    for (; i < prefix.size(); i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t Find(std::wstring_view text, std::wstring_view needle) {
+    if (needle.empty()) {
+        return 0;
+    }
+
+    if (needle.size() > text.size()) {
+        return kNpos;
+    }
+
+    // Positions past this one leave no room for the needle.
+    const size_t last = text.size() - needle.size();
+    size_t i = 0;
+
+#ifdef STRING_KERNELS_SSE2
+    // Candidates are where both the needle's first and last units match,
+    // which in paths rules out nearly everything before a full compare.
+    const __m128i first = _mm_set1_epi16(static_cast<short>(needle.front()));
+    const __m128i end = _mm_set1_epi16(static_cast<short>(needle.back()));
+
+    for (; i + kBlock <= last + 1; i += kBlock) {
+        const __m128i a = _mm_cmpeq_epi16(Load(text.data() + i), first);
+        const __m128i b =
+            _mm_cmpeq_epi16(Load(text.data() + i + needle.size() - 1), end);
+        auto mask =
+            static_cast<unsigned int>(_mm_movemask_epi8(_mm_and_si128(a, b)));
+
+        while (mask) {
+            const int bit = std::countr_zero(mask);
+            const size_t position = i + bit / 2;
+            if (StartsWith(text.substr(position), needle)) {
+                return position;
+            }
+
+            mask &= ~(3u << bit);
+        }
+    }
+#endif
+
+    for (; i <= last; i++) {
+        if (text[i] == needle.front() &&
+            StartsWith(text.substr(i), needle)) {
+            return i;
+        }
+    }
+
+    return kNpos;
+}
+
+size_t FindLast(std::wstring_view text, wchar_t c) {
+    size_t i = text.size();
+
+#ifdef STRING_KERNELS_SSE2
+    const __m128i value = _mm_set1_epi16(static_cast<short>(c));
+    while (i >= kBlock) {
+        i -= kBlock;
+        const unsigned int mask = EqualMask(Load(text.data() + i), value);
+        if (mask) {
+            return i + (std::bit_width(mask) - 1) / 2;
+        }
+    }
+#endif
+
+    while (i > 0) {
+        if (text[--i] == c) {
+            return i;
+        }
+    }
+
+    return kNpos;
+}
+
+size_t PlainAsciiLength(std::wstring_view text) {
+    size_t i = 0;
+
+#ifdef STRING_KERNELS_SSE2
+    // Signed compares: units from 0x8000 up are negative, so below 0x20.
+    const __m128i low = _mm_set1_epi16(0x1F);
+    const __m128i high = _mm_set1_epi16(0x80);
+    const __m128i quote = _mm_set1_epi16('"');
+    const __m128i backslash = _mm_set1_epi16('\\');
+
+    for (; i + kBlock <= text.size(); i += kBlock) {
+        const __m128i x = Load(text.data() + i);
+        const __m128i plain =
+            _mm_and_si128(_mm_cmpgt_epi16(x, low), _mm_cmplt_epi16(x, high));
+        const __m128i special = _mm_or_si128(_mm_cmpeq_epi16(x, quote),
+                                             _mm_cmpeq_epi16(x, backslash));
+        const auto mask = static_cast<unsigned int>(
+            _mm_movemask_epi8(_mm_andnot_si128(special, plain)));
+        if (mask != 0xFFFF) {
+            return i + std::countr_one(mask) / 2;
+        }
+    }
+#endif
+
+    for (; i < text.size(); i++) {
+        const wchar_t c = text[i];
+        if (c < 0x20 || c >= 0x80 || c == '"' || c == '\\') {
+            break;
+        }
+    }
+
+    return i;
+}
+
+void NarrowAscii(const wchar_t* in, size_t count, char* out) {
+    size_t i = 0;
+
+#ifdef STRING_KERNELS_SSE2
+    for (; i + 2 * kBlock <= count; i += 2 * kBlock) {
+        _mm_storeu_si128(
+            reinterpret_cast<__m128i*>(out + i),
+            _mm_packus_epi16(Load(in + i), Load(in + i + kBlock)));
+    }
+#endif
+
+    for (; i < count; i++) {
+        out[i] = static_cast<char>(in[i]);
+    }
+}
+
+size_t FormatHex(uint64_t value, char* out) {
+    const size_t significant = value ? (std::bit_width(value) + 3) / 4 : 1;
+
+#ifdef STRING_KERNELS_SSE2
+    // Most significant byte first, then each byte split into its high and
+    // low nibble.
+    uint64_t bytes = 0;
+    for (int i = 0; i < 8; i++) {
+        bytes |= ((value >> (8 * i)) & 0xFF) << (8 * (7 - i));
+    }
+
+    const __m128i packed =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&bytes));
+    const __m128i mask = _mm_set1_epi8(0x0F);
+    const __m128i nibbles = _mm_unpacklo_epi8(
+        _mm_and_si128(_mm_srli_epi16(packed, 4), mask),
+        _mm_and_si128(packed, mask));
+
+    const __m128i letters =
+        _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)),
+                      _mm_set1_epi8('a' - '0' - 10));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(out),
+        _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters));
+#else
+    for (int i = 15; i >= 0; i--) {
+        out[i] = "0123456789abcdef"[value & 0xF];
+        value >>= 4;
+    }
+#endif
+
+    return significant;
+}
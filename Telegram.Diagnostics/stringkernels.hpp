@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// UTF-16 string primitives for the hot paths that handle element paths:
+// coalescing compares every recorded event's path against the previous
+// one, and reports search and write out every path they refer to.
+//
+// SSE2 on x86 and x64, where it is always available, eight code units at a
+// time. Other targets get the scalar loops. None of them allocate.
+
+// Whether text begins with prefix.
+bool StartsWith(std::wstring_view text, std::wstring_view prefix);
+
+// Position of the first occurrence of needle in text, npos if none.
+size_t Find(std::wstring_view text, std::wstring_view needle);
+
+// Position of the last c in text, npos if none.
+size_t FindLast(std::wstring_view text, wchar_t c);
+
+// Length of the run of code units at the start of text that a JSON string
+// takes as is: printable ASCII other than '"' and '\\'.
+size_t PlainAsciiLength(std::wstring_view text);
+
+// Stores count code units, all ASCII, as count bytes.
+void NarrowAscii(const wchar_t* in, size_t count, char* out);
+
+// Stores the 16 lowercase hex digits of value and returns how many of the
+// last ones are significant, at least 1.
+size_t FormatHex(uint64_t value, char* out);
@@ -2,19 +2,22 @@
 
 #include "tap.hpp"
 
-winrt::com_ptr<VisualTreeWatcher> ExplorerTAP::s_VisualTreeWatcher;
+template <typename Framework>
+winrt::com_ptr<VisualTreeWatcher<Framework>>
+    ExplorerTAP<Framework>::s_VisualTreeWatcher;
 
-HRESULT ExplorerTAP::SetSite(IUnknown* pUnkSite) try {
+template <typename Framework>
+HRESULT ExplorerTAP<Framework>::SetSite(IUnknown* pUnkSite) try {
     // Only ever 1 VTW at once.
     if (s_VisualTreeWatcher.get()) {
-        s_VisualTreeWatcher->Activate();
         throw winrt::hresult_illegal_method_call();
     }
 
     site.copy_from(pUnkSite);
 
     if (site) {
-        s_VisualTreeWatcher = winrt::make_self<VisualTreeWatcher>(site);
+        s_VisualTreeWatcher =
+            winrt::make_self<VisualTreeWatcher<Framework>>(site);
     }
 
     return S_OK;
@@ -22,6 +25,10 @@ HRESULT ExplorerTAP::SetSite(IUnknown* pUnkSite) try {
     return winrt::to_hresult();
 }
 
-HRESULT ExplorerTAP::GetSite(REFIID riid, void** ppvSite) noexcept {
+template <typename Framework>
+HRESULT ExplorerTAP<Framework>::GetSite(REFIID riid, void** ppvSite) noexcept {
     return site.as(riid, ppvSite);
 }
+
+template struct ExplorerTAP<UwpFramework>;
+template struct ExplorerTAP<WinUIFramework>;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "framework.hpp"
 #include "visualtreewatcher.hpp"
 #include "winrt.hpp"
 
@@ -10,14 +11,25 @@ static constexpr CLSID CLSID_Telegram_DiagnosticsTAP = {
     0x48ac,
     {0xbe, 0x31, 0xa5, 0x48, 0x5a, 0x74, 0x35, 0xe7}};
 
-struct ExplorerTAP
-    : winrt::implements<ExplorerTAP, IObjectWithSite, winrt::non_agile> {
+// {0E4C0E1F-5A3B-4F7E-9C2D-6B8A1D3F7C21}
+static constexpr CLSID CLSID_Telegram_DiagnosticsWinUITAP = {
+    0x0e4c0e1f,
+    0x5a3b,
+    0x4f7e,
+    {0x9c, 0x2d, 0x6b, 0x8a, 0x1d, 0x3f, 0x7c, 0x21}};
+
+// Each framework has its own CLSID, so the class that XAML instantiates
+// already knows which watcher to create.
+template <typename Framework>
+struct ExplorerTAP : winrt::implements<ExplorerTAP<Framework>,
+                                       IObjectWithSite,
+                                       winrt::non_agile> {
     HRESULT STDMETHODCALLTYPE SetSite(IUnknown* pUnkSite) override;
     HRESULT STDMETHODCALLTYPE GetSite(REFIID riid,
                                       void** ppvSite) noexcept override;
 
    private:
-    static winrt::com_ptr<VisualTreeWatcher> s_VisualTreeWatcher;
+    static winrt::com_ptr<VisualTreeWatcher<Framework>> s_VisualTreeWatcher;
 
     winrt::com_ptr<IUnknown> site;
 };
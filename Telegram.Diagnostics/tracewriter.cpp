@@ -0,0 +1,267 @@
+#include "stdafx.h"
+
+#include "tracewriter.hpp"
+
+#include "clock.hpp"
+
+namespace {
+
+template <typename T>
+void AppendBytes(std::vector<uint8_t>& output, const T& value) {
+    const auto bytes = reinterpret_cast<const uint8_t*>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(T));
+}
+
+}  // namespace
+
+TraceWriter::TraceWriter(std::wstring folder,
+                         const PathTable& paths,
+                         OwnedMutex& writerMutex,
+                         uint64_t maxFileBytes,
+                         unsigned int maxFiles,
+                         std::function<trace::StatsRecord()> queryStats)
+    : m_folder(std::move(folder)),
+      m_paths(paths),
+      m_writerMutex(writerMutex),
+      m_maxFileBytes(maxFileBytes),
+      m_maxFiles(maxFiles ? maxFiles : 1),
+      m_queryStats(std::move(queryStats)) {
+    for (auto& buffer : m_buffers) {
+        buffer.items = std::make_unique<HistoryItem[]>(kBufferRecords);
+    }
+
+    m_work = CreateThreadpoolWork(WriteCallback, this, nullptr);
+
+    m_timer = CreateThreadpoolTimer(TimerCallback, this, nullptr);
+    if (m_timer) {
+        // Negative means relative, in 100 ns units.
+        const int64_t due = -int64_t{kIdleFlushMilliseconds} * 10000;
+        FILETIME dueTime{
+            .dwLowDateTime = static_cast<DWORD>(due),
+            .dwHighDateTime = static_cast<DWORD>(due >> 32),
+        };
+        SetThreadpoolTimer(m_timer, &dueTime, kIdleFlushMilliseconds, 0);
+    }
+}
+
+TraceWriter::~TraceWriter() {
+    if (m_timer) {
+        SetThreadpoolTimer(m_timer, nullptr, 0, 0);
+        WaitForThreadpoolTimerCallbacks(m_timer, TRUE);
+        CloseThreadpoolTimer(m_timer);
+    }
+
+    // What the active buffer holds would be lost otherwise.
+    {
+        std::scoped_lock lock(m_writerMutex);
+        Flush();
+    }
+
+    if (m_work) {
+        WaitForThreadpoolWorkCallbacks(m_work, FALSE);
+        CloseThreadpoolWork(m_work);
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+    }
+}
+
+void TraceWriter::Append(const HistoryItem& item) {
+    Buffer& buffer = m_buffers[m_active];
+    if (buffer.busy.load(std::memory_order_acquire)) {
+        m_droppedRecords.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    if (buffer.count == 0) {
+        m_activeSince = item.timestamp;
+    }
+
+    buffer.items[buffer.count++] = item;
+
+    if (buffer.count == kBufferRecords ||
+        item.timestamp - m_activeSince >= TicksPerSecond()) {
+        Flush();
+    }
+}
+
+void TraceWriter::Flush() {
+    Buffer& buffer = m_buffers[m_active];
+    if (!m_work || buffer.count == 0 ||
+        buffer.busy.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    buffer.sequence = m_nextSequence++;
+    buffer.busy.store(true, std::memory_order_release);
+    SubmitThreadpoolWork(m_work);
+
+    m_active ^= 1;
+}
+
+void CALLBACK TraceWriter::WriteCallback(PTP_CALLBACK_INSTANCE,
+                                         PVOID context,
+                                         PTP_WORK) {
+    static_cast<TraceWriter*>(context)->WriteBusyBuffers();
+}
+
+void CALLBACK TraceWriter::TimerCallback(PTP_CALLBACK_INSTANCE,
+                                         PVOID context,
+                                         PTP_TIMER) {
+    static_cast<TraceWriter*>(context)->FlushIdle();
+}
+
+void TraceWriter::FlushIdle() {
+    // A writer that holds the lock is busy appending, and flushes when it
+    // appends a record a second after the first. The next tick checks
+    // again otherwise.
+    std::unique_lock lock(m_writerMutex, std::try_to_lock);
+    if (!lock) {
+        return;
+    }
+
+    if (m_buffers[m_active].count &&
+        QueryTicks() - m_activeSince >= TicksPerSecond()) {
+        Flush();
+    }
+}
+
+void TraceWriter::WriteBusyBuffers() {
+    // Callbacks of the same work object can run concurrently.
+    std::scoped_lock lock(m_fileMutex);
+
+    Buffer* busy[2];
+    size_t count = 0;
+    for (auto& buffer : m_buffers) {
+        if (buffer.busy.load(std::memory_order_acquire)) {
+            busy[count++] = &buffer;
+        }
+    }
+
+    if (count == 2 && busy[0]->sequence > busy[1]->sequence) {
+        std::swap(busy[0], busy[1]);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        WriteBuffer(*busy[i]);
+        busy[i]->count = 0;
+        busy[i]->busy.store(false, std::memory_order_release);
+    }
+}
+
+void TraceWriter::WriteBuffer(const Buffer& buffer) {
+    m_output.clear();
+
+    for (size_t i = 0; i < buffer.count; i++) {
+        const HistoryItem& item = buffer.items[i];
+
+        if (m_file == INVALID_HANDLE_VALUE ||
+            m_fileBytes + m_output.size() >= m_maxFileBytes) {
+            WriteOutput();
+            if (!OpenNextFile()) {
+                m_droppedRecords.fetch_add(buffer.count - i,
+                                           std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        // Paths are defined once per file, right before their first use.
+        const auto path = m_paths.Get(item.pathId);
+        if (!path.empty()) {
+            if (item.pathId >= m_definedPaths.size()) {
+                m_definedPaths.resize(m_paths.Size());
+            }
+
+            if (!m_definedPaths[item.pathId]) {
+                m_definedPaths[item.pathId] = true;
+
+                AppendBytes(m_output,
+                            trace::PathRecord{
+                                .type = trace::RecordType::kPath,
+                                .pathId = item.pathId,
+                                .length = static_cast<uint32_t>(path.size())});
+                const auto chars =
+                    reinterpret_cast<const uint8_t*>(path.data());
+                m_output.insert(m_output.end(), chars,
+                                chars + path.size() * sizeof(wchar_t));
+            }
+        }
+
+        AppendBytes(m_output, trace::EventRecord{
+                                  .type = trace::RecordType::kEvent,
+                                  .kind = item.kind,
+                                  .timestamp = item.timestamp,
+                                  .handle = item.handle,
+                                  .pathId = item.pathId});
+    }
+
+    if (m_queryStats && m_file != INVALID_HANDLE_VALUE) {
+        trace::StatsRecord stats = m_queryStats();
+        stats.type = trace::RecordType::kStats;
+        stats.timestamp = QueryTicks();
+        stats.droppedRecords = DroppedRecords();
+        AppendBytes(m_output, stats);
+    }
+
+    WriteOutput();
+}
+
+void TraceWriter::WriteOutput() {
+    if (m_output.empty()) {
+        return;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE) {
+        DWORD written = 0;
+        WriteFile(m_file, m_output.data(), static_cast<DWORD>(m_output.size()),
+                  &written, nullptr);
+        m_fileBytes += written;
+        m_bytesWritten.fetch_add(written, std::memory_order_relaxed);
+    }
+
+    m_output.clear();
+}
+
+bool TraceWriter::OpenNextFile() {
+    if (m_file != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    // Not for every record while the folder is unwritable, the buffers are
+    // dropped until it's time to try again.
+    if (QueryTicks() < m_nextOpenTicks) {
+        return false;
+    }
+
+    const auto fileName =
+        std::format(L"{}\\LayoutTrace-{}.bin", m_folder,
+                    m_fileSequence % m_maxFiles);
+
+    // Shared for reading so that a collector can tail the file.
+    m_file = CreateFile(fileName.c_str(), GENERIC_WRITE,
+                        FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                        CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_file == INVALID_HANDLE_VALUE) {
+        m_nextOpenTicks =
+            QueryTicks() + int64_t{kOpenRetrySeconds} * TicksPerSecond();
+        return false;
+    }
+
+    m_fileBytes = 0;
+    m_definedPaths.assign(m_paths.Size(), false);
+
+    const trace::FileHeader header{
+        .magic = trace::kMagic,
+        .version = trace::kVersion,
+        .sequence = m_fileSequence++,
+        .pid = GetCurrentProcessId(),
+        .reserved = 0,
+        .ticksPerSecond = TicksPerSecond(),
+    };
+
+    AppendBytes(m_output, header);
+    WriteOutput();
+    return true;
+}
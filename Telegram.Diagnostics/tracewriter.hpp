@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../common/traceformat.h"
+#include "history.hpp"
+#include "ownedmutex.hpp"
+#include "pathtable.hpp"
+
+// Streams recorded events to size-bounded, rotating files in the
+// background (format in common/traceformat.h).
+//
+// The hot path only copies the fixed-size HistoryItem into the active one
+// of two buffers. When that buffer fills up, or a second after its first
+// record, the buffers are swapped and a thread pool worker resolves the
+// paths and writes the full buffer with one sequential WriteFile. If the
+// worker still owns the other buffer by then, records are dropped and
+// counted instead of stalling the UI thread, as are the records of buffers
+// written while no file can be created.
+//
+// Each buffer is followed by a stats record from queryStats, called on the
+// worker, so readers of the files get the counters along with the events.
+//
+// Append() and Flush() run under the owner's writer lock. A thread pool
+// timer takes it too, once a second, to hand over records that have waited
+// for a second while the app is idle.
+class TraceWriter {
+   public:
+    TraceWriter(std::wstring folder,
+                const PathTable& paths,
+                OwnedMutex& writerMutex,
+                uint64_t maxFileBytes,
+                unsigned int maxFiles,
+                std::function<trace::StatsRecord()> queryStats);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    // Under the writer lock.
+    void Append(const HistoryItem& item);
+
+    // Under the writer lock. Hands the active buffer to the worker if it has
+    // records.
+    void Flush();
+
+    // Any thread.
+    uint64_t DroppedRecords() const {
+        return m_droppedRecords.load(std::memory_order_relaxed);
+    }
+
+    uint64_t BytesWritten() const {
+        return m_bytesWritten.load(std::memory_order_relaxed);
+    }
+
+   private:
+    static constexpr size_t kBufferRecords = 8192;
+    static constexpr DWORD kIdleFlushMilliseconds = 1000;
+    static constexpr unsigned int kOpenRetrySeconds = 5;
+
+    struct Buffer {
+        std::unique_ptr<HistoryItem[]> items;
+        size_t count = 0;
+        uint64_t sequence = 0;
+        // Set by the writer when it hands the buffer over, cleared by the
+        // worker once the buffer is on disk.
+        std::atomic<bool> busy{false};
+    };
+
+    static void CALLBACK WriteCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_WORK work);
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+    void FlushIdle();
+    void WriteBusyBuffers();
+    void WriteBuffer(const Buffer& buffer);
+    void WriteOutput();
+    // False if the file couldn't be created, or the last attempt failed
+    // less than kOpenRetrySeconds ago.
+    bool OpenNextFile();
+
+    const std::wstring m_folder;
+    const PathTable& m_paths;
+    OwnedMutex& m_writerMutex;
+    const uint64_t m_maxFileBytes;
+    const unsigned int m_maxFiles;
+    const std::function<trace::StatsRecord()> m_queryStats;
+
+    // Guarded by m_writerMutex.
+    Buffer m_buffers[2];
+    size_t m_active = 0;
+    int64_t m_activeSince = 0;
+    uint64_t m_nextSequence = 0;
+
+    PTP_WORK m_work = nullptr;
+    PTP_TIMER m_timer = nullptr;
+
+    // Worker state.
+    std::mutex m_fileMutex;
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    uint64_t m_fileBytes = 0;
+    uint64_t m_fileSequence = 0;
+    int64_t m_nextOpenTicks = 0;
+    std::vector<bool> m_definedPaths;
+    std::vector<uint8_t> m_output;
+
+    std::atomic<uint64_t> m_droppedRecords{0};
+    std::atomic<uint64_t> m_bytesWritten{0};
+};
@@ -0,0 +1,419 @@
+#include "stdafx.h"
+
+#include "tracing.hpp"
+
+#include "clock.hpp"
+
+namespace detail {
+std::atomic<TraceLevel> g_traceLevel{TraceLevel::kOff};
+}  // namespace detail
+
+namespace {
+
+constexpr size_t kBufferSize = 64 * 1024;
+static_assert((kBufferSize & (kBufferSize - 1)) == 0);
+
+constexpr size_t kMaxArgs = 8;
+
+#pragma pack(push, 1)
+struct RecordHeader {
+    uint16_t size;
+    TraceLevel level;
+    uint8_t argCount;
+    DWORD threadId;
+    const wchar_t* format;
+    int64_t timestamp;
+};
+#pragma pack(pop)
+
+// An argument is its type, then 8 bytes for numbers, or a 16-bit length
+// and the characters for strings.
+constexpr size_t kMaxRecordSize =
+    sizeof(RecordHeader) +
+    kMaxArgs * (1 + sizeof(uint16_t) +
+                TraceArg::kMaxStringLength * sizeof(wchar_t));
+static_assert(kMaxRecordSize <= UINT16_MAX);
+
+// Written by the thread that leased it, read by whoever holds
+// g_drainMutex. The positions only grow and are masked on access.
+struct ThreadBuffer {
+    std::atomic<uint32_t> writePosition{0};
+    std::atomic<uint32_t> readPosition{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<bool> leased{true};
+    ThreadBuffer* next = nullptr;
+    uint8_t data[kBufferSize];
+};
+
+// Buffers are never freed, a thread that exits hands its buffer to the
+// next thread that traces.
+std::atomic<ThreadBuffer*> g_buffers{nullptr};
+
+std::mutex g_drainMutex;
+const int64_t g_startTicks = QueryTicks();
+
+// How often the formatter thread drains the buffers while tracing is on.
+constexpr DWORD kFlushIntervalMilliseconds = 50;
+
+// The formatter thread, started by the first SetTraceLevel() that turns
+// tracing on and stopped by StopTracing(). Guarded by g_threadMutex.
+std::mutex g_threadMutex;
+HANDLE g_thread = nullptr;
+// Auto-reset, signaled when the level changes or the thread should stop.
+HANDLE g_wake = nullptr;
+std::atomic<bool> g_stop{false};
+
+struct BufferLease {
+    ThreadBuffer* buffer = nullptr;
+
+    ~BufferLease() {
+        if (buffer) {
+            buffer->leased.store(false, std::memory_order_release);
+        }
+    }
+};
+
+thread_local BufferLease t_lease;
+
+ThreadBuffer* LeaseBuffer() {
+    for (auto* buffer = g_buffers.load(std::memory_order_acquire); buffer;
+         buffer = buffer->next) {
+        bool leased = false;
+        if (buffer->leased.compare_exchange_strong(
+                leased, true, std::memory_order_acquire)) {
+            return buffer;
+        }
+    }
+
+    auto* buffer = new ThreadBuffer;
+    buffer->next = g_buffers.load(std::memory_order_relaxed);
+    while (!g_buffers.compare_exchange_weak(buffer->next, buffer,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+    }
+
+    return buffer;
+}
+
+void CopyIn(ThreadBuffer& buffer,
+            uint32_t position,
+            const uint8_t* source,
+            size_t size) {
+    const size_t offset = position & (kBufferSize - 1);
+    const size_t first = std::min(size, kBufferSize - offset);
+    memcpy(buffer.data + offset, source, first);
+    memcpy(buffer.data, source + first, size - first);
+}
+
+void CopyOut(const ThreadBuffer& buffer,
+             uint32_t position,
+             uint8_t* destination,
+             size_t size) {
+    const size_t offset = position & (kBufferSize - 1);
+    const size_t first = std::min(size, kBufferSize - offset);
+    memcpy(destination, buffer.data + offset, first);
+    memcpy(destination + first, buffer.data, size - first);
+}
+
+class LineBuilder {
+   public:
+    void Append(std::wstring_view text) {
+        const size_t count = std::min(text.size(), kCapacity - m_size);
+        memcpy(m_line + m_size, text.data(), count * sizeof(wchar_t));
+        m_size += count;
+    }
+
+    // Latin-1, the narrow strings are our own ASCII names.
+    void Append(std::string_view text) {
+        for (char c : text) {
+            if (m_size < kCapacity) {
+                m_line[m_size++] = static_cast<unsigned char>(c);
+            }
+        }
+    }
+
+    template <typename... Args>
+    void AppendFormat(const wchar_t* format, Args... args) {
+        const int written = swprintf_s(m_line + m_size, kCapacity - m_size + 1,
+                                       format, args...);
+        if (written > 0) {
+            m_size += written;
+        }
+    }
+
+    const wchar_t* Terminate() {
+        m_line[m_size] = L'\0';
+        return m_line;
+    }
+
+   private:
+    static constexpr size_t kCapacity = 2046;
+
+    // One more for the terminator.
+    wchar_t m_line[kCapacity + 1];
+    size_t m_size = 0;
+};
+
+void OutputRecord(const uint8_t* record) {
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t* p = record + sizeof(header);
+
+    static constexpr wchar_t kLevelNames[] = L"-EIV";
+
+    LineBuilder line;
+    line.AppendFormat(L"[Telegram.Diagnostics] %10.3f %5u %c ",
+                      TicksToMicroseconds(header.timestamp - g_startTicks) /
+                          1000.0,
+                      header.threadId,
+                      kLevelNames[static_cast<uint32_t>(header.level) & 3]);
+
+    auto appendArg = [&] {
+        const auto type = static_cast<TraceArg::Type>(*p++);
+
+        if (type == TraceArg::Type::kString ||
+            type == TraceArg::Type::kNarrowString) {
+            uint16_t length;
+            memcpy(&length, p, sizeof(length));
+            p += sizeof(length);
+
+            if (type == TraceArg::Type::kString) {
+                // Not necessarily aligned, copy in small chunks.
+                wchar_t chars[64];
+                while (length) {
+                    const size_t count = std::min<size_t>(length, 64);
+                    memcpy(chars, p, count * sizeof(wchar_t));
+                    line.Append(std::wstring_view(chars, count));
+                    p += count * sizeof(wchar_t);
+                    length -= static_cast<uint16_t>(count);
+                }
+            } else {
+                line.Append(
+                    std::string_view(reinterpret_cast<const char*>(p), length));
+                p += length;
+            }
+
+            return;
+        }
+
+        uint64_t value;
+        memcpy(&value, p, sizeof(value));
+        p += sizeof(value);
+
+        switch (type) {
+            case TraceArg::Type::kSigned:
+                line.AppendFormat(L"%lld", static_cast<int64_t>(value));
+                break;
+
+            case TraceArg::Type::kUnsigned:
+                line.AppendFormat(L"%llu", value);
+                break;
+
+            default:
+                line.AppendFormat(L"0x%llX", value);
+                break;
+        }
+    };
+
+    size_t argsLeft = header.argCount;
+    for (const wchar_t* f = header.format; *f; f++) {
+        if (f[0] == L'{' && f[1] == L'}') {
+            if (argsLeft) {
+                appendArg();
+                argsLeft--;
+            }
+
+            f++;
+            continue;
+        }
+
+        line.Append(std::wstring_view(f, 1));
+    }
+
+    line.Append(std::wstring_view(L"\n"));
+    OutputDebugString(line.Terminate());
+}
+
+void DrainBuffer(ThreadBuffer& buffer) {
+    uint32_t read = buffer.readPosition.load(std::memory_order_relaxed);
+    const uint32_t write = buffer.writePosition.load(std::memory_order_acquire);
+
+    uint8_t record[kMaxRecordSize];
+    while (read != write) {
+        uint16_t size;
+        CopyOut(buffer, read, reinterpret_cast<uint8_t*>(&size), sizeof(size));
+        CopyOut(buffer, read, record, size);
+        read += size;
+
+        OutputRecord(record);
+    }
+
+    buffer.readPosition.store(read, std::memory_order_release);
+
+    const uint32_t dropped =
+        buffer.dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        LineBuilder line;
+        line.AppendFormat(
+            L"[Telegram.Diagnostics] %u trace records dropped, buffer full\n",
+            dropped);
+        OutputDebugString(line.Terminate());
+    }
+}
+
+// Holds a reference to the module, so that the DLL can't be unloaded from
+// under it, and releases it as it exits.
+DWORD WINAPI FormatterThreadProc(LPVOID module) {
+    for (;;) {
+        // Parked while tracing is off, there is nothing to drain.
+        const bool off = !TraceEnabled(TraceLevel::kError);
+        WaitForSingleObject(g_wake,
+                            off ? INFINITE : kFlushIntervalMilliseconds);
+        if (g_stop.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        FlushTrace();
+    }
+
+    FlushTrace();
+    FreeLibraryAndExitThread(static_cast<HMODULE>(module), 0);
+}
+
+// Called with g_threadMutex held.
+void StartFormatterThread() {
+    HMODULE module;
+    if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS,
+                           reinterpret_cast<LPCWSTR>(&FormatterThreadProc),
+                           &module)) {
+        return;
+    }
+
+    g_wake = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+    if (g_wake) {
+        g_thread = CreateThread(nullptr, 0, FormatterThreadProc, module, 0,
+                                nullptr);
+    }
+
+    if (!g_thread) {
+        if (g_wake) {
+            CloseHandle(g_wake);
+            g_wake = nullptr;
+        }
+
+        FreeLibrary(module);
+    }
+}
+
+}  // namespace
+
+void SetTraceLevel(TraceLevel level) {
+    std::scoped_lock lock(g_threadMutex);
+
+    detail::g_traceLevel.store(level, std::memory_order_relaxed);
+
+    if (!g_thread && level != TraceLevel::kOff) {
+        StartFormatterThread();
+    }
+
+    if (g_wake) {
+        SetEvent(g_wake);
+    }
+}
+
+void StopTracing() {
+    std::scoped_lock lock(g_threadMutex);
+    if (!g_thread) {
+        return;
+    }
+
+    g_stop.store(true, std::memory_order_release);
+    SetEvent(g_wake);
+    WaitForSingleObject(g_thread, INFINITE);
+
+    CloseHandle(g_thread);
+    CloseHandle(g_wake);
+    g_thread = nullptr;
+    g_wake = nullptr;
+    g_stop.store(false, std::memory_order_relaxed);
+}
+
+void LeaseTraceBuffer() {
+    if (!t_lease.buffer) {
+        t_lease.buffer = LeaseBuffer();
+    }
+}
+
+void FlushTrace() {
+    std::scoped_lock lock(g_drainMutex);
+
+    for (auto* buffer = g_buffers.load(std::memory_order_acquire); buffer;
+         buffer = buffer->next) {
+        DrainBuffer(*buffer);
+    }
+}
+
+void TraceWrite(TraceLevel level,
+                const wchar_t* format,
+                std::initializer_list<TraceArg> args) {
+    uint8_t record[kMaxRecordSize];
+    uint8_t* p = record + sizeof(RecordHeader);
+
+    auto put = [&](const void* data, size_t size) {
+        memcpy(p, data, size);
+        p += size;
+    };
+
+    uint8_t argCount = 0;
+    for (const auto& arg : args) {
+        if (argCount == kMaxArgs) {
+            break;
+        }
+
+        argCount++;
+        *p++ = static_cast<uint8_t>(arg.type);
+
+        switch (arg.type) {
+            case TraceArg::Type::kString: {
+                const auto length = static_cast<uint16_t>(
+                    std::min(arg.wide.size(), TraceArg::kMaxStringLength));
+                put(&length, sizeof(length));
+                put(arg.wide.data(), length * sizeof(wchar_t));
+            } break;
+
+            case TraceArg::Type::kNarrowString: {
+                const auto length = static_cast<uint16_t>(
+                    std::min(arg.narrow.size(), TraceArg::kMaxStringLength));
+                put(&length, sizeof(length));
+                put(arg.narrow.data(), length);
+            } break;
+
+            default:
+                put(&arg.value, sizeof(arg.value));
+                break;
+        }
+    }
+
+    const RecordHeader header{
+        .size = static_cast<uint16_t>(p - record),
+        .level = level,
+        .argCount = argCount,
+        .threadId = GetCurrentThreadId(),
+        .format = format,
+        .timestamp = QueryTicks(),
+    };
+    memcpy(record, &header, sizeof(header));
+
+    LeaseTraceBuffer();
+
+    ThreadBuffer& buffer = *t_lease.buffer;
+    const uint32_t write = buffer.writePosition.load(std::memory_order_relaxed);
+    const uint32_t read = buffer.readPosition.load(std::memory_order_acquire);
+    if (kBufferSize - (write - read) < header.size) {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    CopyIn(buffer, write, record, header.size);
+    buffer.writePosition.store(write + header.size, std::memory_order_release);
+}
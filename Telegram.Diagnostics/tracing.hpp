@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <string_view>
+#include <type_traits>
+
+// Debug output of the watcher, sent to OutputDebugString.
+//
+// The level can be changed at any time, and a disabled Trace() call costs
+// one relaxed load. An enabled call only copies its arguments in binary
+// form into a buffer owned by the calling thread. A background thread
+// formats them and sends them to the debugger, so the UI thread doesn't
+// pay for formatting or for OutputDebugString. It drains the buffers every
+// 50 ms while tracing is on, and sleeps until the level changes while it's
+// off.
+//
+// Arguments are evaluated even when tracing is off. Guard expensive ones
+// with TraceEnabled().
+
+enum class TraceLevel : uint32_t {
+    kOff = 0,
+    kError = 1,
+    kInfo = 2,
+    kVerbose = 3,
+};
+
+namespace detail {
+extern std::atomic<TraceLevel> g_traceLevel;
+}  // namespace detail
+
+inline bool TraceEnabled(TraceLevel level) {
+    return level <= detail::g_traceLevel.load(std::memory_order_relaxed);
+}
+
+void SetTraceLevel(TraceLevel level);
+
+// Flushes and stops the background thread, for module teardown. Waits for
+// the thread, so it can't be called from DllMain. Setting a level other
+// than kOff starts it again.
+void StopTracing();
+
+// Leases the calling thread's buffer if it has none yet. Trace() does so
+// on its first call, which allocates: threads that may trace where the heap
+// can't be touched, like the crash handler, call this beforehand.
+void LeaseTraceBuffer();
+
+// Formats and outputs everything buffered so far, from all threads. For the
+// crash handler: the process may not live until the next background pass.
+void FlushTrace();
+
+struct TraceHex {
+    uint64_t value;
+};
+
+// One Trace() argument. Strings are copied (up to kMaxStringLength
+// characters), so they may be freed as soon as Trace() returns.
+struct TraceArg {
+    enum class Type : uint8_t {
+        kSigned,
+        kUnsigned,
+        kHex,
+        kString,
+        kNarrowString,
+    };
+
+    static constexpr size_t kMaxStringLength = 256;
+
+    template <typename T>
+        requires std::is_integral_v<T>
+    TraceArg(T value)
+        : type(std::is_signed_v<T> ? Type::kSigned : Type::kUnsigned),
+          value(static_cast<uint64_t>(value)) {}
+
+    TraceArg(TraceHex hex) : type(Type::kHex), value(hex.value) {}
+    TraceArg(const void* pointer)
+        : type(Type::kHex), value(reinterpret_cast<uintptr_t>(pointer)) {}
+    TraceArg(std::wstring_view string) : type(Type::kString), wide(string) {}
+    TraceArg(const wchar_t* string)
+        : type(Type::kString), wide(string ? string : L"") {}
+    TraceArg(std::string_view string)
+        : type(Type::kNarrowString), narrow(string) {}
+    TraceArg(const char* string)
+        : type(Type::kNarrowString), narrow(string ? string : "") {}
+
+    Type type;
+    uint64_t value = 0;
+    std::wstring_view wide;
+    std::string_view narrow;
+};
+
+void TraceWrite(TraceLevel level,
+                const wchar_t* format,
+                std::initializer_list<TraceArg> args);
+
+// format must be a string literal, only the pointer is stored. Each "{}"
+// is replaced by the next argument.
+template <typename... Args>
+void Trace(TraceLevel level, const wchar_t* format, const Args&... args) {
+    if (TraceEnabled(level)) {
+        TraceWrite(level, format, {TraceArg(args)...});
+    }
+}
@@ -0,0 +1,133 @@
+#include "stdafx.h"
+
+#include "treesnapshot.hpp"
+
+namespace {
+
+uint64_t Mix(uint64_t value) {
+    // splitmix64 finalizer.
+    value ^= value >> 30;
+    value *= 0xBF58476D1CE4E5B9ull;
+    value ^= value >> 27;
+    value *= 0x94D049BB133111EBull;
+    value ^= value >> 31;
+    return value;
+}
+
+}  // namespace
+
+uint64_t ElementHash(std::wstring_view name) {
+    // FNV-1a.
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (wchar_t c : name) {
+        hash ^= static_cast<uint16_t>(c);
+        hash *= 0x100000001B3ull;
+    }
+
+    return Mix(hash);
+}
+
+uint64_t ChildHashTerm(uint64_t childHash, uint32_t childIndex) {
+    return Mix(childHash ^ (uint64_t{childIndex} * 0x9E3779B97F4A7C15ull));
+}
+
+void TreeScratch::Reserve(size_t elements) {
+    entries.reserve(elements);
+    handles.reserve(elements);
+    stack.reserve(elements);
+    emitted.reserve(elements);
+    siblings.reserve(elements);
+    reserved = std::max(reserved, elements);
+}
+
+void TreeSnapshot::Build(TreeScratch& scratch, int64_t newTicks) {
+    auto& entries = scratch.entries;
+
+    ticks = newTicks;
+    nodes.clear();
+    nodes.reserve(entries.size());
+
+    // Siblings end up next to each other, in child order, so an element's
+    // children are found by a binary search on the parent. Sorts in place.
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry& a, const Entry& b) {
+                  if (a.parent != b.parent) {
+                      return a.parent < b.parent;
+                  }
+                  if (a.childIndex != b.childIndex) {
+                      return a.childIndex < b.childIndex;
+                  }
+                  return a.handle < b.handle;
+              });
+
+    auto& handles = scratch.handles;
+    handles.clear();
+    for (const Entry& entry : entries) {
+        handles.push_back(entry.handle);
+    }
+    std::sort(handles.begin(), handles.end());
+
+    auto firstChild = [&](InstanceHandle parent) -> uint32_t {
+        auto find = std::lower_bound(
+            entries.begin(), entries.end(), parent,
+            [](const Entry& entry, InstanceHandle value) {
+                return entry.parent < value;
+            });
+        return find != entries.end() && find->parent == parent
+                   ? static_cast<uint32_t>(find - entries.begin())
+                   : UINT32_MAX;
+    };
+
+    auto& stack = scratch.stack;
+    auto& emitted = scratch.emitted;
+    stack.clear();
+    emitted.assign(entries.size(), 0);
+
+    auto emit = [&](uint32_t i, uint32_t depth) {
+        emitted[i] = 1;
+
+        const Entry& entry = entries[i];
+        nodes.push_back(Node{.handle = entry.handle,
+                             .hash = entry.hash,
+                             .ownHash = entry.ownHash,
+                             .typeId = entry.typeId,
+                             .depth = depth,
+                             .size = 1});
+
+        stack.push_back(
+            {.node = static_cast<uint32_t>(nodes.size() - 1),
+             .nextChild = firstChild(entry.handle)});
+    };
+
+    auto finish = [&] {
+        const uint32_t node = stack.back().node;
+        nodes[node].size = static_cast<uint32_t>(nodes.size()) - node;
+        stack.pop_back();
+    };
+
+    for (uint32_t root = 0; root < entries.size(); root++) {
+        if (emitted[root] || std::binary_search(handles.begin(), handles.end(),
+                                                entries[root].parent)) {
+            continue;
+        }
+
+        emit(root, 0);
+        while (!stack.empty()) {
+            TreeScratch::Frame& frame = stack.back();
+            const InstanceHandle parent = nodes[frame.node].handle;
+
+            const uint32_t child = frame.nextChild;
+            if (child >= entries.size() || entries[child].parent != parent) {
+                finish();
+                continue;
+            }
+
+            frame.nextChild++;
+            if (!emitted[child]) {
+                // Invalidates frame.
+                const uint32_t depth = nodes[frame.node].depth + 1;
+                emit(child, depth);
+            }
+        }
+    }
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Structural (Merkle) hashes of the element tree, and snapshots of it that
+// can be diffed without visiting identical subtrees.
+//
+// An element's hash is the hash of its name plus one term per child,
+// ChildHashTerm(child hash, child index). Terms are added, so when a child
+// changes its parent is updated by subtracting the old term and adding the
+// new one, and so on up to the root: O(depth) per add or remove, no child
+// lists needed. The index in the term keeps the hash sensitive to child
+// order.
+
+uint64_t ElementHash(std::wstring_view name);
+uint64_t ChildHashTerm(uint64_t childHash, uint32_t childIndex);
+
+struct TreeScratch;
+
+struct TreeSnapshot {
+    struct Node {
+        InstanceHandle handle;
+        uint64_t hash;
+        uint64_t ownHash;
+        uint32_t typeId;
+        uint32_t depth;
+        // Nodes in the subtree, itself included. The next sibling is at
+        // index + size.
+        uint32_t size;
+    };
+
+    // One per tracked element, in any order.
+    struct Entry {
+        InstanceHandle handle;
+        InstanceHandle parent;
+        uint64_t hash;
+        uint64_t ownHash;
+        uint32_t typeId;
+        uint32_t childIndex;
+    };
+
+    // Sorts scratch.entries and rebuilds nodes from them. Elements whose
+    // parent isn't among the entries are roots.
+    void Build(TreeScratch& scratch, int64_t ticks);
+
+    // 0 until built.
+    int64_t ticks = 0;
+    // Pre-order, children by child index.
+    std::vector<Node> nodes;
+};
+
+// Buffers for TreeSnapshot::Build and DiffTreeSnapshots, kept so that
+// neither allocates for trees of up to Capacity() elements, as long as the
+// snapshot's nodes are reserved for as many.
+struct TreeScratch {
+    struct Frame {
+        uint32_t node;
+        uint32_t nextChild;
+    };
+
+    void Reserve(size_t elements);
+    size_t Capacity() const { return reserved; }
+
+    std::vector<TreeSnapshot::Entry> entries;
+    std::vector<InstanceHandle> handles;
+    std::vector<Frame> stack;
+    std::vector<uint8_t> emitted;
+    // Child indices of the older snapshot, a run per level being diffed.
+    std::vector<uint32_t> siblings;
+    size_t reserved = 0;
+};
+
+enum class TreeChange {
+    // Subtree only in the newer snapshot.
+    kAdded,
+    // Subtree only in the older snapshot.
+    kRemoved,
+    // Element in both whose own hash (name or type) differs.
+    kChanged,
+};
+
+struct TreeDiffStats {
+    uint32_t added = 0;
+    uint32_t removed = 0;
+    uint32_t changed = 0;
+    // Nodes compared, the work done.
+    uint32_t visited = 0;
+};
+
+namespace detail {
+
+template <typename OnChange>
+void DiffSiblings(const TreeSnapshot& older,
+                  uint32_t olderBegin,
+                  uint32_t olderEnd,
+                  const TreeSnapshot& newer,
+                  uint32_t newerBegin,
+                  uint32_t newerEnd,
+                  OnChange& onChange,
+                  std::vector<uint32_t>& siblings,
+                  TreeDiffStats& stats) {
+    static constexpr uint32_t kMatched = UINT32_MAX;
+
+    // This level's run, deeper levels push theirs after it and drop them
+    // before returning. Indices, the vector may grow.
+    const size_t base = siblings.size();
+    for (uint32_t i = olderBegin; i < olderEnd; i += older.nodes[i].size) {
+        siblings.push_back(i);
+    }
+    const size_t count = siblings.size() - base;
+
+    size_t cursor = 0;
+    for (uint32_t j = newerBegin; j < newerEnd; j += newer.nodes[j].size) {
+        const auto& newerNode = newer.nodes[j];
+        stats.visited++;
+
+        // Siblings mostly keep their order, look from the last match on.
+        size_t match = count;
+        for (size_t k = 0; k < count; k++) {
+            const size_t candidate = (cursor + k) % count;
+            const uint32_t i = siblings[base + candidate];
+            if (i != kMatched && older.nodes[i].handle == newerNode.handle) {
+                match = candidate;
+                break;
+            }
+        }
+
+        if (match == count) {
+            stats.added++;
+            onChange(TreeChange::kAdded, newerNode);
+            continue;
+        }
+
+        const uint32_t i = siblings[base + match];
+        const auto& olderNode = older.nodes[i];
+        siblings[base + match] = kMatched;
+        cursor = match + 1;
+
+        if (olderNode.hash == newerNode.hash) {
+            continue;
+        }
+
+        if (olderNode.ownHash != newerNode.ownHash) {
+            stats.changed++;
+            onChange(TreeChange::kChanged, newerNode);
+        }
+
+        DiffSiblings(older, i + 1, i + olderNode.size, newer, j + 1,
+                     j + newerNode.size, onChange, siblings, stats);
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        const uint32_t i = siblings[base + k];
+        if (i != kMatched) {
+            stats.removed++;
+            onChange(TreeChange::kRemoved, older.nodes[i]);
+        }
+    }
+
+    siblings.resize(base);
+}
+
+}  // namespace detail
+
+// Calls onChange(TreeChange, const TreeSnapshot::Node&) for each difference,
+// with the node of the snapshot it exists in (newer for kChanged). Only
+// descends into subtrees whose hashes differ. Uses scratch.siblings, which
+// never holds more than older has nodes.
+template <typename OnChange>
+TreeDiffStats DiffTreeSnapshots(const TreeSnapshot& older,
+                                const TreeSnapshot& newer,
+                                TreeScratch& scratch,
+                                OnChange&& onChange) {
+    TreeDiffStats stats;
+    scratch.siblings.clear();
+    detail::DiffSiblings(older, 0, static_cast<uint32_t>(older.nodes.size()),
+                         newer, 0, static_cast<uint32_t>(newer.nodes.size()),
+                         onChange, scratch.siblings, stats);
+    return stats;
+}
@@ -0,0 +1,153 @@
+#include "stdafx.h"
+
+#include "treestats.hpp"
+
+namespace {
+
+void Increment(std::atomic<uint32_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+}
+
+void Decrement(std::atomic<uint32_t>& counter) {
+    const uint32_t value = counter.load(std::memory_order_relaxed);
+    if (value) {
+        counter.store(value - 1, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace
+
+uint32_t TreeStats::InternType(std::wstring_view type) {
+    return m_typeNames.Intern(type);
+}
+
+void TreeStats::ElementAdded(uint32_t typeId, unsigned int depth) {
+    Increment(m_elements);
+
+    if (typeId < kMaxTypes) {
+        Increment(m_typeCounts[typeId]);
+    }
+
+    Increment(m_depthCounts[std::min(depth, kMaxDepth - 1)]);
+
+    // Every element starts as a leaf.
+    m_fanOutCounts[0]++;
+}
+
+void TreeStats::ElementRemoved(uint32_t typeId,
+                               unsigned int depth,
+                               uint32_t childCount) {
+    Decrement(m_elements);
+
+    if (typeId < kMaxTypes) {
+        Decrement(m_typeCounts[typeId]);
+    }
+
+    Decrement(m_depthCounts[std::min(depth, kMaxDepth - 1)]);
+
+    RemoveFanOut(childCount);
+}
+
+void TreeStats::ChildCountChanged(uint32_t oldCount, uint32_t newCount) {
+    newCount = std::min(newCount, kMaxFanOut - 1);
+
+    m_fanOutCounts[newCount]++;
+    if (newCount > m_maxFanOut.load(std::memory_order_relaxed)) {
+        m_maxFanOut.store(newCount, std::memory_order_relaxed);
+    }
+
+    RemoveFanOut(oldCount);
+}
+
+void TreeStats::RemoveFanOut(uint32_t count) {
+    count = std::min(count, kMaxFanOut - 1);
+    if (m_fanOutCounts[count]) {
+        m_fanOutCounts[count]--;
+    }
+
+    // Only when the largest one goes away, scan down to the next one. Fan-out
+    // changes one child at a time, so this is usually a single step.
+    uint32_t maxFanOut = m_maxFanOut.load(std::memory_order_relaxed);
+    while (maxFanOut && !m_fanOutCounts[maxFanOut]) {
+        maxFanOut--;
+    }
+
+    m_maxFanOut.store(maxFanOut, std::memory_order_relaxed);
+}
+
+void TreeStats::RootAdded(InstanceHandle root, uint32_t pathId) {
+    if (m_rootSlots.contains(root)) {
+        return;
+    }
+
+    size_t slot;
+    if (!m_freeRootSlots.empty()) {
+        slot = m_freeRootSlots.back();
+        m_freeRootSlots.pop_back();
+    } else if (m_usedRootSlots < kMaxRoots) {
+        slot = m_usedRootSlots++;
+    } else {
+        return;
+    }
+
+    m_rootSlots.emplace(root, slot);
+    m_rootValues[slot] = {.handle = root, .pathId = pathId, .size = 0};
+    m_roots[slot].Store(m_rootValues[slot]);
+}
+
+void TreeStats::RootRemoved(InstanceHandle root) {
+    auto find = m_rootSlots.find(root);
+    if (find == m_rootSlots.end()) {
+        return;
+    }
+
+    const size_t slot = find->second;
+    m_rootSlots.erase(find);
+    m_freeRootSlots.push_back(slot);
+
+    m_rootValues[slot] = {};
+    m_roots[slot].Store(m_rootValues[slot]);
+}
+
+void TreeStats::RootSizeChanged(InstanceHandle root, int32_t delta) {
+    auto find = m_rootSlots.find(root);
+    if (find == m_rootSlots.end()) {
+        return;
+    }
+
+    Root& value = m_rootValues[find->second];
+    if (delta < 0 && value.size < static_cast<uint32_t>(-delta)) {
+        value.size = 0;
+    } else {
+        value.size += delta;
+    }
+
+    m_roots[find->second].Store(value);
+}
+
+size_t TreeStats::LargestRoots(Root* out, size_t maxRoots) const {
+    size_t count = 0;
+
+    for (const auto& cell : m_roots) {
+        Root root;
+        if ((!cell.TryLoad(root) && !cell.TryLoad(root)) || !root.handle) {
+            continue;
+        }
+
+        // Insertion into the sorted output, dropping the smallest once full.
+        size_t i = count < maxRoots ? count++ : maxRoots;
+        while (i > 0 && out[i - 1].size < root.size) {
+            if (i < maxRoots) {
+                out[i] = out[i - 1];
+            }
+            i--;
+        }
+
+        if (i < maxRoots) {
+            out[i] = root;
+        }
+    }
+
+    return count;
+}
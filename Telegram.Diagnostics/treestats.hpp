@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "pathtable.hpp"
+#include "seqlock.hpp"
+
+// Shape of the tracked element tree: element count by type, depth
+// histogram, largest fan-out and the size of each tracked subtree. Kept up
+// to date on every add and remove, so reading it never walks the tree.
+//
+// Mutators are writer only, like the rest of the watcher's element state.
+// Getters are lock-free from any thread; every value is individually
+// consistent, but a reader racing with the writer may see one update and
+// not the next.
+class TreeStats {
+   public:
+    // Types past this many are only counted in Elements().
+    static constexpr uint32_t kMaxTypes = 2048;
+    // Deeper elements are counted at kMaxDepth - 1.
+    static constexpr unsigned int kMaxDepth = 128;
+    // Larger fan-outs are counted as kMaxFanOut - 1.
+    static constexpr uint32_t kMaxFanOut = 1024;
+    // Subtrees past this many aren't tracked.
+    static constexpr size_t kMaxRoots = 256;
+
+    struct Root {
+        InstanceHandle handle;
+        uint32_t pathId;
+        uint32_t size;
+    };
+
+    TreeStats() = default;
+
+    TreeStats(const TreeStats&) = delete;
+    TreeStats& operator=(const TreeStats&) = delete;
+
+    // Writer only.
+    uint32_t InternType(std::wstring_view type);
+    void ElementAdded(uint32_t typeId, unsigned int depth);
+    void ElementRemoved(uint32_t typeId,
+                        unsigned int depth,
+                        uint32_t childCount);
+    void ChildCountChanged(uint32_t oldCount, uint32_t newCount);
+    void RootAdded(InstanceHandle root, uint32_t pathId);
+    void RootRemoved(InstanceHandle root);
+    void RootSizeChanged(InstanceHandle root, int32_t delta);
+
+    // Any thread.
+    uint32_t Elements() const {
+        return m_elements.load(std::memory_order_relaxed);
+    }
+
+    uint32_t MaxFanOut() const {
+        return m_maxFanOut.load(std::memory_order_relaxed);
+    }
+
+    uint32_t TypeCount() const { return m_typeNames.Size(); }
+
+    std::wstring_view TypeName(uint32_t typeId) const {
+        return m_typeNames.Get(typeId);
+    }
+
+    uint32_t ElementsOfType(uint32_t typeId) const {
+        return typeId < kMaxTypes
+                   ? m_typeCounts[typeId].load(std::memory_order_relaxed)
+                   : 0;
+    }
+
+    uint32_t ElementsAtDepth(unsigned int depth) const {
+        return depth < kMaxDepth
+                   ? m_depthCounts[depth].load(std::memory_order_relaxed)
+                   : 0;
+    }
+
+    // Copies up to maxRoots of the largest tracked subtrees, largest first,
+    // and returns how many were copied.
+    size_t LargestRoots(Root* out, size_t maxRoots) const;
+
+   private:
+    void RemoveFanOut(uint32_t count);
+
+    std::atomic<uint32_t> m_elements{0};
+    std::atomic<uint32_t> m_maxFanOut{0};
+    std::atomic<uint32_t> m_typeCounts[kMaxTypes]{};
+    std::atomic<uint32_t> m_depthCounts[kMaxDepth]{};
+    PathTable m_typeNames;
+    SeqlockCell<Root> m_roots[kMaxRoots];
+
+    // Writer-only state.
+    uint32_t m_fanOutCounts[kMaxFanOut]{};
+    Root m_rootValues[kMaxRoots]{};
+    std::unordered_map<InstanceHandle, size_t> m_rootSlots;
+    std::vector<size_t> m_freeRootSlots;
+    size_t m_usedRootSlots = 0;
+};
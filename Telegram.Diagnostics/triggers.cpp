@@ -0,0 +1,145 @@
+#include "stdafx.h"
+
+#include "triggers.hpp"
+
+#include "clock.hpp"
+#include "tracing.hpp"
+
+std::string_view SnapshotTriggerName(SnapshotTrigger trigger) {
+    switch (trigger) {
+        case SnapshotTrigger::kElementRate:
+            return "elementRate";
+        case SnapshotTrigger::kSubtreeRate:
+            return "subtreeRate";
+        case SnapshotTrigger::kRequest:
+            return "request";
+        case SnapshotTrigger::kPeriodic:
+            return "periodic";
+    }
+
+    return "unknown";
+}
+
+std::wstring SnapshotEventName(DWORD pid) {
+    return std::format(L"Telegram.Diagnostics.Snapshot.{}", pid);
+}
+
+SnapshotTriggers::SnapshotTriggers(const Settings& settings,
+                                   Callback callback)
+    : m_callback(std::move(callback)),
+      m_rate(settings.triggerRate),
+      m_periodSeconds(settings.triggerPeriod),
+      m_cooldownTicks(int64_t{settings.triggerCooldown} * TicksPerSecond()) {}
+
+void SnapshotTriggers::Start() {
+    m_work = CreateThreadpoolWork(WorkCallback, this, nullptr);
+
+    m_event = CreateEvent(nullptr, FALSE, FALSE,
+                          SnapshotEventName(GetCurrentProcessId()).c_str());
+    if (m_event) {
+        m_wait = CreateThreadpoolWait(WaitCallback, this, nullptr);
+        if (m_wait) {
+            SetThreadpoolWait(m_wait, m_event, nullptr);
+        }
+    }
+
+    if (m_periodSeconds) {
+        m_timer = CreateThreadpoolTimer(TimerCallback, this, nullptr);
+        if (m_timer) {
+            // Negative means relative, in 100 ns units.
+            const int64_t due = -int64_t{m_periodSeconds} * 10000000;
+            FILETIME dueTime{
+                .dwLowDateTime = static_cast<DWORD>(due),
+                .dwHighDateTime = static_cast<DWORD>(due >> 32),
+            };
+            SetThreadpoolTimer(m_timer, &dueTime, m_periodSeconds * 1000, 0);
+        }
+    }
+}
+
+SnapshotTriggers::~SnapshotTriggers() {
+    if (m_timer) {
+        SetThreadpoolTimer(m_timer, nullptr, 0, 0);
+        WaitForThreadpoolTimerCallbacks(m_timer, TRUE);
+        CloseThreadpoolTimer(m_timer);
+    }
+
+    if (m_wait) {
+        SetThreadpoolWait(m_wait, nullptr, nullptr);
+        WaitForThreadpoolWaitCallbacks(m_wait, TRUE);
+        CloseThreadpoolWait(m_wait);
+    }
+
+    if (m_event) {
+        CloseHandle(m_event);
+    }
+
+    if (m_work) {
+        WaitForThreadpoolWorkCallbacks(m_work, FALSE);
+        CloseThreadpoolWork(m_work);
+    }
+}
+
+bool SnapshotTriggers::CountEvent(uint32_t& windowEvents,
+                                  int64_t& windowStart,
+                                  int64_t now) const {
+    if (!m_rate) {
+        return false;
+    }
+
+    if (now - windowStart >= TicksPerSecond()) {
+        windowStart = now;
+        windowEvents = 0;
+    }
+
+    return ++windowEvents == m_rate;
+}
+
+void SnapshotTriggers::Request(SnapshotTrigger trigger,
+                               InstanceHandle element) {
+    const int64_t now = QueryTicks();
+
+    int64_t next = m_nextAllowed.load(std::memory_order_relaxed);
+    do {
+        if (now < next) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    } while (!m_nextAllowed.compare_exchange_weak(
+        next, now + m_cooldownTicks, std::memory_order_relaxed));
+
+    Trace(TraceLevel::kInfo, L"Snapshot triggered by {} {}",
+          SnapshotTriggerName(trigger), TraceHex{element});
+
+    m_pendingTrigger.store(trigger, std::memory_order_relaxed);
+    m_pendingElement.store(element, std::memory_order_relaxed);
+    if (m_work) {
+        SubmitThreadpoolWork(m_work);
+    }
+}
+
+void CALLBACK SnapshotTriggers::WorkCallback(PTP_CALLBACK_INSTANCE,
+                                             PVOID context,
+                                             PTP_WORK) {
+    auto* self = static_cast<SnapshotTriggers*>(context);
+    self->m_callback(self->m_pendingTrigger.load(std::memory_order_relaxed),
+                     self->m_pendingElement.load(std::memory_order_relaxed));
+}
+
+void CALLBACK SnapshotTriggers::WaitCallback(PTP_CALLBACK_INSTANCE,
+                                             PVOID context,
+                                             PTP_WAIT wait,
+                                             TP_WAIT_RESULT) {
+    auto* self = static_cast<SnapshotTriggers*>(context);
+    self->Request(SnapshotTrigger::kRequest);
+
+    // A wait fires once, re-arm it for the next request.
+    SetThreadpoolWait(wait, self->m_event, nullptr);
+}
+
+void CALLBACK SnapshotTriggers::TimerCallback(PTP_CALLBACK_INSTANCE,
+                                              PVOID context,
+                                              PTP_TIMER) {
+    static_cast<SnapshotTriggers*>(context)->Request(
+        SnapshotTrigger::kPeriodic);
+}
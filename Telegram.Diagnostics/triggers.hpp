@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+#include "settings.hpp"
+
+enum class SnapshotTrigger : uint32_t {
+    // An element, or a subtree below subtreeDepth as a whole, raised
+    // triggerRate events within a second.
+    kElementRate,
+    kSubtreeRate,
+    // The snapshot event was set, by the launcher or by anyone else who
+    // can open it.
+    kRequest,
+    // Every triggerPeriod seconds.
+    kPeriodic,
+};
+
+std::string_view SnapshotTriggerName(SnapshotTrigger trigger);
+
+// Auto-reset event that requests a snapshot of the watcher in process pid.
+// Created in the app's own namespace, which for a packaged app is its
+// AppContainer's.
+std::wstring SnapshotEventName(DWORD pid);
+
+// Decides when the watcher writes a snapshot report while the app keeps
+// running, for layout storms that never crash. The callback runs on a
+// thread pool thread.
+//
+// Triggers are rate limited as a whole: after a snapshot, requests are
+// dropped and counted for triggerCooldown seconds, so a storm that keeps
+// crossing the threshold costs one report per cooldown.
+class SnapshotTriggers {
+   public:
+    using Callback =
+        std::function<void(SnapshotTrigger trigger, InstanceHandle element)>;
+
+    SnapshotTriggers(const Settings& settings, Callback callback);
+    ~SnapshotTriggers();
+
+    SnapshotTriggers(const SnapshotTriggers&) = delete;
+    SnapshotTriggers& operator=(const SnapshotTriggers&) = delete;
+
+    // Creates the event and the timer. Nothing triggers before, so the
+    // owner can finish setting up what the callback needs.
+    void Start();
+
+    // Writer only. Counts an event in the one-second window that
+    // windowStart opened, and returns true for the event that reaches
+    // triggerRate. Always false if triggerRate is 0.
+    bool CountEvent(uint32_t& windowEvents,
+                    int64_t& windowStart,
+                    int64_t now) const;
+
+    // Any thread. element is the element or subtree root of a rate
+    // trigger, 0 otherwise.
+    void Request(SnapshotTrigger trigger, InstanceHandle element = 0);
+
+    // Any thread. Requests dropped by the cooldown.
+    uint64_t Suppressed() const {
+        return m_suppressed.load(std::memory_order_relaxed);
+    }
+
+   private:
+    static void CALLBACK WorkCallback(PTP_CALLBACK_INSTANCE instance,
+                                      PVOID context,
+                                      PTP_WORK work);
+    static void CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE instance,
+                                      PVOID context,
+                                      PTP_WAIT wait,
+                                      TP_WAIT_RESULT waitResult);
+    static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE instance,
+                                       PVOID context,
+                                       PTP_TIMER timer);
+
+    const Callback m_callback;
+    const uint32_t m_rate;
+    const unsigned int m_periodSeconds;
+    const int64_t m_cooldownTicks;
+
+    PTP_WORK m_work = nullptr;
+    HANDLE m_event = nullptr;
+    PTP_WAIT m_wait = nullptr;
+    PTP_TIMER m_timer = nullptr;
+
+    std::atomic<int64_t> m_nextAllowed{0};
+    // The accepted request, for the work callback. The cooldown keeps a
+    // second one from overwriting it first.
+    std::atomic<SnapshotTrigger> m_pendingTrigger{SnapshotTrigger::kRequest};
+    std::atomic<InstanceHandle> m_pendingElement{0};
+    std::atomic<uint64_t> m_suppressed{0};
+};
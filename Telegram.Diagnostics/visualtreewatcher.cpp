@@ -2,78 +2,205 @@
 
 #include "visualtreewatcher.hpp"
 
+#include "clock.hpp"
+#include "pathabbreviations.hpp"
+#include "stringkernels.hpp"
+#include "tracing.hpp"
+
+#include "../common/version.h"
+
 #include <winrt/Windows.Storage.h>
-#include <fstream>
-
-#define EXTRA_DEBUG 0
-
-const std::wstring TO_MASTER_LONG =
-    L"RootPage/LayoutRoot (Grid)[0]/Navigation (SplitView)/Grid[1]/ContentRoot "
-    L"(Grid)[0]/Border/Frame/ContentPresenter/";
-const std::wstring TO_MASTER_SHORT = L"RootPage/.../";
-
-const std::wstring TO_DETAIL_LONG =
-    L"MainPage/Grid[4]/MasterDetail (MasterDetailView)/AdaptivePanel "
-    L"(MasterDetailPanel)[1]/DetailHeaderPresenter2 (Grid)[3]/DetailPresenter "
-    L"(Grid)/Frame/ContentPresenter/";
-const std::wstring TO_DETAIL_SHORT = L"MainPage/.../";
-
-const std::wstring TO_PIVOTITEM_LONG =
-    L"MainPage/Grid[4]/MasterDetail (MasterDetailView)/AdaptivePanel "
-    L"(MasterDetailPanel)[2]/MasterFrame "
-    L"(ContentControl)/ContentPresenter/Grid[1]/rpMasterTitlebar "
-    L"(Pivot)/RootElement (Grid)[1]/Grid/ScrollViewer "
-    L"(ScrollViewer)/Grid/ScrollContentPresenter "
-    L"(ScrollContentPresenter)/Panel (PivotPanel)/PivotLayoutElement "
-    L"(Grid)[5]/PivotItemPresenter (ItemsPresenter)/Grid/PivotItem";
-const std::wstring TO_PIVOTITEM_SHORT = L"MainPage/.../PivotItem";
-
-inline void OutputDebugStringFormat(LPCWSTR pwhFormat, ...) {
-    va_list args;
-    va_start(args, pwhFormat);
-    WCHAR buffer[1024];
-    vswprintf_s(buffer, 1024, pwhFormat, args);
-    OutputDebugStringW(buffer);
-    va_end(args);
-}
-
-inline bool Replace(std::wstring& str,
-                    const std::wstring& from,
-                    const std::wstring& to) {
-    size_t start_pos = str.find(from);
-    if (start_pos == std::string::npos)
-        return false;
-    str.replace(start_pos, from.length(), to);
-    return true;
-}
-
-VisualTreeWatcher::VisualTreeWatcher(winrt::com_ptr<IUnknown> site)
-    : m_xamlDiagnostics(site.as<IXamlDiagnostics>()) {
-    m_unhandledException = wux::Application::Current().UnhandledException(
-        winrt::auto_revoke, [this](wf::IInspectable const& sender,
-                                   wux::UnhandledExceptionEventArgs const& e) {
+
+namespace {
+
+Settings LoadSettings(IXamlDiagnostics* xamlDiagnostics) {
+    CComBSTR initializationData;
+    if (FAILED(xamlDiagnostics->GetInitializationData(&initializationData)) ||
+        !initializationData) {
+        return {};
+    }
+
+    return Settings::Parse(
+        {initializationData.m_str, initializationData.Length()});
+}
+
+// Unpackaged WinUI apps have no ApplicationData, their files go to the
+// temp folder instead.
+std::wstring QueryLocalFolder() {
+    try {
+        return std::wstring{winrt::Windows::Storage::ApplicationData::Current()
+                                .LocalFolder()
+                                .Path()};
+    } catch (...) {
+    }
+
+    WCHAR path[MAX_PATH + 1];
+    const DWORD length = GetTempPath(ARRAYSIZE(path), path);
+    if (length == 0 || length > ARRAYSIZE(path)) {
+        return L".";
+    }
+
+    // Without the trailing backslash, like LocalFolder.
+    return std::wstring(path, length - 1);
+}
+
+std::wstring QueryPackageFullName() {
+    WCHAR name[PACKAGE_FULL_NAME_MAX_LENGTH + 1];
+    UINT32 length = ARRAYSIZE(name);
+    if (GetCurrentPackageFullName(&length, name) != ERROR_SUCCESS) {
+        return {};
+    }
+
+    return name;
+}
+
+// GetVersionEx lies to processes without a compatibility manifest.
+std::string QueryOsVersion() {
+    using RtlGetVersion_t = LONG(WINAPI*)(OSVERSIONINFOW*);
+
+    auto rtlGetVersion = reinterpret_cast<RtlGetVersion_t>(
+        GetProcAddress(GetModuleHandle(L"ntdll.dll"), "RtlGetVersion"));
+    if (!rtlGetVersion) {
+        return {};
+    }
+
+    OSVERSIONINFOW info{sizeof(info)};
+    if (rtlGetVersion(&info) != 0) {
+        return {};
+    }
+
+    return std::format("{}.{}.{}", info.dwMajorVersion, info.dwMinorVersion,
+                       info.dwBuildNumber);
+}
+
+// Must run on the element's UI thread. Failures are returned in
+// properties.hr rather than thrown, so that none of them allocates when a
+// cycle is reported.
+template <typename Framework>
+void ReadLayout(IXamlDiagnostics* diagnostics, LayoutProperties& properties) {
+    winrt::com_ptr<::IInspectable> obj;
+    properties.hr =
+        diagnostics->GetIInspectableFromHandle(properties.handle, obj.put());
+    if (FAILED(properties.hr)) {
+        return;
+    }
+
+    typename Framework::FrameworkElement element{nullptr};
+    properties.hr = obj->QueryInterface(
+        winrt::guid_of<typename Framework::FrameworkElement>(),
+        winrt::put_abi(element));
+    if (FAILED(properties.hr)) {
+        return;
+    }
+
+    // The getters don't fail on the element's own thread.
+    try {
+        ReadLayoutProperties(element, properties);
+    } catch (...) {
+        properties.hr = winrt::to_hresult();
+    }
+}
+
+}  // namespace
+
+template <typename Framework>
+VisualTreeWatcher<Framework>::VisualTreeWatcher(winrt::com_ptr<IUnknown> site)
+    : m_xamlDiagnostics(site.as<IXamlDiagnostics>()),
+      m_settings(LoadSettings(m_xamlDiagnostics.get())),
+      m_governor(m_settings.budgetMicroseconds),
+      m_lifetime(m_paths, m_settings),
+      m_localFolder(QueryLocalFolder()),
+      m_packageFullName(QueryPackageFullName()),
+      m_osVersion(QueryOsVersion()),
+      m_reportedPaths(
+          std::make_unique<uint64_t[]>(PathTable::kMaxEntries / 64)),
+      m_snapshotPaths(
+          std::make_unique<uint64_t[]>(PathTable::kMaxEntries / 64)),
+      m_triggers(m_settings, [this](SnapshotTrigger trigger,
+                                    InstanceHandle element) {
+          WriteSnapshot(trigger, element);
+      }) {
+    SetTraceLevel(m_settings.traceLevel);
+    Trace(TraceLevel::kInfo, L"Watcher started, budget {} us, events {}",
+          m_settings.budgetMicroseconds, TraceHex{m_settings.eventKinds});
+
+    m_report.emplace(m_localFolder + L"\\LayoutCycle.jsonl", kReportCapacity);
+    m_flameReport.emplace(m_localFolder + L"\\LayoutFlame.folded",
+                          kFlameCapacity);
+    m_snapshotReport.emplace(m_localFolder + L"\\LayoutSnapshot-0.jsonl",
+                             kReportCapacity);
+
+    if (m_settings.rollingTrace) {
+        m_trace.emplace(
+            m_localFolder, m_paths, m_writerMutex,
+            uint64_t{m_settings.rollingTraceFileSize} * 1024 * 1024,
+            m_settings.rollingTraceFiles, [this] {
+                return trace::StatsRecord{
+                    .eventsSeen = m_stats.eventsSeen.load(),
+                    .eventsRecorded = m_stats.eventsRecorded.load(),
+                    .samplingInterval = m_governor.Interval(),
+                    .overheadUs = m_governor.LastWindowMicroseconds(),
+                    .elements = m_treeStats.Elements(),
+                };
+            });
+    }
+
+    m_unhandledException = Framework::Application::Current().UnhandledException(
+        winrt::auto_revoke, [this](auto const& sender, auto const& e) {
             auto exception = e.Exception();
             if (exception == 0x802B0014) {
-                std::wstring path =
-                    winrt::Windows::Storage::ApplicationData::Current()
-                        .LocalFolder()
-                        .Path()
-                        .c_str();
-                std::wofstream f(path + L"\\LayoutCycle.txt",
-                                 std::wofstream::out | std::wofstream::trunc);
-
-                for (auto& item : m_history) {
-                    auto path = std::wstring(item.path);
-                    Replace(path, TO_MASTER_LONG, TO_MASTER_SHORT);
-                    Replace(path, TO_DETAIL_LONG, TO_DETAIL_SHORT);
-                    Replace(path, TO_PIVOTITEM_LONG, TO_PIVOTITEM_SHORT);
-                    f << path << L" 0x" << std::hex << item.handle
-                      << L"\n";
+                const int64_t start = QueryTicks();
+
+                // Writer state only if no writer is mid-update. This thread
+                // may well be one of them, and trying to lock a mutex it
+                // holds is undefined, so that's ruled out first.
+                std::unique_lock lock(m_writerMutex, std::defer_lock);
+                if (!m_writerMutex.OwnedByThisThread()) {
+                    lock.try_lock();
                 }
+                const TreeSnapshot* current = nullptr;
+                if (lock) {
+                    if (m_trace) {
+                        m_trace->Flush();
+                    }
 
-                f.close();
+                    // The cycle is most likely mid-repeat, with events held.
+                    const uint32_t partitions =
+                        m_partitionCount.load(std::memory_order_relaxed);
+                    for (uint32_t i = 0; i < partitions; i++) {
+                        Partition& window = *m_partitions[i];
+                        window.folder.Flush([&](const HistoryItem& item) {
+                            window.history.Push(item);
+                            window.archive.Push(item);
+                        });
+                    }
+
+                    // Only into the space reserved for it, a tree that grew
+                    // past it since the baseline goes without a diff.
+                    if (m_baseline &&
+                        m_elements.size() <= m_crashScratch.Capacity()) {
+                        TakeSnapshot(m_crashSnapshot, m_crashScratch,
+                                     QueryTicks());
+                        current = &m_crashSnapshot;
+                    }
+                }
+
+                Trace(TraceLevel::kError, L"Layout cycle, writing report");
+                WriteCrashReport(exception, lock.owns_lock(), current,
+                                 start);
+                FlushTrace();
             }
         });
+
+    m_triggers.Start();
+
+    if (m_settings.sessionRegistry &&
+        m_sessions.Attach(reinterpret_cast<HANDLE>(
+            static_cast<uintptr_t>(m_settings.sessionRegistry))) &&
+        !m_sessions.Register(Framework::kId, &m_stats)) {
+        Trace(TraceLevel::kError, L"Session registry is full");
+    }
+
     // const auto treeService = m_xamlDiagnostics.as<IVisualTreeService3>();
     // winrt::check_hresult(treeService->AdviseVisualTreeChange(this));
 
@@ -83,10 +210,7 @@ VisualTreeWatcher::VisualTreeWatcher(winrt::com_ptr<IUnknown> site)
     HANDLE thread = CreateThread(
         nullptr, 0,
         [](LPVOID lpParam) -> DWORD {
-            auto watcher = reinterpret_cast<VisualTreeWatcher*>(lpParam);
-            const auto treeService =
-                watcher->m_xamlDiagnostics.as<IVisualTreeService3>();
-            winrt::check_hresult(treeService->AdviseVisualTreeChange(watcher));
+            reinterpret_cast<VisualTreeWatcher*>(lpParam)->Attach();
             return 0;
         },
         this, 0, nullptr);
@@ -95,104 +219,27 @@ VisualTreeWatcher::VisualTreeWatcher(winrt::com_ptr<IUnknown> site)
     }
 }
 
-void VisualTreeWatcher::Activate() {
-    std::shared_lock lock(m_dlgMainMutex);
-}
-
-VisualTreeWatcher::~VisualTreeWatcher() {
-    std::shared_lock lock(m_dlgMainMutex);
-}
+template <typename Framework>
+VisualTreeWatcher<Framework>::~VisualTreeWatcher() = default;
 
-HRESULT VisualTreeWatcher::OnVisualTreeChange(
+template <typename Framework>
+HRESULT VisualTreeWatcher<Framework>::OnVisualTreeChange(
     ParentChildRelation parentChildRelation,
     VisualElement element,
     VisualMutationType mutationType) try {
-#if EXTRA_DEBUG
-    try {
-        WCHAR szBuffer[1025];
-        OutputDebugString(L"========================================\n");
-
-        wsprintf(szBuffer, L"Parent: %p\n", (void*)parentChildRelation.Parent);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"Child: %p\n", (void*)parentChildRelation.Child);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"Child index: %u\n",
-                 parentChildRelation.ChildIndex);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"Handle: %p\n", (void*)element.Handle);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"Type: %s\n", element.Type);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"Name: %s\n", element.Name);
-        OutputDebugString(szBuffer);
-        wsprintf(szBuffer, L"NumChildren: %u\n", element.NumChildren);
-        OutputDebugString(szBuffer);
-        OutputDebugString(L"~~~~~~~~~~\n");
-
-        switch (mutationType) {
-            case Add:
-                OutputDebugString(L"Mutation type: Add\n");
-                break;
-
-            case Remove:
-                OutputDebugString(L"Mutation type: Remove\n");
-                break;
-
-            default:
-                wsprintf(szBuffer, L"Mutation type: %d\n",
-                         static_cast<int>(mutationType));
-                OutputDebugString(szBuffer);
-                break;
-        }
-
-        wux::FrameworkElement frameworkElement = nullptr;
-
-        const auto inspectable = FromHandle<wf::IInspectable>(element.Handle);
-        frameworkElement = inspectable.try_as<wux::FrameworkElement>();
-
-        if (frameworkElement) {
-            wsprintf(szBuffer, L"FrameworkElement address: %p\n",
-                     winrt::get_abi(frameworkElement));
-            OutputDebugString(szBuffer);
-            wsprintf(szBuffer, L"FrameworkElement class: %s\n",
-                     winrt::get_class_name(frameworkElement).c_str());
-            OutputDebugString(szBuffer);
-            wsprintf(szBuffer, L"FrameworkElement name: %s\n",
-                     frameworkElement.Name().c_str());
-            OutputDebugString(szBuffer);
-        }
-
-        if (parentChildRelation.Parent) {
-            if (frameworkElement) {
-                wsprintf(szBuffer, L"Real parent address: %p\n",
-                         winrt::get_abi(
-                             frameworkElement.Parent().as<wf::IInspectable>()));
-                OutputDebugString(szBuffer);
-            }
+    const int64_t start = QueryTicks();
+    std::scoped_lock lock(m_writerMutex);
 
-            const auto inspectable =
-                FromHandle<wf::IInspectable>(parentChildRelation.Parent);
-            const auto frameworkElement =
-                inspectable.try_as<wux::FrameworkElement>();
-            if (frameworkElement) {
-                wsprintf(szBuffer, L"Parent FrameworkElement address: %p\n",
-                         winrt::get_abi(frameworkElement));
-                OutputDebugString(szBuffer);
-                wsprintf(szBuffer, L"Parent FrameworkElement class: %s\n",
-                         winrt::get_class_name(frameworkElement).c_str());
-                OutputDebugString(szBuffer);
-                wsprintf(szBuffer, L"Parent FrameworkElement name: %s\n",
-                         frameworkElement.Name().c_str());
-                OutputDebugString(szBuffer);
-            }
-        }
-    } catch (...) {
-        HRESULT hr = winrt::to_hresult();
-        WCHAR szBuffer[1025];
-        wsprintf(szBuffer, L"Error %X\n", hr);
-        OutputDebugString(szBuffer);
+    if (TraceEnabled(TraceLevel::kVerbose)) {
+        const char* mutation = mutationType == Add      ? "Add"
+                               : mutationType == Remove ? "Remove"
+                                                        : "Unknown";
+        Trace(TraceLevel::kVerbose,
+              L"{} {} ({} {}) parent {} index {} children {}", mutation,
+              TraceHex{element.Handle}, element.Type, element.Name,
+              TraceHex{parentChildRelation.Parent},
+              parentChildRelation.ChildIndex, element.NumChildren);
     }
-#endif  // EXTRA_DEBUG
 
     switch (mutationType) {
         case Add:
@@ -208,8 +255,14 @@ HRESULT VisualTreeWatcher::OnVisualTreeChange(
             break;
     }
 
+    m_lifetime.MaybeSummarize(start);
+    MaybeTakeBaseline(start);
+    ChargeCallback(WatcherCallback::kTreeChange, start);
+
     return S_OK;
 } catch (...) {
+    Trace(TraceLevel::kError, L"OnVisualTreeChange failed with {}",
+          TraceHex{static_cast<uint32_t>(winrt::to_hresult())});
     ATLASSERT(FALSE);
     // Returning an error prevents (some?) further messages, always return
     // success.
@@ -217,100 +270,1366 @@ HRESULT VisualTreeWatcher::OnVisualTreeChange(
     return S_OK;
 }
 
-HRESULT VisualTreeWatcher::OnElementStateChanged(InstanceHandle,
-                                                 VisualElementState,
-                                                 LPCWSTR) noexcept {
+template <typename Framework>
+HRESULT VisualTreeWatcher<Framework>::OnElementStateChanged(
+    InstanceHandle,
+    VisualElementState,
+    LPCWSTR) noexcept {
     return S_OK;
 }
 
-void VisualTreeWatcher::ElementAdded(
+template <typename Framework>
+void VisualTreeWatcher<Framework>::ElementAdded(
     const ParentChildRelation& parentChildRelation,
     const VisualElement& element) {
-    wux::FrameworkElement frameworkElement = nullptr;
+    // Every element is tracked, so that the tree is the same whether it was
+    // replayed or built live, only FrameworkElements are subscribed to.
+    const std::wstring_view elementType{
+        element.Type, element.Type ? SysStringLen(element.Type) : 0};
+    const std::wstring_view elementName{
+        element.Name, element.Name ? SysStringLen(element.Name) : 0};
 
-    const auto inspectable = FromHandle<wf::IInspectable>(element.Handle);
-    frameworkElement = inspectable.try_as<wux::FrameworkElement>();
+    std::wstring path;
 
-    if (frameworkElement) {
-        const std::wstring_view elementType{
-            element.Type, element.Type ? SysStringLen(element.Type) : 0};
-        const std::wstring_view elementName{
-            element.Name, element.Name ? SysStringLen(element.Name) : 0};
+    if (!elementName.empty()) {
+        path += elementName;
+        path += L" (";
+    }
 
-        std::wstring path;
+    size_t index = FindLast(elementType, L'.');
+    const auto typeName = elementType.substr(index + 1);
+    path += typeName;
 
-        if (!elementName.empty()) {
-            path += elementName;
-            path += L" (";
+    if (!elementName.empty()) {
+        path += L")";
+    }
+
+    // Re-added without a remove, don't count it twice.
+    if (m_elements.contains(element.Handle)) {
+        ElementRemoved(element.Handle);
+    }
+
+    const int64_t now = QueryTicks();
+    unsigned int depth = 0;
+    InstanceHandle samplingRoot = element.Handle;
+    InstanceHandle transientRoot = 0;
+    uint32_t subtreePathId = PathTable::kInvalidId;
+    uint32_t flameNode = FlameGraph::kRoot;
+    uint32_t partition = 0;
+
+    auto parent = m_elements.find(parentChildRelation.Parent);
+    const bool isRoot = parent == m_elements.end();
+    if (!isRoot) {
+        depth = parent->second.depth + 1;
+        if (depth > m_settings.subtreeDepth) {
+            samplingRoot = parent->second.samplingRoot;
+            subtreePathId = parent->second.subtreePathId;
         }
 
-        size_t index = elementType.find_last_of('.');
-        if (index >= 0) {
-            path += elementType.substr(index + 1);
-        } else {
-            path += elementType;
+        transientRoot = parent->second.transientRoot;
+        flameNode = parent->second.flameNode;
+        partition = parent->second.partition;
+
+        auto& childCount = parent->second.childCount;
+        m_treeStats.ChildCountChanged(childCount, childCount + 1);
+        childCount++;
+    }
+
+    const uint32_t typeId = m_treeStats.InternType(typeName);
+    const uint64_t ownHash = ElementHash(path);
+    if (!transientRoot && m_lifetime.IsTransientType(typeId, typeName)) {
+        transientRoot = element.Handle;
+    }
+
+    if (m_settings.flameGraph != FlameWeight::kOff) {
+        flameNode = m_flame.Child(flameNode, path);
+    }
+
+    auto& item = m_elements[element.Handle] =
+        ElementItem{.parent = parentChildRelation.Parent,
+                    .name = path,
+                    .numChildren = element.NumChildren,
+                    .childIndex = parentChildRelation.ChildIndex,
+                    .depth = depth,
+                    .samplingRoot = samplingRoot,
+                    .subtreePathId = subtreePathId,
+                    .eventCount = 0,
+                    .subtreeEventCount = 0,
+                    .typeId = typeId,
+                    .childCount = 0,
+                    .addedTicks = now,
+                    .generation = m_lifetime.Generation(),
+                    .transientRoot = transientRoot,
+                    .ownHash = ownHash,
+                    .hash = ownHash,
+                    .flameNode = flameNode,
+                    .partition = partition,
+                    .rateStart = 0,
+                    .rateEvents = 0,
+                    .subtreeRateStart = 0,
+                    .subtreeRateEvents = 0};
+    UpdateHashes(item.parent, 0, ChildHashTerm(item.hash, item.childIndex));
+
+    if (isRoot) {
+        item.partition = AddPartition(element.Handle);
+    }
+    m_partitions[item.partition]->elements.fetch_add(
+        1, std::memory_order_relaxed);
+
+    uint32_t pathId = PathTable::kInvalidId;
+    if (depth == m_settings.subtreeDepth ||
+        transientRoot == element.Handle) {
+        pathId = m_paths.Intern(FindPathToRoot(element.Handle));
+    }
+
+    m_treeStats.ElementAdded(typeId, depth);
+    if (depth == m_settings.subtreeDepth) {
+        m_treeStats.RootAdded(element.Handle, pathId);
+        item.subtreePathId = pathId;
+    }
+
+    if (depth >= m_settings.subtreeDepth) {
+        m_treeStats.RootSizeChanged(samplingRoot, 1);
+        m_churn.ElementAdded(typeId, samplingRoot, item.subtreePathId, now);
+    } else {
+        m_churn.ElementAdded(typeId, 0, PathTable::kInvalidId, now);
+    }
+
+    m_lifetime.ElementAdded(now);
+    if (transientRoot == element.Handle) {
+        item.generation =
+            m_lifetime.TransientRootAdded(element.Handle, pathId, now);
+    }
+
+    if (transientRoot) {
+        m_lifetime.TransientSizeChanged(transientRoot, 1);
+    }
+
+    if (!parentChildRelation.Parent) {
+        return;
+    }
+
+    if (m_ingesting) {
+        QueueSubscription(element.Handle);
+        return;
+    }
+
+    TrySubscribe(element.Handle);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::Attach() {
+    {
+        std::scoped_lock lock(m_writerMutex);
+        m_ingesting = true;
+        m_elements.reserve(kInitialElements);
+        m_subscriptions.reserve(kInitialElements);
+    }
+
+    const auto treeService = m_xamlDiagnostics.as<IVisualTreeService3>();
+    winrt::check_hresult(treeService->AdviseVisualTreeChange(this));
+
+    std::scoped_lock lock(m_writerMutex);
+    m_ingesting = false;
+
+    const int64_t attachTicks =
+        m_settings.startTicks ? m_settings.startTicks : m_startTicks;
+    const uint64_t replayedUs = TicksToMicroseconds(QueryTicks() - attachTicks);
+    m_stats.attachReplayedUs.store(replayedUs, std::memory_order_relaxed);
+    if (m_pendingSubscriptions.empty()) {
+        m_stats.attachSyncedUs.store(replayedUs, std::memory_order_relaxed);
+    }
+
+    Trace(TraceLevel::kInfo, L"Tree replayed, {} elements, {} us after start",
+          m_elements.size(), replayedUs);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::QueueSubscription(InstanceHandle handle) {
+    const DWORD threadId = GetCurrentThreadId();
+    auto find = m_pendingSubscriptions.find(threadId);
+    if (find == m_pendingSubscriptions.end()) {
+        // Runs once the replay has given the thread back, at low priority
+        // so input and rendering go first. A thread that can't be called
+        // back has its elements subscribed right away, as if added live.
+        auto queue = Framework::DispatcherQueue::GetForCurrentThread();
+        if (!queue ||
+            !queue.TryEnqueue(Framework::DispatcherQueuePriority::Low,
+                              [this] { SubscribePending(); })) {
+            TrySubscribe(handle);
+            return;
         }
 
-        if (!elementName.empty()) {
-            path += L")";
+        find = m_pendingSubscriptions
+                   .emplace(threadId,
+                            PendingSubscriptions{.queue = std::move(queue)})
+                   .first;
+    }
+
+    find->second.handles.push_back(handle);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::SubscribePending() {
+    const int64_t start = QueryTicks();
+    std::scoped_lock lock(m_writerMutex);
+
+    auto find = m_pendingSubscriptions.find(GetCurrentThreadId());
+    if (find == m_pendingSubscriptions.end()) {
+        return;
+    }
+
+    auto& pending = find->second;
+    const int64_t deadline =
+        start + kSubscribeBatchMicroseconds * TicksPerSecond() / 1000000;
+
+    while (pending.next < pending.handles.size()) {
+        const InstanceHandle handle = pending.handles[pending.next++];
+
+        // Removed since, or removed and added again and so subscribed.
+        if (!m_elements.contains(handle) || m_subscriptions.contains(handle)) {
+            continue;
         }
 
-        m_elements[element.Handle] =
-            ElementItem{.parent = parentChildRelation.Parent,
-                        .name = path,
-                        .numChildren = element.NumChildren,
-                        .childIndex = parentChildRelation.ChildIndex};
+        try {
+            TrySubscribe(handle);
+        } catch (...) {
+            Trace(TraceLevel::kError, L"Subscribing {} failed with {}",
+                  TraceHex{handle},
+                  TraceHex{static_cast<uint32_t>(winrt::to_hresult())});
+        }
 
-        if (!parentChildRelation.Parent) {
-            return;
+        if ((pending.next & 63) == 0 && QueryTicks() >= deadline) {
+            break;
         }
+    }
 
-        auto handle = element.Handle;
+    // A queue that shut down has no thread left to subscribe on, the rest of
+    // its elements are dropped.
+    if (pending.next == pending.handles.size() ||
+        !pending.queue.TryEnqueue(Framework::DispatcherQueuePriority::Low,
+                                  [this] { SubscribePending(); })) {
+        m_pendingSubscriptions.erase(find);
 
-        m_sizeChangedTokens[element.Handle] = frameworkElement.SizeChanged(
+        if (m_pendingSubscriptions.empty() && !m_ingesting) {
+            const int64_t attachTicks =
+                m_settings.startTicks ? m_settings.startTicks : m_startTicks;
+            const uint64_t syncedUs =
+                TicksToMicroseconds(QueryTicks() - attachTicks);
+            m_stats.attachSyncedUs.store(syncedUs, std::memory_order_relaxed);
+            Trace(TraceLevel::kInfo, L"Tree synced, {} us after start",
+                  syncedUs);
+        }
+    }
+
+    ChargeCallback(WatcherCallback::kSubscribe, start);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::Subscribe(
+    InstanceHandle handle,
+    const typename Framework::FrameworkElement& element) {
+    auto& subscriptions = m_subscriptions[handle];
+
+    subscriptions.threadId = GetCurrentThreadId();
+    if (!m_dispatchers.contains(subscriptions.threadId)) {
+        // Ahead of a cycle report on this thread, which mustn't allocate.
+        LeaseTraceBuffer();
+
+        auto queue = Framework::DispatcherQueue::GetForCurrentThread();
+        if (queue) {
+            m_dispatchers.emplace(subscriptions.threadId, std::move(queue));
+        }
+    }
+
+    if (m_settings.Captures(EventKind::kSizeChanged)) {
+        subscriptions.sizeChanged = element.SizeChanged(
             winrt::auto_revoke,
-            [this, handle](IInspectable const& sender,
-                           wux::SizeChangedEventArgs const& args) {
+            [this, handle](auto const& sender, auto const& args) {
                 auto previous = args.PreviousSize();
                 if (previous.Width > 0 || previous.Height > 0) {
-                    auto path = FindPathToRoot(handle);
-
-#if EXTRA_DEBUG
-                    OutputDebugStringFormat(L"SizeChanged for %s\n",
-                                            path.c_str());
-#endif
-
-                    if (!m_history.empty()) {
-                        const auto& peek = m_history.back();
-                        size_t index = path.find(peek.path);
-                        if (index == 0 && path.size() > peek.path.size()) {
-                            m_history.pop_back();
-                        }
+                    OnElementEvent(handle, EventKind::kSizeChanged);
+                }
+            });
+    }
+
+    // Only on 1809 and later for UWP.
+    if (m_settings.Captures(EventKind::kEffectiveViewportChanged)) {
+        const auto viewportElement =
+            element.template try_as<typename Framework::ViewportElement>();
+        if (viewportElement) {
+            subscriptions.effectiveViewportChanged =
+                viewportElement.EffectiveViewportChanged(
+                    winrt::auto_revoke,
+                    [this, handle](auto const&, auto const&) {
+                        OnElementEvent(handle,
+                                       EventKind::kEffectiveViewportChanged);
+                    });
+        }
+    }
+
+    if (m_settings.Captures(EventKind::kLoaded)) {
+        subscriptions.loaded = element.Loaded(
+            winrt::auto_revoke, [this, handle](auto const&, auto const&) {
+                OnElementEvent(handle, EventKind::kLoaded);
+            });
+    }
+
+    if (m_settings.Captures(EventKind::kUnloaded)) {
+        subscriptions.unloaded = element.Unloaded(
+            winrt::auto_revoke, [this, handle](auto const&, auto const&) {
+                OnElementEvent(handle, EventKind::kUnloaded);
+            });
+    }
+
+    // Raised on every subscriber after every layout pass, with no sender.
+    // It tells when passes happen, not which element caused them.
+    if (m_settings.Captures(EventKind::kLayoutUpdated)) {
+        subscriptions.layoutUpdated = element.LayoutUpdated(
+            winrt::auto_revoke, [this, handle](auto const&, auto const&) {
+                OnElementEvent(handle, EventKind::kLayoutUpdated);
+            });
+    }
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::TrySubscribe(InstanceHandle handle) {
+    const auto frameworkElement =
+        FromHandle<wf::IInspectable>(handle)
+            .template try_as<typename Framework::FrameworkElement>();
+    if (frameworkElement) {
+        Subscribe(handle, frameworkElement);
+    }
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::ElementRemoved(InstanceHandle handle) {
+    auto find = m_elements.find(handle);
+    if (find != m_elements.end()) {
+        const ElementItem& item = find->second;
+
+        m_treeStats.ElementRemoved(item.typeId, item.depth, item.childCount);
+        if (item.depth == m_settings.subtreeDepth) {
+            m_treeStats.RootRemoved(handle);
+        } else if (item.depth > m_settings.subtreeDepth) {
+            m_treeStats.RootSizeChanged(item.samplingRoot, -1);
+        }
+
+        if (item.depth >= m_settings.subtreeDepth) {
+            m_churn.ElementRemoved(item.typeId, item.samplingRoot,
+                                   item.subtreePathId, QueryTicks());
+        } else {
+            m_churn.ElementRemoved(item.typeId, 0, PathTable::kInvalidId,
+                                   QueryTicks());
+        }
+
+        UpdateHashes(item.parent, ChildHashTerm(item.hash, item.childIndex),
+                     0);
+
+        m_lifetime.ElementRemoved(item.addedTicks);
+        m_partitions[item.partition]->elements.fetch_sub(
+            1, std::memory_order_relaxed);
+        if (item.transientRoot == handle) {
+            m_lifetime.TransientRootRemoved(handle);
+        } else if (item.transientRoot) {
+            m_lifetime.TransientSizeChanged(item.transientRoot, -1);
+        }
+
+        auto parent = m_elements.find(item.parent);
+        if (parent != m_elements.end() && parent->second.childCount) {
+            auto& childCount = parent->second.childCount;
+            m_treeStats.ChildCountChanged(childCount, childCount - 1);
+            childCount--;
+        }
+
+        m_elements.erase(find);
+    }
+
+    m_subscriptions.erase(handle);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::OnElementEvent(InstanceHandle handle,
+                                                  EventKind kind) {
+    const int64_t start = QueryTicks();
+    std::scoped_lock lock(m_writerMutex);
+
+    m_stats.eventsSeen.fetch_add(1, std::memory_order_relaxed);
+
+    auto find = m_elements.find(handle);
+    if (find == m_elements.end()) {
+        return;
+    }
+
+    ElementItem& item = find->second;
+    uint32_t count = ++item.eventCount;
+
+    m_partitions[item.partition]->eventsSeen.fetch_add(
+        1, std::memory_order_relaxed);
+
+    ElementItem* root = nullptr;
+    if (m_settings.samplingScope == SamplingScope::kSubtree ||
+        m_settings.triggerRate) {
+        auto findRoot = m_elements.find(item.samplingRoot);
+        if (findRoot != m_elements.end()) {
+            root = &findRoot->second;
+        }
+    }
+
+    if (root && m_settings.samplingScope == SamplingScope::kSubtree) {
+        count = ++root->subtreeEventCount;
+    }
+
+    if (kind == EventKind::kSizeChanged &&
+        m_settings.flameGraph != FlameWeight::kOff) {
+        m_flame.Count(item.flameNode, start);
+    }
+
+    if (m_triggers.CountEvent(item.rateEvents, item.rateStart, start)) {
+        m_triggers.Request(SnapshotTrigger::kElementRate, handle);
+    }
+
+    if (root && item.depth >= m_settings.subtreeDepth &&
+        m_triggers.CountEvent(root->subtreeRateEvents, root->subtreeRateStart,
+                              start)) {
+        m_triggers.Request(SnapshotTrigger::kSubtreeRate, item.samplingRoot);
+    }
+
+    if (m_governor.ShouldRecord(count)) {
+        RecordEvent(handle, kind, start, item.partition);
+    }
+
+    m_lifetime.MaybeSummarize(start);
+    ChargeCallback(WatcherCallback::kElementEvent, start);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::ChargeCallback(WatcherCallback callback,
+                                                  int64_t start) {
+    const int64_t end = QueryTicks();
+    m_governor.Charge(start, end);
+    m_stats.Latency(callback).Record(end - start);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::RecordEvent(InstanceHandle handle,
+                                               EventKind kind,
+                                               int64_t timestamp,
+                                               uint32_t partition) {
+    auto path = FindPathToRoot(handle);
+
+    Trace(TraceLevel::kVerbose, L"{} for {}", EventKindName(kind), path);
+
+    // Captured here, still inside the event handler, so that the stack is
+    // the one of the layout pass that raised the event.
+    const uint32_t stackId =
+        m_settings.captureStacks && kind == EventKind::kSizeChanged
+            ? m_stacks.Capture()
+            : StackTable::kInvalidId;
+
+    const HistoryItem item{.timestamp = timestamp,
+                           .handle = handle,
+                           .pathId = m_paths.Intern(path),
+                           .stackId = stackId,
+                           .kind = kind};
+
+    m_stats.eventsRecorded.fetch_add(1, std::memory_order_relaxed);
+
+    Partition& window = *m_partitions[partition];
+    window.eventsRecorded.fetch_add(1, std::memory_order_relaxed);
+    window.lastEventTicks.store(timestamp, std::memory_order_relaxed);
+
+    // The trace gets every recorded event, coalescing only applies to the
+    // in-memory history.
+    if (m_trace) {
+        m_trace->Append(item);
+    }
+
+    // A descendant resizing right after its ancestor is part of the same
+    // layout pass, keep only the deepest one. Other kinds are kept as is,
+    // they are what explains the resizes around them.
+    // Not while the folder holds events or the back closes a repeat, the
+    // back doesn't stand for just the last event then.
+    HistoryItem peek;
+    if (kind == EventKind::kSizeChanged && window.folder.Idle() &&
+        window.history.Back(peek) && peek.kind == EventKind::kSizeChanged &&
+        !peek.period) {
+        const auto peekPath = m_paths.Get(peek.pathId);
+        if (path.size() > peekPath.size() && StartsWith(path, peekPath)) {
+            window.history.ReplaceBack(item);
+            window.archive.ReplaceBack(item);
+            window.folder.ReplacedBack(item);
+            return;
+        }
+    }
+
+    if (!m_settings.foldHistory) {
+        window.history.Push(item);
+        window.archive.Push(item);
+        return;
+    }
+
+    window.folder.Append(
+        item,
+        [&](const HistoryItem& recorded) {
+            window.history.Push(recorded);
+            window.archive.Push(recorded);
+        },
+        [&](const HistoryItem& folded) {
+            window.history.ReplaceBack(folded);
+            window.archive.ReplaceBack(folded);
+        });
+}
+
+template <typename Framework>
+uint32_t VisualTreeWatcher<Framework>::AddPartition(InstanceHandle root) {
+    const uint32_t count = m_partitionCount.load(std::memory_order_relaxed);
+
+    // A root added again after a remove gets its window back.
+    for (uint32_t i = 0; i < count; i++) {
+        if (m_partitions[i]->root == root) {
+            return i;
+        }
+    }
+
+    if (count == kMaxPartitions) {
+        return kMaxPartitions - 1;
+    }
+
+    auto& partition = m_partitions[count] = std::make_unique<Partition>();
+    partition->root = root;
+    partition->rootPathId = m_paths.Intern(FindPathToRoot(root));
+    partition->threadId = GetCurrentThreadId();
+
+    // Publishes the partition.
+    m_partitionCount.store(count + 1, std::memory_order_release);
+
+    Trace(TraceLevel::kInfo, L"Window {} at {} on thread {}", count,
+          TraceHex{root}, partition->threadId);
+    return count;
+}
+
+template <typename Framework>
+uint32_t VisualTreeWatcher<Framework>::FindPartition(DWORD threadId) const {
+    const uint32_t count = m_partitionCount.load(std::memory_order_acquire);
+
+    uint32_t found = 0;
+    bool foundOnThread = false;
+    int64_t foundTicks = -1;
+    for (uint32_t i = 0; i < count; i++) {
+        const Partition& partition = *m_partitions[i];
+        const bool onThread = partition.threadId == threadId;
+        const int64_t ticks =
+            partition.lastEventTicks.load(std::memory_order_relaxed);
+        if (onThread > foundOnThread ||
+            (onThread == foundOnThread && ticks > foundTicks)) {
+            found = i;
+            foundOnThread = onThread;
+            foundTicks = ticks;
+        }
+    }
+
+    return found;
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::UpdateHashes(InstanceHandle parent,
+                                                uint64_t oldTerm,
+                                                uint64_t newTerm) {
+    // A changed child changes the hash of every ancestor.
+    for (auto find = m_elements.find(parent); find != m_elements.end();
+         find = m_elements.find(find->second.parent)) {
+        ElementItem& item = find->second;
+
+        const uint64_t oldHash = item.hash;
+        item.hash += newTerm - oldTerm;
+
+        oldTerm = ChildHashTerm(oldHash, item.childIndex);
+        newTerm = ChildHashTerm(item.hash, item.childIndex);
+    }
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::CopyTree(TreeScratch& scratch) {
+    auto& entries = scratch.entries;
+    entries.clear();
+    for (const auto& [handle, item] : m_elements) {
+        entries.push_back({.handle = handle,
+                           .parent = item.parent,
+                           .hash = item.hash,
+                           .ownHash = item.ownHash,
+                           .typeId = item.typeId,
+                           .childIndex = item.childIndex});
+    }
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::TakeSnapshot(TreeSnapshot& snapshot,
+                                                TreeScratch& scratch,
+                                                int64_t now) {
+    CopyTree(scratch);
+    snapshot.Build(scratch, now);
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::MaybeTakeBaseline(int64_t now) {
+    if (!m_settings.snapshotInterval || now < m_nextBaseline) {
+        return;
+    }
+
+    m_nextBaseline =
+        now + int64_t{m_settings.snapshotInterval} * TicksPerSecond();
+
+    auto baseline = std::make_shared<TreeSnapshot>();
+    TakeSnapshot(*baseline, m_crashScratch, now);
+    m_baseline = std::move(baseline);
+
+    // Room for the tree to double before the next baseline.
+    const size_t capacity = 2 * m_elements.size();
+    m_crashScratch.Reserve(capacity);
+    m_crashSnapshot.nodes.reserve(capacity);
+
+    Trace(TraceLevel::kInfo, L"Tree snapshot, {} elements in {} us",
+          m_baseline->nodes.size(), TicksToMicroseconds(QueryTicks() - now));
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteCrashReport(
+    HRESULT hr,
+    bool elementsLocked,
+    const TreeSnapshot* current,
+    int64_t start) {
+    // Two windows may hit a cycle at once. This lock is never taken by
+    // writers, so it can't deadlock against the layout pass that threw.
+    std::lock_guard lock(m_reportMutex);
+
+    // This is the UI thread that threw, the cycle is in one of its
+    // windows, and most likely the one that saw the last event.
+    const uint32_t partition = FindPartition(GetCurrentThreadId());
+    const size_t layoutCount = CaptureLayoutHere(partition, elementsLocked, m_crashLayout);
+
+    m_report->Reset();
+    WriteReport(*m_report, m_reportedPaths.get(),
+                ReportReason{.trigger = "layoutCycle",
+                             .hr = hr,
+                             .element = 0,
+                             .elementPathId = PathTable::kInvalidId,
+                             .sequence = 0,
+                             .partition = partition},
+                m_crashLayout, layoutCount,
+                current ? m_baseline.get() : nullptr, current, m_crashScratch,
+                true);
+
+    m_flameReport->Reset();
+    WriteFlameGraph(*m_flameReport);
+
+    m_stats.Latency(WatcherCallback::kCrashReport).Record(QueryTicks() - start);
+}
+
+template <typename Framework>
+size_t VisualTreeWatcher<Framework>::RecentEvents(uint32_t partition,
+                                                  HistoryItem* out) {
+    if (partition >= m_partitionCount.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    HistoryItem history[kHistoryCapacity];
+    const size_t count =
+        m_partitions[partition]->history.Snapshot(history, ARRAYSIZE(history));
+    return UnfoldHistory(history, count, out, kHistoryCapacity);
+}
+
+template <typename Framework>
+size_t VisualTreeWatcher<Framework>::CaptureLayoutHere(uint32_t partition,
+                                                       bool elementsLocked,
+                                                       LayoutProperties* out) {
+    HistoryItem recent[kHistoryCapacity];
+    const size_t recentCount = RecentEvents(partition, recent);
+    const size_t count =
+        SelectParticipants(recent, recentCount, out, kLayoutElements);
+    if (!count) {
+        return 0;
+    }
+
+    // Elements of other threads are skipped before COM is asked, it would
+    // fail them with RPC_E_WRONG_THREAD and set up error info for that. An
+    // element's thread is its subscription's, or without the element
+    // tables its window's, unless the window may share the last partition.
+    const DWORD threadId = GetCurrentThreadId();
+    const bool windowHere = m_partitions[partition]->threadId == threadId &&
+                            partition != kMaxPartitions - 1;
+
+    for (size_t i = 0; i < count; i++) {
+        if (elementsLocked) {
+            auto find = m_subscriptions.find(out[i].handle);
+            if (find == m_subscriptions.end()) {
+                out[i].hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
+                continue;
+            }
+
+            if (find->second.threadId != threadId) {
+                out[i].hr = RPC_E_WRONG_THREAD;
+                continue;
+            }
+        } else if (!windowHere) {
+            out[i].hr = RPC_E_WRONG_THREAD;
+            continue;
+        }
+
+        ReadLayout<Framework>(m_xamlDiagnostics.get(), out[i]);
+    }
+
+    return count;
+}
+
+template <typename Framework>
+size_t VisualTreeWatcher<Framework>::CaptureLayoutOnUiThreads(
+    uint32_t partition,
+    LayoutProperties* out) {
+    if (partition >= m_partitionCount.load(std::memory_order_acquire)) {
+        return 0;
+    }
+
+    // Shared with the UI thread callbacks, which may run after the wait
+    // timed out.
+    struct Capture {
+        std::mutex mutex;
+        LayoutProperties items[kLayoutElements];
+        DWORD threads[kLayoutElements];
+        size_t count = 0;
+        size_t pending = 0;
+        bool abandoned = false;
+        winrt::handle done{CreateEvent(nullptr, TRUE, FALSE, nullptr)};
+    };
+
+    auto capture = std::make_shared<Capture>();
+
+    HistoryItem recent[kHistoryCapacity];
+    const size_t recentCount = RecentEvents(partition, recent);
+    capture->count = SelectParticipants(recent, recentCount, capture->items,
+                                        kLayoutElements);
+    if (!capture->count || !capture->done) {
+        return 0;
+    }
+
+    {
+        std::scoped_lock lock(m_writerMutex, capture->mutex);
+
+        for (size_t i = 0; i < capture->count; i++) {
+            auto find = m_subscriptions.find(capture->items[i].handle);
+            capture->threads[i] =
+                find != m_subscriptions.end() ? find->second.threadId : 0;
+        }
+
+        for (size_t i = 0; i < capture->count; i++) {
+            const DWORD threadId = capture->threads[i];
+            auto queue = m_dispatchers.find(threadId);
+            if (queue == m_dispatchers.end() ||
+                std::find(capture->threads, capture->threads + i, threadId) !=
+                    capture->threads + i) {
+                continue;
+            }
+
+            // The capture holds what it needs, the watcher may be gone by
+            // the time it runs.
+            const bool queued = queue->second.TryEnqueue(
+                Framework::DispatcherQueuePriority::High,
+                [capture, threadId, diagnostics = m_xamlDiagnostics] {
+                    std::lock_guard lock(capture->mutex);
+                    if (capture->abandoned) {
+                        return;
                     }
 
-                    m_history.push_back({.handle = handle, .path = path});
+                    for (size_t j = 0; j < capture->count; j++) {
+                        if (capture->threads[j] == threadId) {
+                            ReadLayout<Framework>(diagnostics.get(),
+                                                  capture->items[j]);
+                        }
+                    }
 
-                    while (200 < m_history.size()) {
-                        m_history.pop_front();
+                    if (--capture->pending == 0) {
+                        SetEvent(capture->done.get());
                     }
-                }
-            });
+                });
+            if (queued) {
+                capture->pending++;
+            }
+        }
+
+        if (capture->pending == 0) {
+            SetEvent(capture->done.get());
+        }
+    }
+
+    // A UI thread stuck in a layout storm answers late or not at all, its
+    // elements are reported as E_PENDING.
+    WaitForSingleObject(capture->done.get(), kLayoutTimeoutMilliseconds);
+
+    std::lock_guard lock(capture->mutex);
+    capture->abandoned = true;
+    std::copy(capture->items, capture->items + capture->count, out);
+    return capture->count;
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteSnapshot(SnapshotTrigger trigger,
+                                                 InstanceHandle element) {
+    const int64_t start = QueryTicks();
+
+    // The app keeps running: only the tree needs the writer lock, and only
+    // for as long as it takes to copy its entries, the snapshot is built
+    // from them afterwards. The rest is read lock-free, as for a crash.
+    std::shared_ptr<const TreeSnapshot> baseline;
+    TreeSnapshot current;
+    TreeScratch scratch;
+    int64_t currentTicks = 0;
+    uint32_t elementPathId = PathTable::kInvalidId;
+    // The window of a rate trigger's element, else the latest to see an
+    // event.
+    uint32_t partition = FindPartition(0);
+    {
+        std::scoped_lock lock(m_writerMutex);
+
+        auto find = element ? m_elements.find(element) : m_elements.end();
+        if (find != m_elements.end()) {
+            elementPathId = m_paths.Intern(FindPathToRoot(element));
+            partition = find->second.partition;
+        }
+
+        if (m_baseline) {
+            baseline = m_baseline;
+            CopyTree(scratch);
+            currentTicks = QueryTicks();
+        }
+    }
+
+    if (baseline) {
+        current.Build(scratch, currentTicks);
+    }
+
+    LayoutProperties layout[kLayoutElements];
+    const size_t layoutCount = CaptureLayoutOnUiThreads(partition, layout);
+
+    std::lock_guard lock(m_snapshotMutex);
+
+    const uint64_t sequence = m_snapshots++;
+    m_snapshotReport->Reset(std::format(L"{}\\LayoutSnapshot-{}.jsonl",
+                                        m_localFolder,
+                                        sequence % kSnapshotFiles));
+    WriteReport(*m_snapshotReport, m_snapshotPaths.get(),
+                ReportReason{.trigger = SnapshotTriggerName(trigger),
+                             .hr = S_OK,
+                             .element = element,
+                             .elementPathId = elementPathId,
+                             .sequence = sequence,
+                             .partition = partition},
+                layout, layoutCount,
+                baseline.get(), baseline ? &current : nullptr, scratch, false);
+
+    m_snapshotReport->Reset(std::format(L"{}\\LayoutSnapshot-{}.folded",
+                                        m_localFolder,
+                                        sequence % kSnapshotFiles));
+    WriteFlameGraph(*m_snapshotReport);
+
+    const int64_t end = QueryTicks();
+    m_stats.Latency(WatcherCallback::kSnapshot).Record(end - start);
+    Trace(TraceLevel::kInfo, L"Snapshot {} ({}) written in {} us", sequence,
+          SnapshotTriggerName(trigger), TicksToMicroseconds(end - start));
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteReport(JsonLinesWriter& report,
+                                               uint64_t* reportedPaths,
+                                               const ReportReason& reason,
+                                               const LayoutProperties* layout,
+                                               size_t layoutCount,
+                                               const TreeSnapshot* baseline,
+                                               const TreeSnapshot* current,
+                                               TreeScratch& scratch,
+                                               bool elementsLocked) {
+    const uint32_t partitionCount =
+        m_partitionCount.load(std::memory_order_acquire);
+    Partition* window = reason.partition < partitionCount
+                            ? m_partitions[reason.partition].get()
+                            : nullptr;
+
+    // The cycle, or the storm for a snapshot, is whatever the window's ring
+    // holds right now.
+    HistoryItem recent[kHistoryCapacity];
+    const size_t recentCount = RecentEvents(reason.partition, recent);
+    const CycleFingerprint fingerprint =
+        ComputeCycleFingerprint(m_paths, recent, recentCount);
+
+    report.BeginLine();
+    report.Field("type", std::string_view("header"));
+    report.Field("schema", uint64_t{kReportSchema});
+    report.Field("trigger", reason.trigger);
+    if (reason.trigger != "layoutCycle") {
+        report.Field("sequence", reason.sequence);
+    }
+    report.HexField("hresult", static_cast<uint32_t>(reason.hr));
+    report.Field("version", std::string_view(VER_FILE_VERSION_STR));
+    report.Field("package", std::wstring_view(m_packageFullName));
+    report.Field("os", std::string_view(m_osVersion));
+    report.Field("pid", uint64_t{GetCurrentProcessId()});
+    report.HexField("fingerprint", fingerprint.hash);
+    report.Field("fingerprintVersion", uint64_t{CycleFingerprint::kVersion});
+    report.Field("fingerprintParticipants", uint64_t{fingerprint.participants});
+    report.Field("fingerprintTransitions", uint64_t{fingerprint.transitions});
+    report.Field("uptimeUs", TicksToMicroseconds(QueryTicks() - m_startTicks));
+    report.Field("eventsSeen", m_stats.eventsSeen.load());
+    report.Field("eventsRecorded", m_stats.eventsRecorded.load());
+    report.Field("samplingInterval", uint64_t{m_governor.Interval()});
+    report.Field("overheadUs", uint64_t{m_governor.LastWindowMicroseconds()});
+    uint64_t archiveBytes = 0;
+    uint64_t archiveDroppedBlocks = 0;
+    for (uint32_t i = 0; i < partitionCount; i++) {
+        archiveBytes += m_partitions[i]->archive.CompressedBytes();
+        archiveDroppedBlocks += m_partitions[i]->archive.DroppedBlocks();
+    }
+    report.Field("archiveBytes", archiveBytes);
+    report.Field("archiveDroppedBlocks", archiveDroppedBlocks);
+    if (window) {
+        report.Field("window", uint64_t{reason.partition});
+    }
+    report.Field("attachReplayedUs", m_stats.attachReplayedUs.load());
+    report.Field("attachSyncedUs", m_stats.attachSyncedUs.load());
+    if (m_trace) {
+        report.Field("traceDropped", m_trace->DroppedRecords());
+        report.Field("traceBytes", m_trace->BytesWritten());
+    }
+    report.Field("snapshotsSuppressed", m_triggers.Suppressed());
+    report.Field("paths", uint64_t{m_paths.Size()});
+    report.Field("pathsDropped", m_paths.Dropped());
+    if (m_settings.captureStacks) {
+        report.Field("stacks", uint64_t{m_stacks.Size()});
+        report.Field("stacksDropped", m_stacks.Dropped());
+    }
+    report.EndLine();
+
+    memset(reportedPaths, 0, PathTable::kMaxEntries / 64 * sizeof(uint64_t));
+
+    // Each path is written once, before the first line that uses it.
+    auto writePath = [&](uint32_t pathId) {
+        if (pathId >= PathTable::kMaxEntries) {
+            return false;
+        }
+
+        if (reportedPaths[pathId / 64] & (1ull << pathId % 64)) {
+            return true;
+        }
+
+        reportedPaths[pathId / 64] |= 1ull << pathId % 64;
+
+        report.BeginLine();
+        report.Field("type", std::string_view("path"));
+        report.Field("id", uint64_t{pathId});
+        report.Key("path");
+        report.StringBegin();
+        ForEachAbbreviatedPart(
+            m_paths.Get(pathId),
+            [&](std::wstring_view part) { report.StringPart(part); });
+        report.StringEnd();
+        report.EndLine();
+        return true;
+    };
+
+    if (reason.element) {
+        const bool known = writePath(reason.elementPathId);
+
+        report.BeginLine();
+        report.Field("type", std::string_view("trigger"));
+        report.HexField("handle", reason.element);
+        if (known) {
+            report.Field("path", uint64_t{reason.elementPathId});
+        }
+        report.Field("rate", uint64_t{m_settings.triggerRate});
+        report.EndLine();
+    }
+
+    for (uint32_t i = 0; i < partitionCount; i++) {
+        Partition& partition = *m_partitions[i];
+        const bool known = writePath(partition.rootPathId);
+
+        report.BeginLine();
+        report.Field("type", std::string_view("window"));
+        report.Field("index", uint64_t{i});
+        report.HexField("root", partition.root);
+        if (known) {
+            report.Field("path", uint64_t{partition.rootPathId});
+        }
+        report.Field("thread", uint64_t{partition.threadId});
+        report.Field("elements", partition.elements.load());
+        report.Field("eventsSeen", partition.eventsSeen.load());
+        report.Field("eventsRecorded", partition.eventsRecorded.load());
+        report.Field("archiveBytes",
+                     uint64_t{partition.archive.CompressedBytes()});
+        report.Field("archiveDroppedBlocks",
+                     partition.archive.DroppedBlocks());
+        report.EndLine();
+    }
+
+    for (size_t i = 0; i < layoutCount; i++) {
+        WriteLayoutProperties(report, layout[i], writePath(layout[i].pathId));
+    }
+
+    WriteTreeStats(report, writePath);
+    WriteLifetime(report, writePath);
+    WriteChurn(report, writePath);
+    WriteLatency(report);
+
+    // Stacks too, like paths.
+    uint64_t reportedStacks[StackTable::kMaxStacks / 64] = {};
+    auto writeStack = [&](uint32_t stackId) {
+        if (stackId >= m_stacks.Size()) {
+            return false;
+        }
+
+        if (!(reportedStacks[stackId / 64] & (1ull << stackId % 64))) {
+            reportedStacks[stackId / 64] |= 1ull << stackId % 64;
+            m_stacks.Write(report, stackId);
+        }
+
+        return true;
+    };
+
+    auto write = [&](const HistoryItem& item) {
+        const uint32_t pathId = item.pathId;
+        const bool known = writePath(pathId);
+        const bool stackKnown = writeStack(item.stackId);
+
+        report.BeginLine();
+        report.Field("type", std::string_view("event"));
+        report.Field("kind", EventKindName(item.kind));
+        report.Field("us", TicksToMicroseconds(item.timestamp - m_startTicks));
+        report.HexField("handle", item.handle);
+        if (known) {
+            report.Field("path", uint64_t{pathId});
+        }
+        if (stackKnown) {
+            report.Field("stack", uint64_t{item.stackId});
+        }
+        report.EndLine();
+
+        if (item.period) {
+            report.BeginLine();
+            report.Field("type", std::string_view("repeat"));
+            report.Field("period", uint64_t{item.period});
+            report.Field("repeats", uint64_t{item.repeats});
+            report.EndLine();
+        }
+    };
+
+    // Older history first, then whatever the ring holds past the last
+    // archived record. Neither takes the writer lock: the writer that threw
+    // may be this very thread, in the middle of a layout pass.
+    if (window) {
+        const uint64_t archived = window->archive.ForEach(write);
+
+        HistoryItem history[kHistoryCapacity];
+        const size_t count =
+            window->history.Snapshot(history, ARRAYSIZE(history), archived);
+
+        for (size_t i = 0; i < count; i++) {
+            write(history[i]);
+        }
     }
+
+    if (baseline && current) {
+        WriteTreeDiff(report, *baseline, *current, scratch, elementsLocked);
+    }
+
+    report.Finish();
 }
 
-void VisualTreeWatcher::ElementRemoved(InstanceHandle handle) {
-    m_elements.erase(handle);
-    m_sizeChangedTokens.erase(handle);
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteTreeDiff(JsonLinesWriter& report,
+                                                 const TreeSnapshot& baseline,
+                                                 const TreeSnapshot& current,
+                                                 TreeScratch& scratch,
+                                                 bool elementsLocked) {
+    static constexpr std::string_view kChangeNames[] = {"added", "removed",
+                                                        "changed"};
+
+    size_t written = 0;
+    const TreeDiffStats stats = DiffTreeSnapshots(
+        baseline, current, scratch,
+        [&](TreeChange change, const TreeSnapshot::Node& node) {
+            if (written == kReportedChanges) {
+                return;
+            }
+
+            written++;
+
+            report.BeginLine();
+            report.Field("type", std::string_view("change"));
+            report.Field("change", kChangeNames[static_cast<int>(change)]);
+            report.HexField("handle", node.handle);
+
+            // Removed elements are gone from the table, only their type is
+            // known.
+            auto find = elementsLocked ? m_elements.find(node.handle)
+                                       : m_elements.end();
+            if (change != TreeChange::kRemoved && find != m_elements.end()) {
+                report.Field("element", std::wstring_view(find->second.name));
+            } else {
+                report.Field("element", m_treeStats.TypeName(node.typeId));
+            }
+
+            report.Field("depth", uint64_t{node.depth});
+            report.Field("size", uint64_t{node.size});
+            report.EndLine();
+        });
+
+    report.BeginLine();
+    report.Field("type", std::string_view("diff"));
+    report.Field("baselineUs",
+                 TicksToMicroseconds(baseline.ticks - m_startTicks));
+    report.Field("baselineElements", uint64_t{baseline.nodes.size()});
+    report.Field("elements", uint64_t{current.nodes.size()});
+    report.Field("added", uint64_t{stats.added});
+    report.Field("removed", uint64_t{stats.removed});
+    report.Field("changed", uint64_t{stats.changed});
+    report.Field("visited", uint64_t{stats.visited});
+    report.EndLine();
 }
 
-std::wstring VisualTreeWatcher::FindPathToRoot(InstanceHandle parent) {
+template <typename Framework>
+template <typename WritePath>
+void VisualTreeWatcher<Framework>::WriteTreeStats(JsonLinesWriter& report,
+                                                  WritePath& writePath) {
+    TreeStats::Root roots[kReportedSubtrees];
+    const size_t rootCount =
+        m_treeStats.LargestRoots(roots, ARRAYSIZE(roots));
+
+    bool rootKnown[kReportedSubtrees];
+    for (size_t i = 0; i < rootCount; i++) {
+        rootKnown[i] = writePath(roots[i].pathId);
+    }
+
+    report.BeginLine();
+    report.Field("type", std::string_view("tree"));
+    report.Field("elements", uint64_t{m_treeStats.Elements()});
+    report.Field("maxFanOut", uint64_t{m_treeStats.MaxFanOut()});
+
+    unsigned int depthCount = TreeStats::kMaxDepth;
+    while (depthCount && !m_treeStats.ElementsAtDepth(depthCount - 1)) {
+        depthCount--;
+    }
+
+    report.BeginArray("depths");
+    for (unsigned int depth = 0; depth < depthCount; depth++) {
+        report.Value(m_treeStats.ElementsAtDepth(depth));
+    }
+    report.EndArray();
+
+    report.BeginArray("types");
+    const uint32_t typeCount =
+        std::min(m_treeStats.TypeCount(), TreeStats::kMaxTypes);
+    for (uint32_t typeId = 0; typeId < typeCount; typeId++) {
+        const uint32_t count = m_treeStats.ElementsOfType(typeId);
+        if (!count) {
+            continue;
+        }
+
+        report.BeginObject();
+        report.Field("name", m_treeStats.TypeName(typeId));
+        report.Field("count", uint64_t{count});
+        report.EndObject();
+    }
+    report.EndArray();
+
+    report.BeginArray("subtrees");
+    for (size_t i = 0; i < rootCount; i++) {
+        report.BeginObject();
+        report.HexField("handle", roots[i].handle);
+        if (rootKnown[i]) {
+            report.Field("path", uint64_t{roots[i].pathId});
+        }
+        report.Field("size", uint64_t{roots[i].size});
+        report.EndObject();
+    }
+    report.EndArray();
+
+    report.EndLine();
+}
+
+template <typename Framework>
+template <typename WritePath>
+void VisualTreeWatcher<Framework>::WriteLifetime(JsonLinesWriter& report,
+                                                 WritePath& writePath) {
+    const int64_t now = QueryTicks();
+
+    LifetimeTracker::Suspect suspects[LifetimeTracker::kMaxSuspects];
+    const size_t suspectCount =
+        m_lifetime.LeakSuspects(suspects, ARRAYSIZE(suspects));
+
+    bool suspectKnown[LifetimeTracker::kMaxSuspects];
+    for (size_t i = 0; i < suspectCount; i++) {
+        suspectKnown[i] = writePath(suspects[i].pathId);
+    }
+
+    report.BeginLine();
+    report.Field("type", std::string_view("lifetime"));
+    report.Field("generation", uint64_t{m_lifetime.Generation()});
+
+    const int64_t summaryTicks = m_lifetime.SummaryTicks();
+    if (summaryTicks) {
+        report.Field("summaryUs",
+                     TicksToMicroseconds(summaryTicks - m_startTicks));
+    }
+
+    size_t bucketCount = LifetimeTracker::kAgeBuckets;
+    while (bucketCount && !m_lifetime.ElementsOfAge(bucketCount - 1)) {
+        bucketCount--;
+    }
+
+    report.BeginArray("ages");
+    for (size_t bucket = 0; bucket < bucketCount; bucket++) {
+        report.Value(m_lifetime.ElementsOfAge(bucket));
+    }
+    report.EndArray();
+
+    report.BeginArray("leaks");
+    for (size_t i = 0; i < suspectCount; i++) {
+        const auto& suspect = suspects[i];
+
+        report.BeginObject();
+        report.HexField("handle", suspect.handle);
+        if (suspectKnown[i]) {
+            report.Field("path", uint64_t{suspect.pathId});
+        }
+        report.Field("ageUs", TicksToMicroseconds(now - suspect.addedTicks));
+        report.Field("generation", uint64_t{suspect.generation});
+        report.Field("size", uint64_t{suspect.size});
+        report.EndObject();
+    }
+    report.EndArray();
+
+    report.EndLine();
+}
+
+template <typename Framework>
+template <typename WritePath>
+void VisualTreeWatcher<Framework>::WriteChurn(JsonLinesWriter& report,
+                                              WritePath& writePath) {
+    using Window = ChurnStats::Window;
+
+    const int64_t now = QueryTicks();
+
+    static constexpr Window kWindows[] = {Window::kPrevious, Window::kCurrent};
+
+    ChurnStats::Churner types[ARRAYSIZE(kWindows)][kReportedChurners];
+    ChurnStats::Churner subtrees[ARRAYSIZE(kWindows)][kReportedChurners];
+    size_t typeCounts[ARRAYSIZE(kWindows)];
+    size_t subtreeCounts[ARRAYSIZE(kWindows)];
+    for (size_t w = 0; w < ARRAYSIZE(kWindows); w++) {
+        typeCounts[w] =
+            m_churn.TopTypes(kWindows[w], types[w], kReportedChurners);
+        subtreeCounts[w] =
+            m_churn.TopSubtrees(kWindows[w], subtrees[w], kReportedChurners);
+
+        for (size_t i = 0; i < subtreeCounts[w]; i++) {
+            if (!writePath(subtrees[w][i].pathId)) {
+                subtrees[w][i].pathId = PathTable::kInvalidId;
+            }
+        }
+    }
+
+    report.BeginLine();
+    report.Field("type", std::string_view("churn"));
+    report.BeginArray("windows");
+    for (size_t w = 0; w < ARRAYSIZE(kWindows); w++) {
+        const int64_t start = m_churn.WindowStart(kWindows[w]);
+        if (!start) {
+            continue;
+        }
+
+        const int64_t end = m_churn.WindowEnd(kWindows[w]);
+
+        report.BeginObject();
+        report.Field("startUs", TicksToMicroseconds(start - m_startTicks));
+        report.Field("durationUs",
+                     TicksToMicroseconds((end ? end : now) - start));
+
+        report.BeginArray("types");
+        for (size_t i = 0; i < typeCounts[w]; i++) {
+            const auto& churner = types[w][i];
+
+            report.BeginObject();
+            report.Field("name", m_treeStats.TypeName(
+                                     static_cast<uint32_t>(churner.key)));
+            report.Field("adds", uint64_t{churner.adds});
+            report.Field("removes", uint64_t{churner.removes});
+            report.EndObject();
+        }
+        report.EndArray();
+
+        report.BeginArray("subtrees");
+        for (size_t i = 0; i < subtreeCounts[w]; i++) {
+            const auto& churner = subtrees[w][i];
+
+            report.BeginObject();
+            report.HexField("handle", churner.key);
+            if (churner.pathId != PathTable::kInvalidId) {
+                report.Field("path", uint64_t{churner.pathId});
+            }
+            report.Field("adds", uint64_t{churner.adds});
+            report.Field("removes", uint64_t{churner.removes});
+            report.EndObject();
+        }
+        report.EndArray();
+
+        report.EndObject();
+    }
+    report.EndArray();
+
+    report.EndLine();
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteLatency(JsonLinesWriter& report) {
+    report.BeginLine();
+    report.Field("type", std::string_view("latency"));
+    for (uint32_t i = 0; i < static_cast<uint32_t>(WatcherCallback::kCount);
+         i++) {
+        const auto callback = static_cast<WatcherCallback>(i);
+        const LatencyHistogram::Summary summary =
+            m_stats.Latency(callback).Summarize();
+
+        report.BeginObject(WatcherCallbackName(callback));
+        report.Field("count", summary.count);
+        report.Field("p50Ns", summary.p50Nanoseconds);
+        report.Field("p99Ns", summary.p99Nanoseconds);
+        report.Field("maxNs", summary.maxNanoseconds);
+        report.Field("totalUs", summary.totalMicroseconds);
+        report.EndObject();
+    }
+    report.EndLine();
+}
+
+template <typename Framework>
+void VisualTreeWatcher<Framework>::WriteFlameGraph(JsonLinesWriter& out) {
+    if (m_settings.flameGraph == FlameWeight::kOff) {
+        return;
+    }
+
+    m_flame.Write(out, m_settings.flameGraph);
+    out.Finish();
+}
+
+template <typename Framework>
+std::wstring VisualTreeWatcher<Framework>::FindPathToRoot(
+    InstanceHandle parent) {
     unsigned int numChildren;
     auto path = FindPathToRootImpl(parent, numChildren);
     return path;
 }
 
-std::wstring VisualTreeWatcher::FindPathToRootImpl(InstanceHandle handle,
-                                                   unsigned int& numChildren) {
+template <typename Framework>
+std::wstring VisualTreeWatcher<Framework>::FindPathToRootImpl(
+    InstanceHandle handle,
+    unsigned int& numChildren) {
     auto find = m_elements.find(handle);
     if (find != m_elements.end()) {
         std::wstring path = find->second.name;
@@ -333,3 +1652,6 @@ std::wstring VisualTreeWatcher::FindPathToRootImpl(InstanceHandle handle,
     numChildren = 0;
     return L"";
 }
+
+template struct VisualTreeWatcher<UwpFramework>;
+template struct VisualTreeWatcher<WinUIFramework>;
@@ -1,16 +1,38 @@
 #pragma once
 
+#include "churnstats.hpp"
+#include "clock.hpp"
+#include "fingerprint.hpp"
+#include "flamegraph.hpp"
+#include "framework.hpp"
+#include "history.hpp"
+#include "historyarchive.hpp"
+#include "historyfolder.hpp"
+#include "jsonlineswriter.hpp"
+#include "layoutcapture.hpp"
+#include "lifetime.hpp"
+#include "ownedmutex.hpp"
+#include "pathtable.hpp"
+#include "sampling.hpp"
+#include "seqlock.hpp"
+#include "sessionregistry.hpp"
+#include "settings.hpp"
+#include "stacktable.hpp"
+#include "stats.hpp"
+#include "tracewriter.hpp"
+#include "treesnapshot.hpp"
+#include "treestats.hpp"
+#include "triggers.hpp"
 #include "winrt.hpp"
 
-#include <deque>
-
-struct VisualTreeWatcher : winrt::implements<VisualTreeWatcher,
+// Framework is one of the traits in framework.hpp. Both are instantiated in
+// visualtreewatcher.cpp.
+template <typename Framework>
+struct VisualTreeWatcher : winrt::implements<VisualTreeWatcher<Framework>,
                                              IVisualTreeServiceCallback2,
                                              winrt::non_agile> {
     VisualTreeWatcher(winrt::com_ptr<IUnknown> site);
 
-    void Activate();
-
     VisualTreeWatcher(const VisualTreeWatcher&) = delete;
     VisualTreeWatcher& operator=(const VisualTreeWatcher&) = delete;
 
@@ -38,33 +60,305 @@ struct VisualTreeWatcher : winrt::implements<VisualTreeWatcher,
         return obj.as<T>();
     }
 
+    // Advises for tree changes, which replays an Add for every existing
+    // element. Called once, on a thread of its own.
+    void Attach();
+    void QueueSubscription(InstanceHandle handle);
+    void SubscribePending();
+
     void ElementAdded(const ParentChildRelation& parentChildRelation,
                       const VisualElement& element);
     void ElementRemoved(InstanceHandle handle);
 
+    void Subscribe(InstanceHandle handle,
+                   const typename Framework::FrameworkElement& element);
+    // Subscribes to handle if it's a FrameworkElement.
+    void TrySubscribe(InstanceHandle handle);
+    void OnElementEvent(InstanceHandle handle, EventKind kind);
+    // Writer only. Charges the governor and the callback's latency
+    // histogram with the time since start.
+    void ChargeCallback(WatcherCallback callback, int64_t start);
+    void RecordEvent(InstanceHandle handle,
+                     EventKind kind,
+                     int64_t timestamp,
+                     uint32_t partition);
+    void UpdateHashes(InstanceHandle parent,
+                      uint64_t oldTerm,
+                      uint64_t newTerm);
+    // Writer only. Copies the tree into scratch.entries, for Build().
+    void CopyTree(TreeScratch& scratch);
+    void TakeSnapshot(TreeSnapshot& snapshot,
+                      TreeScratch& scratch,
+                      int64_t now);
+    void MaybeTakeBaseline(int64_t now);
+
+    // Why a report is written, for its header.
+    struct ReportReason {
+        // "layoutCycle" or a SnapshotTriggerName().
+        std::string_view trigger;
+        HRESULT hr;
+        // The element or subtree root of a rate trigger, with its path if
+        // it's still in the tree.
+        InstanceHandle element;
+        uint32_t elementPathId;
+        // Of snapshot reports.
+        uint64_t sequence;
+        // The window whose history is reported.
+        uint32_t partition;
+    };
+
+    // Writer only. The partition of a new root element, see Partition.
+    uint32_t AddPartition(InstanceHandle root);
+    // Any thread. Among the partitions of threadId's windows, or of all
+    // windows if it has none, the one with the most recent event.
+    uint32_t FindPartition(DWORD threadId) const;
+
+    // Any thread. The last kHistoryCapacity events of a partition, oldest
+    // first, with the history's folded repeats expanded again.
+    size_t RecentEvents(uint32_t partition, HistoryItem* out);
+
+    // Reads the layout properties of the hottest elements among the recent
+    // events of a partition. A crash report only reads the ones of its own
+    // thread, the subscriptions tell which if elementsLocked. Snapshots
+    // can't read them from the thread pool, they ask each element's UI
+    // thread and wait up to kLayoutTimeoutMilliseconds.
+    size_t CaptureLayoutHere(uint32_t partition,
+                             bool elementsLocked,
+                             LayoutProperties* out);
+    size_t CaptureLayoutOnUiThreads(uint32_t partition, LayoutProperties* out);
+
+    // elementsLocked is whether the writer lock is held. current is a
+    // snapshot taken for the report, only passed if so. start is when the
+    // handler was entered.
+    void WriteCrashReport(HRESULT hr,
+                          bool elementsLocked,
+                          const TreeSnapshot* current,
+                          int64_t start);
+    // Called by m_triggers on a thread pool thread.
+    void WriteSnapshot(SnapshotTrigger trigger, InstanceHandle element);
+    // The tree diff is written if both snapshots are passed. Element names
+    // are only looked up if elementsLocked, the writer lock being held.
+    void WriteReport(JsonLinesWriter& report,
+                     uint64_t* reportedPaths,
+                     const ReportReason& reason,
+                     const LayoutProperties* layout,
+                     size_t layoutCount,
+                     const TreeSnapshot* baseline,
+                     const TreeSnapshot* current,
+                     TreeScratch& scratch,
+                     bool elementsLocked);
+    void WriteTreeDiff(JsonLinesWriter& report,
+                       const TreeSnapshot& baseline,
+                       const TreeSnapshot& current,
+                       TreeScratch& scratch,
+                       bool elementsLocked);
+    template <typename WritePath>
+    void WriteTreeStats(JsonLinesWriter& report, WritePath& writePath);
+    template <typename WritePath>
+    void WriteLifetime(JsonLinesWriter& report, WritePath& writePath);
+    template <typename WritePath>
+    void WriteChurn(JsonLinesWriter& report, WritePath& writePath);
+    void WriteLatency(JsonLinesWriter& report);
+    // out must have been reset to the .folded file.
+    void WriteFlameGraph(JsonLinesWriter& out);
+
     std::wstring FindPathToRoot(InstanceHandle parent);
     std::wstring FindPathToRootImpl(InstanceHandle parent,
                                     unsigned int& numChildren);
 
     winrt::com_ptr<IXamlDiagnostics> m_xamlDiagnostics;
+    const Settings m_settings;
 
-    struct HistoryItem {
-        InstanceHandle handle;
-        std::wstring path;
-    };
+    // Per partition.
+    static constexpr size_t kHistoryCapacity = 200;
+    // Roots past the first kMaxPartitions - 1 share the last partition.
+    static constexpr uint32_t kMaxPartitions = 8;
+
+    // Table sizes reserved for the initial replay.
+    static constexpr size_t kInitialElements = 16 * 1024;
+    // UI thread time SubscribePending() takes at once before yielding.
+    static constexpr int64_t kSubscribeBatchMicroseconds = 4000;
+    static_assert(HistoryArchive::kBlockRecords <= kHistoryCapacity);
+
+    // LayoutCycle.jsonl: one JSON object per line, a header and summary
+    // lines first, then path definitions and events oldest first, then the
+    // tree diff. Bump the schema when a field changes meaning.
+    static constexpr unsigned int kReportSchema = 1;
+    static constexpr size_t kReportCapacity = 1024 * 1024;
+    static constexpr size_t kReportedSubtrees = 16;
+    static constexpr size_t kReportedChurners = 16;
+    static constexpr size_t kReportedChanges = 256;
+    static constexpr size_t kLayoutElements = 16;
+    static constexpr DWORD kLayoutTimeoutMilliseconds = 500;
+    static constexpr size_t kFlameCapacity = 256 * 1024;
+    // LayoutSnapshot-<n>.jsonl files reused round-robin.
+    static constexpr uint64_t kSnapshotFiles = 8;
 
     struct ElementItem {
         InstanceHandle parent;
         std::wstring name;
         unsigned int numChildren;
         unsigned int childIndex;
+        unsigned int depth;
+        // The element whose counter decides sampling in
+        // SamplingScope::kSubtree, the element itself near the root.
+        InstanceHandle samplingRoot;
+        // Path of samplingRoot, for elements at or below subtreeDepth.
+        uint32_t subtreePathId;
+        // Exact counts, kept even for events that weren't sampled.
+        uint32_t eventCount;
+        uint32_t subtreeEventCount;
+        uint32_t typeId;
+        // Tracked children, unlike numChildren which is only what the
+        // element had when it was added.
+        uint32_t childCount;
+        int64_t addedTicks;
+        // LifetimeTracker generation when the element was added.
+        uint32_t generation;
+        // The outermost transient ancestor (or the element itself), if any.
+        InstanceHandle transientRoot;
+        // ElementHash(name), and that plus the terms of tracked children.
+        uint64_t ownHash;
+        uint64_t hash;
+        // FlameGraph node of the element's path.
+        uint32_t flameNode;
+        // Index in m_partitions, the root's.
+        uint32_t partition;
+        // One-second windows for triggerRate, of the element's own events
+        // and, for a subtree root, of its whole subtree.
+        int64_t rateStart;
+        uint32_t rateEvents;
+        int64_t subtreeRateStart;
+        uint32_t subtreeRateEvents;
+    };
+
+    // Elements replayed on one UI thread, subscribed to after the replay in
+    // batches.
+    struct PendingSubscriptions {
+        typename Framework::DispatcherQueue queue{nullptr};
+        std::vector<InstanceHandle> handles;
+        size_t next = 0;
+    };
+
+    // Only the kinds enabled in m_settings are set.
+    struct ElementSubscriptions {
+        using FrameworkElement = typename Framework::FrameworkElement;
+        using ViewportElement = typename Framework::ViewportElement;
+
+        typename FrameworkElement::SizeChanged_revoker sizeChanged;
+        typename ViewportElement::EffectiveViewportChanged_revoker
+            effectiveViewportChanged;
+        typename FrameworkElement::Loaded_revoker loaded;
+        typename FrameworkElement::Unloaded_revoker unloaded;
+        typename FrameworkElement::LayoutUpdated_revoker layoutUpdated;
+        // The element's UI thread, the only one that can read its
+        // properties.
+        DWORD threadId;
     };
 
-    std::shared_mutex m_dlgMainMutex;
-    wux::Application::UnhandledException_revoker m_unhandledException;
-    std::unordered_map<InstanceHandle,
-                       wux::FrameworkElement::SizeChanged_revoker>
-        m_sizeChangedTokens;
+    // The history and counters of one window. A window is the subtree of a
+    // root, an element added without a tracked parent, so that an event
+    // storm in one window doesn't evict the history of the others. Added
+    // when a root appears and kept for the watcher's lifetime, even once the
+    // root is removed: it still holds the window's last events.
+    struct Partition {
+        InstanceHandle root;
+        uint32_t rootPathId;
+        // The UI thread the root was added on.
+        DWORD threadId;
+        SeqlockRing<HistoryItem, kHistoryCapacity> history;
+        HistoryArchive archive;
+        // Writer only, in front of both.
+        HistoryFolder folder;
+        std::atomic<uint64_t> elements{0};
+        std::atomic<uint64_t> eventsSeen{0};
+        std::atomic<uint64_t> eventsRecorded{0};
+        std::atomic<int64_t> lastEventTicks{0};
+    };
+
+    // Threading model: tree and SizeChanged callbacks arrive on the UI
+    // thread of the window they belong to, so with several windows there
+    // are several writers. They serialize on m_writerMutex, which guards the
+    // element tables, as does Attach() around the replay.
+    //
+    // Most of what is read from elsewhere (exporters, stats readers, the
+    // crash report) is published without it: m_partitions is append-only,
+    // their histories are seqlock rings, m_paths, m_stacks and m_flame are
+    // append-only, m_stats, m_treeStats, m_churn and m_lifetime publish
+    // atomics and seqlock cells, and archives have their own lock that
+    // writers take once per sealed block.
+    //
+    // A few paths off the writers take m_writerMutex for the element tables:
+    // - WriteSnapshot(), on the thread pool, blocks on it to copy the tree's
+    //   entries, and builds the snapshot after letting go.
+    // - CaptureLayoutOnUiThreads(), on the thread pool, blocks on it to look
+    //   up the participants' threads and queue a read on each. It waits for
+    //   the reads after letting go, and the reads don't take it.
+    // - TraceWriter's idle timer only tries it, and its destructor takes it
+    //   once to hand the last buffer over.
+    // - The cycle handler only tries it, and not at all if its own thread
+    //   holds it, so it never waits for a writer stuck in a layout cycle.
+    // None of them waits on a UI thread, or takes another lock that a
+    // holder of m_writerMutex waits for, so none can deadlock against a
+    // writer; a writer only waits for them to finish copying.
+    OwnedMutex m_writerMutex;
+    typename Framework::Application::UnhandledException_revoker
+        m_unhandledException;
+    std::unordered_map<InstanceHandle, ElementSubscriptions> m_subscriptions;
+    // Set while AdviseVisualTreeChange replays the existing tree.
+    bool m_ingesting = false;
+    // By thread id.
+    std::unordered_map<DWORD, PendingSubscriptions> m_pendingSubscriptions;
+    // Of the threads elements were subscribed on, by thread id.
+    std::unordered_map<DWORD, typename Framework::DispatcherQueue>
+        m_dispatchers;
     std::unordered_map<InstanceHandle, ElementItem> m_elements;
-    std::deque<HistoryItem> m_history;
+    PathTable m_paths;
+    StackTable m_stacks;
+    // Published by m_partitionCount.
+    std::unique_ptr<Partition> m_partitions[kMaxPartitions];
+    std::atomic<uint32_t> m_partitionCount{0};
+    OverheadGovernor m_governor;
+    WatcherStats m_stats;
+    // Where the launcher finds m_stats.
+    SessionRegistry m_sessions;
+    TreeStats m_treeStats;
+    ChurnStats m_churn;
+    LifetimeTracker m_lifetime;
+    FlameGraph m_flame;
+    // After the members its worker reads stats from, so that the worker is
+    // stopped before they're destroyed.
+    std::optional<TraceWriter> m_trace;
+    // Writer only, like the element tables. Replaced rather than rebuilt,
+    // so that a snapshot report can keep it once the writer lock is gone.
+    std::shared_ptr<const TreeSnapshot> m_baseline;
+    int64_t m_nextBaseline = 0;
+
+    // Crash report state, all of it set up front so that writing the report
+    // doesn't allocate.
+    const int64_t m_startTicks = QueryTicks();
+    const std::wstring m_localFolder;
+    const std::wstring m_packageFullName;
+    const std::string m_osVersion;
+    std::mutex m_reportMutex;
+    std::optional<JsonLinesWriter> m_report;
+    std::optional<JsonLinesWriter> m_flameReport;
+    std::unique_ptr<uint64_t[]> m_reportedPaths;
+    LayoutProperties m_crashLayout[kLayoutElements];
+    // Taken when a cycle is reported if the tree still fits, reserved with
+    // room to grow each time a baseline is taken. Writer only, the baselines
+    // are built in m_crashScratch too.
+    TreeSnapshot m_crashSnapshot;
+    TreeScratch m_crashScratch;
+
+    // Snapshot reports have their own writer, a crash while one is being
+    // written doesn't wait for it.
+    std::mutex m_snapshotMutex;
+    std::optional<JsonLinesWriter> m_snapshotReport;
+    std::unique_ptr<uint64_t[]> m_snapshotPaths;
+    uint64_t m_snapshots = 0;
+
+    // Last, so that it's destroyed first: its callbacks use everything
+    // above.
+    SnapshotTriggers m_triggers;
 };
@@ -2,7 +2,9 @@
 
 // forward declare namespaces we alias
 namespace winrt {
-    namespace Microsoft::UI::Xaml::Controls {}
+    namespace Microsoft::UI::Xaml {
+        namespace Controls {}
+    }
     namespace Windows {
         namespace Foundation::Collections {}
         namespace UI::Xaml {
@@ -182,8 +182,9 @@ void CMainDlg::InitProcessList() {
         int width;
         WORD sort;
     } columns[] = {
-        {L"Process name", -60, LVCOLSORT_TEXT},
+        {L"Process name", -180, LVCOLSORT_TEXT},
         {L"PID", 60, LVCOLSORT_DECIMAL},
+        {L"Session", 120, LVCOLSORT_TEXT},
     };
 
     for (int i = 0; i < ARRAYSIZE(columns); i++) {
@@ -214,6 +215,10 @@ void CMainDlg::LoadProcessList() {
 
     int itemIndex = 0;
 
+    // Processes already being inspected, with how far along they are.
+    std::vector<session::Info> sessions;
+    ProcessSpyQuerySessions(m_hWnd, sessions);
+
     HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
     if (snapshot != INVALID_HANDLE_VALUE) {
         PROCESSENTRY32 entry{
@@ -231,6 +236,21 @@ void CMainDlg::LoadProcessList() {
                 m_processListSort.AddItem(itemIndex, 0, entry.szExeFile);
                 m_processListSort.AddItem(itemIndex, 1, szPid);
                 m_processListSort.SetItemData(itemIndex, entry.th32ProcessID);
+
+                for (const auto& info : sessions) {
+                    if (info.pid != entry.th32ProcessID) {
+                        continue;
+                    }
+
+                    const PCWSTR framework =
+                        info.framework == session::kFrameworkWinUI ? L"WinUI 3"
+                                                                   : L"UWP";
+                    const std::wstring text = std::format(
+                        L"{}, {} events", framework, info.eventsSeen);
+                    m_processListSort.AddItem(itemIndex, 2, text.c_str());
+                    break;
+                }
+
                 itemIndex++;
             } while (Process32Next(snapshot, &entry));
         }
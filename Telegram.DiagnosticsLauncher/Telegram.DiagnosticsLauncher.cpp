@@ -1,6 +1,7 @@
 #include "stdafx.h"
 
 #include "MainDlg.h"
+#include "collector.h"
 #include "process_spy.h"
 
 CAppModule _Module;
@@ -20,18 +21,72 @@ int WINAPI wWinMain(_In_ HINSTANCE hInstance,
 
     int nRet = 0;
 
+    // Usage: Telegram.DiagnosticsLauncher.exe [pid [uwp|winui [options]]]
+    //        Telegram.DiagnosticsLauncher.exe pid trace off|error|info|verbose
+    //        Telegram.DiagnosticsLauncher.exe pid snapshot
+    //        Telegram.DiagnosticsLauncher.exe sessions
+    //        Telegram.DiagnosticsLauncher.exe pid collect folder [uwp|winui
+    //                                         [options]]
     DWORD pid = 0;
     ProcessSpyFramework framework = kFrameworkUWP;
+    PCWSTR options = nullptr;
+    if (__argc >= 2 && _wcsicmp(__wargv[1], L"sessions") == 0) {
+        ProcessSpySetHeadless(true);
+        nRet = ProcessSpyListSessions(nullptr) ? 0 : 1;
+
+        _Module.Term();
+        ::CoUninitialize();
+
+        return nRet;
+    }
+
     if (__argc >= 2) {
         pid = wcstoul(__wargv[1], nullptr, 0);
 
+        if (pid && __argc >= 4 && _wcsicmp(__wargv[2], L"trace") == 0) {
+            nRet = ProcessSpySetTraceLevel(nullptr, pid, __wargv[3]) ? 0 : 1;
+
+            _Module.Term();
+            ::CoUninitialize();
+
+            return nRet;
+        }
+
+        if (pid && __argc >= 3 && _wcsicmp(__wargv[2], L"snapshot") == 0) {
+            nRet = ProcessSpyRequestSnapshot(nullptr, pid) ? 0 : 1;
+
+            _Module.Term();
+            ::CoUninitialize();
+
+            return nRet;
+        }
+
+        if (pid && __argc >= 4 && _wcsicmp(__wargv[2], L"collect") == 0) {
+            if (__argc >= 5 && _wcsicmp(__wargv[4], L"winui") == 0) {
+                framework = kFrameworkWinUI;
+            }
+
+            nRet = RunCollector(pid, framework,
+                                __argc >= 6 ? __wargv[5] : nullptr,
+                                __wargv[3]);
+
+            _Module.Term();
+            ::CoUninitialize();
+
+            return nRet;
+        }
+
         if (__argc >= 3 && _wcsicmp(__wargv[2], L"winui") == 0) {
             framework = kFrameworkWinUI;
         }
+
+        if (__argc >= 4) {
+            options = __wargv[3];
+        }
     }
 
     if (pid) {
-        ProcessSpy(nullptr, pid, framework);
+        ProcessSpy(nullptr, pid, framework, options);
     } else {
         CMainDlg dlgMain;
         nRet = (int)dlgMain.DoModal();
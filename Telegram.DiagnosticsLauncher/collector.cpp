@@ -0,0 +1,641 @@
+#include "stdafx.h"
+
+#include "collector.h"
+
+#include "../common/lz.h"
+#include "../common/traceformat.h"
+
+namespace {
+
+constexpr DWORD kPollMilliseconds = 500;
+// Trace files are looked up by index until one is missing.
+constexpr unsigned int kMaxTraceFiles = 1024;
+constexpr DWORD kReadBytes = 1024 * 1024;
+// Raw bytes per compressed block, and how long a partial block may wait
+// before it's written anyway.
+constexpr size_t kBlockBytes = 256 * 1024;
+constexpr ULONGLONG kBlockMilliseconds = 5000;
+constexpr uint64_t kOutputFileBytes = 64 * 1024 * 1024;
+constexpr unsigned int kOutputFiles = 16;
+// Longer paths can only be garbage.
+constexpr uint32_t kMaxPathLength = 64 * 1024;
+
+constexpr const char* kEventKindNames[trace::kEventKindCount] = {
+    "SizeChanged", "EffectiveViewportChanged", "Loaded", "Unloaded",
+    "LayoutUpdated"};
+
+constexpr DWORD kShareAll =
+    FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+
+HANDLE g_stop = nullptr;
+
+BOOL WINAPI OnConsoleCtrl(DWORD) {
+    SetEvent(g_stop);
+    return TRUE;
+}
+
+// Where the watcher writes its files, see QueryLocalFolder in
+// Telegram.Diagnostics.
+std::wstring QueryTraceFolder(HANDLE process) {
+    WCHAR family[PACKAGE_FAMILY_NAME_MAX_LENGTH + 1];
+    UINT32 length = ARRAYSIZE(family);
+    PWSTR localAppData = nullptr;
+    if (GetPackageFamilyName(process, &length, family) == ERROR_SUCCESS &&
+        SUCCEEDED(SHGetKnownFolderPath(FOLDERID_LocalAppData, 0, nullptr,
+                                       &localAppData))) {
+        std::wstring folder =
+            std::format(L"{}\\Packages\\{}\\LocalState", localAppData, family);
+        CoTaskMemFree(localAppData);
+        return folder;
+    }
+
+    // Unpackaged, the target runs as the same user and shares the temp
+    // folder.
+    WCHAR path[MAX_PATH + 1];
+    const DWORD pathLength = GetTempPath(ARRAYSIZE(path), path);
+    if (pathLength == 0 || pathLength > ARRAYSIZE(path)) {
+        return L".";
+    }
+
+    return std::wstring(path, pathLength - 1);
+}
+
+DWORD ReadAt(HANDLE file, uint64_t offset, void* buffer, DWORD size) {
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    DWORD read = 0;
+    if (!ReadFile(file, buffer, size, &read, &overlapped)) {
+        return 0;
+    }
+
+    return read;
+}
+
+void Write(HANDLE file, const void* data, size_t size) {
+    DWORD written;
+    WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr);
+}
+
+// Reads the trace files of one target in sequence order and re-packs their
+// records into compressed files. Paths are kept for the whole session, the
+// watcher's path ids don't change between files.
+class Collector {
+   public:
+    Collector(DWORD pid, std::wstring traceFolder, std::wstring outputFolder);
+    ~Collector();
+
+    Collector(const Collector&) = delete;
+    Collector& operator=(const Collector&) = delete;
+
+    // Reads what the watcher wrote since the last call.
+    void Poll();
+
+    // Writes out what's left and the summary.
+    void Finish(bool targetExited, DWORD exitCode);
+
+   private:
+    bool FindTraceFile(uint64_t minSequence,
+                       trace::FileHeader& found,
+                       std::wstring& foundName) const;
+    bool OpenTraceFile();
+    void CloseTraceFile();
+    void ReadTraceFile();
+    void ParseInput();
+    void OnEvent(const trace::EventRecord& event);
+
+    void BeginRecord();
+    void AppendOutput(const void* data, size_t size);
+    void FlushBlock();
+    void OpenOutputFile();
+
+    bool CopyCycleReport() const;
+    void WriteSummary(bool targetExited,
+                      DWORD exitCode,
+                      bool cycleReport) const;
+
+    const DWORD m_pid;
+    const std::wstring m_traceFolder;
+    const std::wstring m_outputFolder;
+    FILETIME m_startTime;
+
+    // Input.
+    HANDLE m_traceFile = INVALID_HANDLE_VALUE;
+    uint64_t m_traceSequence = 0;
+    uint64_t m_traceOffset = 0;
+    bool m_traceCorrupt = false;
+    int64_t m_ticksPerSecond = 0;
+    std::vector<uint8_t> m_input;
+    std::vector<std::wstring> m_paths;
+
+    // Output.
+    HANDLE m_outputFile = INVALID_HANDLE_VALUE;
+    uint64_t m_outputSequence = 0;
+    uint64_t m_outputBytes = 0;
+    std::vector<bool> m_definedPaths;
+    std::vector<uint8_t> m_block;
+    ULONGLONG m_blockSince = 0;
+    std::vector<uint8_t> m_compressed;
+
+    // Summary.
+    uint64_t m_events[trace::kEventKindCount]{};
+    uint64_t m_traceFiles = 0;
+    uint64_t m_lostFiles = 0;
+    uint64_t m_corruptBytes = 0;
+    uint64_t m_rawBytes = 0;
+    uint64_t m_compressedBytes = 0;
+    int64_t m_firstTimestamp = 0;
+    int64_t m_lastTimestamp = 0;
+    trace::StatsRecord m_lastStats{};
+};
+
+Collector::Collector(DWORD pid,
+                     std::wstring traceFolder,
+                     std::wstring outputFolder)
+    : m_pid(pid),
+      m_traceFolder(std::move(traceFolder)),
+      m_outputFolder(std::move(outputFolder)) {
+    GetSystemTimeAsFileTime(&m_startTime);
+}
+
+Collector::~Collector() {
+    CloseTraceFile();
+
+    if (m_outputFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_outputFile);
+    }
+}
+
+void Collector::Poll() {
+    while (m_traceFile != INVALID_HANDLE_VALUE || OpenTraceFile()) {
+        // The watcher truncates the files it reuses.
+        trace::FileHeader header;
+        if (ReadAt(m_traceFile, 0, &header, sizeof(header)) !=
+                sizeof(header) ||
+            header.sequence != m_traceSequence) {
+            m_lostFiles++;
+            CloseTraceFile();
+            m_traceSequence++;
+            continue;
+        }
+
+        // The watcher only starts the next file after its last write to this
+        // one, so once that exists, what's left here is all there is.
+        trace::FileHeader next;
+        std::wstring nextName;
+        const bool complete =
+            FindTraceFile(m_traceSequence + 1, next, nextName);
+
+        ReadTraceFile();
+        if (!complete) {
+            break;
+        }
+
+        CloseTraceFile();
+        m_traceSequence++;
+    }
+
+    if (!m_block.empty() &&
+        GetTickCount64() - m_blockSince >= kBlockMilliseconds) {
+        FlushBlock();
+    }
+}
+
+void Collector::Finish(bool targetExited, DWORD exitCode) {
+    CloseTraceFile();
+    FlushBlock();
+
+    if (m_outputFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_outputFile);
+        m_outputFile = INVALID_HANDLE_VALUE;
+    }
+
+    WriteSummary(targetExited, exitCode, CopyCycleReport());
+}
+
+bool Collector::FindTraceFile(uint64_t minSequence,
+                              trace::FileHeader& found,
+                              std::wstring& foundName) const {
+    bool any = false;
+
+    for (unsigned int i = 0; i < kMaxTraceFiles; i++) {
+        auto name = std::format(L"{}\\LayoutTrace-{}.bin", m_traceFolder, i);
+        HANDLE file = CreateFile(name.c_str(), GENERIC_READ, kShareAll,
+                                 nullptr, OPEN_EXISTING, 0, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            if (GetLastError() == ERROR_FILE_NOT_FOUND) {
+                break;
+            }
+
+            continue;
+        }
+
+        // Files of earlier sessions can still be around.
+        trace::FileHeader header;
+        const bool valid =
+            ReadAt(file, 0, &header, sizeof(header)) == sizeof(header) &&
+            header.magic == trace::kMagic &&
+            header.version == trace::kVersion && header.pid == m_pid &&
+            header.sequence >= minSequence;
+        CloseHandle(file);
+
+        if (valid && (!any || header.sequence < found.sequence)) {
+            found = header;
+            foundName = std::move(name);
+            any = true;
+        }
+    }
+
+    return any;
+}
+
+bool Collector::OpenTraceFile() {
+    trace::FileHeader header;
+    std::wstring name;
+    if (!FindTraceFile(m_traceSequence, header, name)) {
+        return false;
+    }
+
+    m_traceFile =
+        CreateFile(name.c_str(), GENERIC_READ, kShareAll, nullptr,
+                   OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (m_traceFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    // Files the watcher reused before they were read. The first file can
+    // be late if the watcher was already tracing.
+    if (m_traceFiles) {
+        m_lostFiles += header.sequence - m_traceSequence;
+    }
+
+    m_traceFiles++;
+    m_traceSequence = header.sequence;
+    m_traceOffset = sizeof(header);
+    m_traceCorrupt = false;
+    m_ticksPerSecond = header.ticksPerSecond;
+    return true;
+}
+
+void Collector::CloseTraceFile() {
+    if (m_traceFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    CloseHandle(m_traceFile);
+    m_traceFile = INVALID_HANDLE_VALUE;
+
+    // A record cut short by the end of a finished file.
+    m_corruptBytes += m_input.size();
+    m_input.clear();
+}
+
+void Collector::ReadTraceFile() {
+    for (;;) {
+        const size_t size = m_input.size();
+        m_input.resize(size + kReadBytes);
+
+        const DWORD read = ReadAt(m_traceFile, m_traceOffset,
+                                  m_input.data() + size, kReadBytes);
+        m_input.resize(size + read);
+        m_traceOffset += read;
+
+        if (m_traceCorrupt) {
+            m_corruptBytes += m_input.size();
+            m_input.clear();
+        } else {
+            ParseInput();
+        }
+
+        if (read < kReadBytes) {
+            break;
+        }
+    }
+}
+
+void Collector::ParseInput() {
+    size_t offset = 0;
+
+    while (offset < m_input.size()) {
+        const uint8_t* record = m_input.data() + offset;
+        const size_t available = m_input.size() - offset;
+
+        size_t size = 0;
+        trace::PathRecord path{};
+        switch (static_cast<trace::RecordType>(record[0])) {
+            case trace::RecordType::kEvent:
+                size = sizeof(trace::EventRecord);
+                break;
+
+            case trace::RecordType::kPath:
+                size = sizeof(path);
+                if (available >= size) {
+                    memcpy(&path, record, sizeof(path));
+                    size += size_t{path.length} * sizeof(wchar_t);
+                }
+                break;
+
+            case trace::RecordType::kStats:
+                size = sizeof(trace::StatsRecord);
+                break;
+        }
+
+        if (size == 0 || path.length > kMaxPathLength) {
+            // Records can't be told apart from here on, skip the rest of
+            // the file.
+            m_traceCorrupt = true;
+            m_corruptBytes += available;
+            offset = m_input.size();
+            break;
+        }
+
+        if (available < size) {
+            // Still being written.
+            break;
+        }
+
+        switch (static_cast<trace::RecordType>(record[0])) {
+            case trace::RecordType::kEvent: {
+                trace::EventRecord event;
+                memcpy(&event, record, sizeof(event));
+                OnEvent(event);
+                break;
+            }
+
+            case trace::RecordType::kPath:
+                if (path.pathId >= m_paths.size()) {
+                    m_paths.resize(path.pathId + 1);
+                }
+
+                m_paths[path.pathId].assign(
+                    reinterpret_cast<const wchar_t*>(record + sizeof(path)),
+                    path.length);
+                break;
+
+            case trace::RecordType::kStats:
+                memcpy(&m_lastStats, record, sizeof(m_lastStats));
+                BeginRecord();
+                AppendOutput(record, size);
+                break;
+        }
+
+        offset += size;
+    }
+
+    m_input.erase(m_input.begin(), m_input.begin() + offset);
+}
+
+void Collector::OnEvent(const trace::EventRecord& event) {
+    if (static_cast<size_t>(event.kind) < trace::kEventKindCount) {
+        m_events[static_cast<size_t>(event.kind)]++;
+    }
+
+    if (!m_firstTimestamp) {
+        m_firstTimestamp = event.timestamp;
+    }
+    m_lastTimestamp = event.timestamp;
+
+    BeginRecord();
+
+    // Paths are defined once per output file, right before their first use,
+    // as in the watcher's files.
+    if (event.pathId < m_paths.size() && !m_paths[event.pathId].empty()) {
+        if (event.pathId >= m_definedPaths.size()) {
+            m_definedPaths.resize(m_paths.size());
+        }
+
+        if (!m_definedPaths[event.pathId]) {
+            m_definedPaths[event.pathId] = true;
+
+            const std::wstring& path = m_paths[event.pathId];
+            const trace::PathRecord record{
+                .type = trace::RecordType::kPath,
+                .pathId = event.pathId,
+                .length = static_cast<uint32_t>(path.size())};
+            AppendOutput(&record, sizeof(record));
+            AppendOutput(path.data(), path.size() * sizeof(wchar_t));
+        }
+    }
+
+    AppendOutput(&event, sizeof(event));
+}
+
+void Collector::BeginRecord() {
+    if (m_outputFile == INVALID_HANDLE_VALUE ||
+        m_outputBytes >= kOutputFileBytes) {
+        FlushBlock();
+        OpenOutputFile();
+    }
+}
+
+void Collector::AppendOutput(const void* data, size_t size) {
+    if (m_block.empty()) {
+        m_blockSince = GetTickCount64();
+    }
+
+    const auto bytes = static_cast<const uint8_t*>(data);
+    m_block.insert(m_block.end(), bytes, bytes + size);
+
+    if (m_block.size() >= kBlockBytes) {
+        FlushBlock();
+    }
+}
+
+void Collector::FlushBlock() {
+    if (m_block.empty() || m_outputFile == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    m_compressed.resize(lz::CompressBound(m_block.size()));
+    const size_t size = lz::Compress(m_block.data(), m_block.size(),
+                                     m_compressed.data(), m_compressed.size());
+
+    const trace::BlockHeader header{
+        .compressedSize = static_cast<uint32_t>(size),
+        .rawSize = static_cast<uint32_t>(m_block.size())};
+    Write(m_outputFile, &header, sizeof(header));
+    Write(m_outputFile, m_compressed.data(), size);
+
+    m_outputBytes += sizeof(header) + size;
+    m_rawBytes += m_block.size();
+    m_compressedBytes += size;
+    m_block.clear();
+}
+
+void Collector::OpenOutputFile() {
+    if (m_outputFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(m_outputFile);
+    }
+
+    const auto fileName =
+        std::format(L"{}\\CollectorTrace-{}.lzt", m_outputFolder,
+                    m_outputSequence % kOutputFiles);
+
+    m_outputFile =
+        CreateFile(fileName.c_str(), GENERIC_WRITE,
+                   FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, CREATE_ALWAYS,
+                   FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    m_definedPaths.clear();
+
+    const trace::FileHeader header{
+        .magic = trace::kCollectorMagic,
+        .version = trace::kVersion,
+        .sequence = m_outputSequence++,
+        .pid = m_pid,
+        .reserved = 0,
+        .ticksPerSecond = m_ticksPerSecond,
+    };
+
+    if (m_outputFile != INVALID_HANDLE_VALUE) {
+        Write(m_outputFile, &header, sizeof(header));
+    }
+
+    m_outputBytes = sizeof(header);
+}
+
+bool Collector::CopyCycleReport() const {
+    const auto source = m_traceFolder + L"\\LayoutCycle.jsonl";
+
+    // Only a report of this session.
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesEx(source.c_str(), GetFileExInfoStandard, &data) ||
+        CompareFileTime(&data.ftLastWriteTime, &m_startTime) < 0) {
+        return false;
+    }
+
+    const auto target = m_outputFolder + L"\\LayoutCycle.jsonl";
+    return CopyFile(source.c_str(), target.c_str(), FALSE);
+}
+
+void Collector::WriteSummary(bool targetExited,
+                             DWORD exitCode,
+                             bool cycleReport) const {
+    uint64_t events = 0;
+    std::string kinds;
+    std::wstring kindsText;
+    for (size_t i = 0; i < trace::kEventKindCount; i++) {
+        events += m_events[i];
+        if (!m_events[i]) {
+            continue;
+        }
+
+        kinds += std::format("{}\"{}\":{}", kinds.empty() ? "" : ",",
+                             kEventKindNames[i], m_events[i]);
+        kindsText += std::format(L", {} {}", m_events[i],
+                                 CA2W(kEventKindNames[i]).m_psz);
+    }
+
+    const uint64_t durationUs =
+        m_ticksPerSecond ? (m_lastTimestamp - m_firstTimestamp) * 1000000 /
+                               m_ticksPerSecond
+                         : 0;
+
+    const std::string json = std::format(
+        "{{\"targetExited\":{},\"exitCode\":{},\"durationUs\":{},"
+        "\"events\":{},\"eventKinds\":{{{}}},\"traceFiles\":{},"
+        "\"lostFiles\":{},\"corruptBytes\":{},\"outputFiles\":{},"
+        "\"rawBytes\":{},\"compressedBytes\":{},\"eventsSeen\":{},"
+        "\"eventsRecorded\":{},\"droppedRecords\":{},"
+        "\"samplingInterval\":{},\"overheadUs\":{},\"elements\":{},"
+        "\"layoutCycleReport\":{}}}\n",
+        targetExited, exitCode, durationUs, events, kinds, m_traceFiles,
+        m_lostFiles, m_corruptBytes, m_outputSequence, m_rawBytes,
+        m_compressedBytes, uint64_t{m_lastStats.eventsSeen},
+        uint64_t{m_lastStats.eventsRecorded},
+        uint64_t{m_lastStats.droppedRecords},
+        uint32_t{m_lastStats.samplingInterval},
+        uint32_t{m_lastStats.overheadUs}, uint32_t{m_lastStats.elements},
+        cycleReport);
+
+    const auto fileName = m_outputFolder + L"\\CollectorSummary.json";
+    HANDLE file = CreateFile(fileName.c_str(), GENERIC_WRITE, FILE_SHARE_READ,
+                             nullptr, CREATE_ALWAYS, 0, nullptr);
+    if (file != INVALID_HANDLE_VALUE) {
+        Write(file, json.data(), json.size());
+        CloseHandle(file);
+    }
+
+    PrintToConsole(targetExited
+                       ? std::format(L"Target exited with 0x{:08X}", exitCode)
+                       : std::wstring(L"Stopped"));
+    PrintToConsole(std::format(L"{} events over {}.{:03} s{}", events,
+                               durationUs / 1000000,
+                               durationUs / 1000 % 1000, kindsText));
+    PrintToConsole(std::format(
+        L"{} trace files read, {} lost, {} KB compressed to {} KB in {} files",
+        m_traceFiles, m_lostFiles, m_rawBytes / 1024, m_compressedBytes / 1024,
+        m_outputSequence));
+    if (m_lastStats.droppedRecords) {
+        PrintToConsole(std::format(L"The watcher dropped {} records",
+                                   uint64_t{m_lastStats.droppedRecords}));
+    }
+    if (cycleReport) {
+        PrintToConsole(L"Layout cycle report copied");
+    }
+}
+
+}  // namespace
+
+int RunCollector(DWORD pid,
+                 ProcessSpyFramework framework,
+                 PCWSTR options,
+                 PCWSTR outputFolder) {
+    ProcessSpySetHeadless(true);
+
+    HANDLE process = OpenProcess(
+        SYNCHRONIZE | PROCESS_QUERY_LIMITED_INFORMATION, FALSE, pid);
+    if (!process) {
+        PrintToConsole(std::format(L"Error: failed to open process {}", pid));
+        return 1;
+    }
+
+    if (!CreateDirectory(outputFolder, nullptr) &&
+        GetLastError() != ERROR_ALREADY_EXISTS) {
+        PrintToConsole(
+            std::format(L"Error: failed to create {}", outputFolder));
+        CloseHandle(process);
+        return 1;
+    }
+
+    // Later options win, so this one can't be turned off.
+    std::wstring collectOptions = options ? options : L"";
+    collectOptions += L";rollingTrace=1";
+
+    Collector collector(pid, QueryTraceFolder(process), outputFolder);
+    if (!ProcessSpy(nullptr, pid, framework, collectOptions.c_str())) {
+        CloseHandle(process);
+        return 1;
+    }
+
+    PrintToConsole(std::format(L"Collecting from {} into {}", pid,
+                               outputFolder));
+
+    g_stop = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    SetConsoleCtrlHandler(OnConsoleCtrl, TRUE);
+
+    const HANDLE handles[] = {process, g_stop};
+    DWORD wait;
+    do {
+        collector.Poll();
+        wait = WaitForMultipleObjects(ARRAYSIZE(handles), handles, FALSE,
+                                      kPollMilliseconds);
+    } while (wait == WAIT_TIMEOUT);
+
+    // Whatever the watcher wrote before the target went away.
+    collector.Poll();
+
+    const bool targetExited = wait == WAIT_OBJECT_0;
+    DWORD exitCode = 0;
+    if (targetExited) {
+        GetExitCodeProcess(process, &exitCode);
+    }
+
+    collector.Finish(targetExited, exitCode);
+
+    SetConsoleCtrlHandler(OnConsoleCtrl, FALSE);
+    CloseHandle(g_stop);
+    CloseHandle(process);
+
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "process_spy.h"
+
+// Headless collection for unattended runs. Attaches to pid with the rolling
+// trace enabled, tails the trace files as the watcher writes them, and
+// re-packs their records into compressed rolling files in outputFolder
+// (format in common/traceformat.h). Returns once the target exits or on
+// Ctrl+C, after writing CollectorSummary.json next to them. Messages go to
+// the console, see ProcessSpySetHeadless.
+int RunCollector(DWORD pid,
+                 ProcessSpyFramework framework,
+                 PCWSTR options,
+                 PCWSTR outputFolder);
@@ -4,6 +4,42 @@
 
 namespace {
 
+bool g_headless = false;
+
+int ShowMessage(HWND hWnd, PCWSTR text, PCWSTR caption, UINT type) {
+    if (!g_headless) {
+        return MessageBox(hWnd, text, caption, type);
+    }
+
+    PrintToConsole(std::format(L"{}: {}", caption, text));
+    return (type & MB_TYPEMASK) == MB_YESNO ? IDYES : IDOK;
+}
+
+// For the exports that talk to a running watcher.
+HMODULE LoadDiagnosticsLibrary(HWND hWnd) {
+    WCHAR path[MAX_PATH];
+    switch (GetModuleFileName(nullptr, path, ARRAYSIZE(path))) {
+        case 0:
+        case ARRAYSIZE(path):
+            ShowMessage(hWnd, L"Failed to get module path", L"Error",
+                        MB_ICONERROR);
+            return nullptr;
+    }
+
+    PWSTR filename = PathFindFileName(path);
+
+    wcscpy_s(filename, ARRAYSIZE(path) - (filename - path),
+             L"Telegram.Diagnostics.dll");
+
+    HMODULE lib = LoadLibrary(path);
+    if (!lib) {
+        ShowMessage(hWnd, L"Failed to load Telegram.Diagnostics.dll", L"Error",
+                    MB_ICONERROR);
+    }
+
+    return lib;
+}
+
 bool AllowAppContainerAccess(PCWSTR path) {
     PSECURITY_DESCRIPTOR sd = nullptr;
     ULONG sd_length = 0;
@@ -33,13 +69,16 @@ bool AllowAppContainerAccess(PCWSTR path) {
 
 }  // namespace
 
-bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework) {
+bool ProcessSpy(HWND hWnd,
+                DWORD pid,
+                ProcessSpyFramework framework,
+                PCWSTR options) {
     WCHAR path[MAX_PATH];
     switch (GetModuleFileName(nullptr, path, ARRAYSIZE(path))) {
         case 0:
         case ARRAYSIZE(path):
-            MessageBox(hWnd, L"Failed to get module path", L"Error",
-                       MB_ICONERROR);
+            ShowMessage(hWnd, L"Failed to get module path", L"Error",
+                        MB_ICONERROR);
             return false;
     }
 
@@ -48,7 +87,7 @@ bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework) {
     wcscpy_s(filename, ARRAYSIZE(path) - (filename - path), L"Telegram.Diagnostics.dll");
 
     if (GetFileAttributes(path) == INVALID_FILE_ATTRIBUTES) {
-        MessageBox(hWnd, L"Telegram.Diagnostics.dll is missing", L"Error", MB_ICONERROR);
+        ShowMessage(hWnd, L"Telegram.Diagnostics.dll is missing", L"Error", MB_ICONERROR);
         return false;
     }
 
@@ -63,15 +102,15 @@ bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework) {
             L"there.\n"
             L"\n"
             L"Proceed anyway?";
-        if (MessageBox(hWnd, warningMsg, L"Warning",
-                       MB_ICONWARNING | MB_YESNO) == IDNO) {
+        if (ShowMessage(hWnd, warningMsg, L"Warning",
+                        MB_ICONWARNING | MB_YESNO) == IDNO) {
             return false;
         }
     }
 
     HMODULE lib = LoadLibrary(path);
     if (!lib) {
-        MessageBox(hWnd, L"Failed to load Telegram.Diagnostics.dll", L"Error", MB_ICONERROR);
+        ShowMessage(hWnd, L"Failed to load Telegram.Diagnostics.dll", L"Error", MB_ICONERROR);
         return false;
     }
 
@@ -85,22 +124,24 @@ bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework) {
             L"inspection session, relaunch the target application.\n"
             L"\n"
             L"Resume the existing inspection session?";
-        if (MessageBox(hWnd, warningMsg, L"Warning",
-                       MB_ICONWARNING | MB_YESNO) == IDNO) {
+        if (ShowMessage(hWnd, warningMsg, L"Warning",
+                        MB_ICONWARNING | MB_YESNO) == IDNO) {
             return false;
         }
     }
 
-    using start_proc_t = HRESULT(WINAPI*)(DWORD pid, DWORD framework);
+    using startWithOptions_proc_t =
+        HRESULT(WINAPI*)(DWORD pid, DWORD framework, PCWSTR options);
 
-    start_proc_t start = (start_proc_t)GetProcAddress(lib, "start");
-    if (!start) {
-        MessageBox(hWnd, L"Failed to find spy function", L"Error",
-                   MB_ICONERROR);
+    startWithOptions_proc_t startWithOptions =
+        (startWithOptions_proc_t)GetProcAddress(lib, "startWithOptions");
+    if (!startWithOptions) {
+        ShowMessage(hWnd, L"Failed to find spy function", L"Error",
+                    MB_ICONERROR);
         return false;
     }
 
-    HRESULT hr = start(pid, framework);
+    HRESULT hr = startWithOptions(pid, framework, options);
     if (FAILED(hr)) {
         CString message =
             L"Failed to start spying:\n" + AtlGetErrorDescription(hr);
@@ -124,9 +165,193 @@ bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework) {
                 break;
         }
 
-        MessageBox(hWnd, message, L"Error", MB_ICONERROR);
+        ShowMessage(hWnd, message, L"Error", MB_ICONERROR);
+        return false;
+    }
+
+    return true;
+}
+
+bool ProcessSpySetTraceLevel(HWND hWnd, DWORD pid, PCWSTR level) {
+    static constexpr PCWSTR kLevels[] = {L"off", L"error", L"info",
+                                         L"verbose"};
+
+    DWORD levelIndex = 0;
+    while (levelIndex < ARRAYSIZE(kLevels) &&
+           _wcsicmp(level, kLevels[levelIndex]) != 0) {
+        levelIndex++;
+    }
+
+    if (levelIndex == ARRAYSIZE(kLevels)) {
+        ShowMessage(hWnd, L"Unknown trace level", L"Error", MB_ICONERROR);
+        return false;
+    }
+
+    HMODULE lib = LoadDiagnosticsLibrary(hWnd);
+    if (!lib) {
+        return false;
+    }
+
+    using setTraceLevel_proc_t = HRESULT(WINAPI*)(DWORD pid, DWORD level);
+
+    setTraceLevel_proc_t setTraceLevel =
+        (setTraceLevel_proc_t)GetProcAddress(lib, "setTraceLevel");
+    if (!setTraceLevel) {
+        ShowMessage(hWnd, L"Failed to find trace function", L"Error",
+                    MB_ICONERROR);
+        return false;
+    }
+
+    HRESULT hr = setTraceLevel(pid, levelIndex);
+    if (FAILED(hr)) {
+        CString message =
+            L"Failed to set the trace level:\n" + AtlGetErrorDescription(hr);
+        if (hr == HRESULT_FROM_WIN32(ERROR_MOD_NOT_FOUND)) {
+            message += L"\n\nThe target process isn't being inspected.";
+        }
+
+        ShowMessage(hWnd, message, L"Error", MB_ICONERROR);
         return false;
     }
 
     return true;
 }
+
+bool ProcessSpyRequestSnapshot(HWND hWnd, DWORD pid) {
+    HMODULE lib = LoadDiagnosticsLibrary(hWnd);
+    if (!lib) {
+        return false;
+    }
+
+    using requestSnapshot_proc_t = HRESULT(WINAPI*)(DWORD pid);
+
+    requestSnapshot_proc_t requestSnapshot =
+        (requestSnapshot_proc_t)GetProcAddress(lib, "requestSnapshot");
+    if (!requestSnapshot) {
+        ShowMessage(hWnd, L"Failed to find snapshot function", L"Error",
+                    MB_ICONERROR);
+        return false;
+    }
+
+    HRESULT hr = requestSnapshot(pid);
+    if (FAILED(hr)) {
+        CString message =
+            L"Failed to request a snapshot:\n" + AtlGetErrorDescription(hr);
+        if (hr == HRESULT_FROM_WIN32(ERROR_MOD_NOT_FOUND)) {
+            message += L"\n\nThe target process isn't being inspected.";
+        }
+
+        ShowMessage(hWnd, message, L"Error", MB_ICONERROR);
+        return false;
+    }
+
+    return true;
+}
+
+bool ProcessSpyQuerySessions(HWND hWnd, std::vector<session::Info>& sessions) {
+    HMODULE lib = LoadDiagnosticsLibrary(hWnd);
+    if (!lib) {
+        return false;
+    }
+
+    using querySessions_proc_t =
+        HRESULT(WINAPI*)(session::Info* sessions, DWORD capacity,
+                         DWORD* count);
+
+    querySessions_proc_t querySessions =
+        (querySessions_proc_t)GetProcAddress(lib, "querySessions");
+    if (!querySessions) {
+        ShowMessage(hWnd, L"Failed to find session function", L"Error",
+                    MB_ICONERROR);
+        return false;
+    }
+
+    sessions.resize(session::kMaxSessions);
+
+    DWORD count;
+    HRESULT hr = querySessions(sessions.data(),
+                               static_cast<DWORD>(sessions.size()), &count);
+    if (FAILED(hr)) {
+        sessions.clear();
+
+        CString message =
+            L"Failed to query sessions:\n" + AtlGetErrorDescription(hr);
+        ShowMessage(hWnd, message, L"Error", MB_ICONERROR);
+        return false;
+    }
+
+    // More may have registered than fit.
+    if (count < sessions.size()) {
+        sessions.resize(count);
+    }
+
+    return true;
+}
+
+bool ProcessSpyListSessions(HWND hWnd) {
+    std::vector<session::Info> sessions;
+    if (!ProcessSpyQuerySessions(hWnd, sessions)) {
+        return false;
+    }
+
+    PrintToConsole(std::format(L"{} sessions", sessions.size()));
+
+    for (const auto& info : sessions) {
+        const ULARGE_INTEGER attachTime{.QuadPart = info.attachTime};
+        const FILETIME utc{.dwLowDateTime = attachTime.LowPart,
+                           .dwHighDateTime = attachTime.HighPart};
+        SYSTEMTIME universal{}, local{};
+        FileTimeToSystemTime(&utc, &universal);
+        SystemTimeToTzSpecificLocalTime(nullptr, &universal, &local);
+
+        PrintToConsole(std::format(
+            L"{} {} since {:04}-{:02}-{:02} {:02}:{:02}:{:02}, {} events, "
+            L"{} recorded, attached in {} ms, synced in {} ms",
+            info.pid,
+            info.framework == session::kFrameworkWinUI ? L"winui" : L"uwp",
+            local.wYear, local.wMonth, local.wDay, local.wHour, local.wMinute,
+            local.wSecond, info.eventsSeen, info.eventsRecorded,
+            info.attachReplayedUs / 1000, info.attachSyncedUs / 1000));
+    }
+
+    return true;
+}
+
+void ProcessSpySetHeadless(bool headless) {
+    g_headless = headless;
+}
+
+void PrintToConsole(std::wstring_view line) {
+    static const HANDLE output = [] {
+        // A GUI process has no console of its own, but inherits redirected
+        // handles.
+        HANDLE handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (!handle && AttachConsole(ATTACH_PARENT_PROCESS)) {
+            handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        }
+        return handle;
+    }();
+
+    if (!output || output == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    const std::wstring text = std::wstring(line) + L"\r\n";
+
+    DWORD mode;
+    DWORD written;
+    if (GetConsoleMode(output, &mode)) {
+        WriteConsole(output, text.data(), static_cast<DWORD>(text.size()),
+                     &written, nullptr);
+        return;
+    }
+
+    // Redirected to a file or a pipe.
+    const int length = static_cast<int>(text.size());
+    const int size = WideCharToMultiByte(CP_UTF8, 0, text.data(), length,
+                                         nullptr, 0, nullptr, nullptr);
+    std::string utf8(size, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, text.data(), length, utf8.data(), size,
+                        nullptr, nullptr);
+    WriteFile(output, utf8.data(), size, &written, nullptr);
+}
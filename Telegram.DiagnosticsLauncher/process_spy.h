@@ -1,8 +1,38 @@
 #pragma once
 
+#include "../common/sessioninfo.h"
+
 enum ProcessSpyFramework : DWORD {
     kFrameworkUWP = 1,
     kFrameworkWinUI,
 };
 
-bool ProcessSpy(HWND hWnd, DWORD pid, ProcessSpyFramework framework);
+// options is forwarded to the watcher, see Settings in Telegram.Diagnostics.
+bool ProcessSpy(HWND hWnd,
+                DWORD pid,
+                ProcessSpyFramework framework,
+                PCWSTR options = nullptr);
+
+// Changes the trace level of a running watcher. level is off, error, info
+// or verbose.
+bool ProcessSpySetTraceLevel(HWND hWnd, DWORD pid, PCWSTR level);
+
+// Asks a running watcher to write a snapshot report, see triggerCooldown.
+bool ProcessSpyRequestSnapshot(HWND hWnd, DWORD pid);
+
+// Reads the watcher sessions running in this logon session, with their
+// counters.
+bool ProcessSpyQuerySessions(HWND hWnd, std::vector<session::Info>& sessions);
+
+// Prints a line per watcher session, see PrintToConsole.
+bool ProcessSpyListSessions(HWND hWnd);
+
+// Headless runs write messages to the console of the parent process instead
+// of showing them (see PrintToConsole), and answer yes/no questions with yes,
+// so that nothing waits for a click. Off by default.
+void ProcessSpySetHeadless(bool headless);
+
+// Writes a line to the standard output inherited from the parent process,
+// attaching to its console first if there is one. Does nothing if neither
+// exists.
+void PrintToConsole(std::wstring_view line);
@@ -31,5 +31,14 @@ extern CAppModule _Module;
 // Windows
 
 #include <aclapi.h>
+#include <appmodel.h>
 #include <sddl.h>
+#include <shlobj.h>
 #include <tlhelp32.h>
+
+// STL
+
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A small byte-oriented LZ77 codec in the spirit of LZ4: greedy matching
+// through a hash table of 4-byte sequences, 16-bit offsets, no entropy
+// stage. It trades ratio for speed and has no dependencies, so both the
+// injected DLL and the launcher can use it. Neither function allocates.
+//
+// Stream format, a series of sequences:
+//   token      high nibble: literal count, low nibble: match length - 4,
+//              15 in either means more length bytes follow (255 = continue)
+//   literals
+//   offset     2 bytes little endian, 1..65535 back from the output
+//   ...        match length bytes
+// The last sequence has literals only and ends the stream.
+
+namespace lz {
+
+constexpr size_t kMinMatch = 4;
+
+constexpr size_t CompressBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+namespace detail {
+
+inline uint32_t Read32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t Hash(uint32_t sequence, unsigned int bits) {
+    return (sequence * 2654435761u) >> (32 - bits);
+}
+
+inline uint8_t* WriteLength(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+}  // namespace detail
+
+// Returns the compressed size, or 0 if capacity is smaller than
+// CompressBound(size).
+inline size_t Compress(const uint8_t* src,
+                       size_t size,
+                       uint8_t* dst,
+                       size_t capacity) {
+    if (capacity < CompressBound(size)) {
+        return 0;
+    }
+
+    constexpr unsigned int kHashBits = 12;
+    uint32_t table[1 << kHashBits];
+    memset(table, 0xFF, sizeof(table));
+
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const end = src + size;
+    // Keep a few bytes of slack so the 4-byte reads stay in bounds.
+    const uint8_t* const matchLimit = size > 8 ? end - 8 : src;
+    uint8_t* op = dst;
+
+    while (ip < matchLimit) {
+        const uint32_t sequence = detail::Read32(ip);
+        const uint32_t hash = detail::Hash(sequence, kHashBits);
+        const uint32_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(ip - src);
+
+        if (candidate == UINT32_MAX ||
+            static_cast<size_t>(ip - src) - candidate > 0xFFFF ||
+            detail::Read32(src + candidate) != sequence) {
+            ip++;
+            continue;
+        }
+
+        const uint8_t* match = src + candidate;
+        size_t matchLength = kMinMatch;
+        while (ip + matchLength < end &&
+               ip[matchLength] == match[matchLength]) {
+            matchLength++;
+        }
+
+        const size_t literalLength = ip - anchor;
+        uint8_t* token = op++;
+        *token = static_cast<uint8_t>(
+            (literalLength >= 15 ? 15 : literalLength) << 4);
+        if (literalLength >= 15) {
+            op = detail::WriteLength(op, literalLength - 15);
+        }
+
+        memcpy(op, anchor, literalLength);
+        op += literalLength;
+
+        const size_t offset = ip - match;
+        *op++ = static_cast<uint8_t>(offset);
+        *op++ = static_cast<uint8_t>(offset >> 8);
+
+        const size_t extra = matchLength - kMinMatch;
+        *token |= static_cast<uint8_t>(extra >= 15 ? 15 : extra);
+        if (extra >= 15) {
+            op = detail::WriteLength(op, extra - 15);
+        }
+
+        ip += matchLength;
+        anchor = ip;
+    }
+
+    const size_t literalLength = end - anchor;
+    *op++ = static_cast<uint8_t>((literalLength >= 15 ? 15 : literalLength)
+                                 << 4);
+    if (literalLength >= 15) {
+        op = detail::WriteLength(op, literalLength - 15);
+    }
+
+    memcpy(op, anchor, literalLength);
+    op += literalLength;
+
+    return op - dst;
+}
+
+// Returns false on malformed input or if the output doesn't fit. On success
+// decompressedSize receives the number of bytes written.
+inline bool Decompress(const uint8_t* src,
+                       size_t size,
+                       uint8_t* dst,
+                       size_t capacity,
+                       size_t& decompressedSize) {
+    const uint8_t* ip = src;
+    const uint8_t* const end = src + size;
+    uint8_t* op = dst;
+    uint8_t* const outEnd = dst + capacity;
+
+    auto readLength = [&](size_t length) -> size_t {
+        if (length != 15) {
+            return length;
+        }
+
+        uint8_t byte;
+        do {
+            if (ip >= end) {
+                return SIZE_MAX;
+            }
+
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+
+        return length;
+    };
+
+    while (ip < end) {
+        const uint8_t token = *ip++;
+
+        const size_t literalLength = readLength(token >> 4);
+        if (literalLength == SIZE_MAX ||
+            literalLength > static_cast<size_t>(end - ip) ||
+            literalLength > static_cast<size_t>(outEnd - op)) {
+            return false;
+        }
+
+        memcpy(op, ip, literalLength);
+        ip += literalLength;
+        op += literalLength;
+
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+
+        size_t matchLength = readLength(token & 0x0F);
+        if (matchLength == SIZE_MAX) {
+            return false;
+        }
+
+        matchLength += kMinMatch;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst) ||
+            matchLength > static_cast<size_t>(outEnd - op)) {
+            return false;
+        }
+
+        // Byte by byte, matches may overlap their own output.
+        const uint8_t* match = op - offset;
+        for (size_t i = 0; i < matchLength; i++) {
+            op[i] = match[i];
+        }
+
+        op += matchLength;
+    }
+
+    decompressedSize = op - dst;
+    return true;
+}
+
+}  // namespace lz
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+
+// Watcher sessions as the launcher sees them, returned by the
+// querySessions export of Telegram.Diagnostics.dll.
+
+namespace session {
+
+// Values of the framework parameter of start().
+enum Framework : uint32_t {
+    kFrameworkUWP = 1,
+    kFrameworkWinUI = 2,
+};
+
+// Sessions beyond this many aren't registered, and so can't be found.
+constexpr uint32_t kMaxSessions = 64;
+
+struct Info {
+    uint32_t pid;
+    Framework framework;
+    // FILETIME, UTC.
+    uint64_t attachTime;
+    // Read from the watcher's counters when queried, 0 if they can't be.
+    uint64_t eventsSeen;
+    uint64_t eventsRecorded;
+    uint64_t attachReplayedUs;
+    uint64_t attachSyncedUs;
+};
+
+}  // namespace session
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// On-disk format of the rolling layout trace (LayoutTrace-<n>.bin in the
+// app's LocalFolder). Every file starts with a FileHeader and is
+// self-contained: a path is defined in a file before the first event that
+// refers to it. Records are tightly packed, little endian, and each starts
+// with a one-byte RecordType.
+//
+// The launcher's collector re-packs the same records into
+// CollectorTrace-<n>.lzt files: a FileHeader with kCollectorMagic, then
+// blocks, each a BlockHeader followed by compressedSize bytes of common/lz.h
+// output that decompress to rawSize bytes of whole records. Paths are again
+// defined per file.
+
+namespace trace {
+
+constexpr uint32_t kMagic = 0x52544454;  // "TDTR"
+constexpr uint32_t kCollectorMagic = 0x43544454;  // "TDTC"
+constexpr uint32_t kVersion = 3;
+
+#pragma pack(push, 1)
+
+struct FileHeader {
+    uint32_t magic;
+    uint32_t version;
+    // Increases with every file the session writes, files are reused
+    // round-robin so this is what orders them.
+    uint64_t sequence;
+    uint32_t pid;
+    uint32_t reserved;
+    // Frequency of the QueryPerformanceCounter timestamps below.
+    int64_t ticksPerSecond;
+};
+
+enum class RecordType : uint8_t {
+    kEvent = 1,
+    kPath = 2,
+    kStats = 3,
+};
+
+// What an event record observed. Values are part of the format.
+enum class EventKind : uint8_t {
+    kSizeChanged = 0,
+    kEffectiveViewportChanged = 1,
+    kLoaded = 2,
+    kUnloaded = 3,
+    kLayoutUpdated = 4,
+};
+
+constexpr size_t kEventKindCount = 5;
+
+struct EventRecord {
+    RecordType type;
+    EventKind kind;
+    int64_t timestamp;
+    uint64_t handle;
+    uint32_t pathId;
+};
+
+// Followed by length UTF-16 code units.
+struct PathRecord {
+    RecordType type;
+    uint32_t pathId;
+    uint32_t length;
+};
+
+// The watcher's counters, written with every buffer of events.
+struct StatsRecord {
+    RecordType type;
+    int64_t timestamp;
+    uint64_t eventsSeen;
+    uint64_t eventsRecorded;
+    // Records the trace writer couldn't keep up with.
+    uint64_t droppedRecords;
+    uint32_t samplingInterval;
+    uint32_t overheadUs;
+    uint32_t elements;
+};
+
+struct BlockHeader {
+    uint32_t compressedSize;
+    uint32_t rawSize;
+};
+
+#pragma pack(pop)
+
+}  // namespace trace
@@ -0,0 +1,304 @@
+// Checks common/lz.h and the history archive of
+// Telegram.Diagnostics/historyarchive.cpp: LZ round trips on random input,
+// then a writer pushing records through the archive while a reader dumps
+// it, which has to see every sealed record as it was pushed, in order.
+// Built with ThreadSanitizer, which also reports any access the archive's
+// locks don't order.
+//
+//     archivecheck [--pushes N]
+
+#include "stdafx.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "../common/lz.h"
+#include "historyarchive.hpp"
+
+namespace {
+
+// Pushes after which the last record is replaced, and how many times.
+constexpr uint64_t kReplaceEvery = 3;
+constexpr uint32_t kReplacements = 4;
+// Timestamps are this many ticks apart, so that the index shows in them.
+constexpr int64_t kTicksPerPush = 1000;
+
+uint64_t Mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    return value;
+}
+
+struct Failures {
+    std::atomic<uint64_t> count{0};
+    std::mutex printMutex;
+
+    void Fail(const char* what, uint64_t value) {
+        if (count.fetch_add(1, std::memory_order_relaxed) < 10) {
+            std::lock_guard lock(printMutex);
+            fprintf(stderr, "%s (%llu)\n", what,
+                    static_cast<unsigned long long>(value));
+        }
+    }
+};
+
+// Bytes drawn from an alphabet of the given size, in runs of up to
+// maxRun, so that the input ranges from incompressible to one long match.
+void FillRandom(std::mt19937& random,
+                uint8_t* data,
+                size_t size,
+                unsigned int alphabet,
+                unsigned int maxRun) {
+    size_t i = 0;
+    while (i < size) {
+        const uint8_t byte = static_cast<uint8_t>(random() % alphabet);
+        for (unsigned int run = 1 + random() % maxRun; run && i < size;
+             run--) {
+            data[i++] = byte;
+        }
+    }
+}
+
+void CheckLz(Failures& failures) {
+    static constexpr unsigned int kAlphabets[] = {1, 2, 4, 16, 256};
+    // Longer than the 16-bit match offsets reach.
+    constexpr size_t kMaxSize = 80000;
+
+    std::mt19937 random(1);
+    std::vector<uint8_t> input(kMaxSize);
+    std::vector<uint8_t> compressed(lz::CompressBound(kMaxSize));
+    std::vector<uint8_t> output(kMaxSize);
+
+    for (int round = 0; round < 2000; round++) {
+        const size_t size = round % 4 == 0 ? random() % kMaxSize
+                                           : random() % 300;
+        FillRandom(random, input.data(), size,
+                   kAlphabets[random() % std::size(kAlphabets)],
+                   1 + random() % 40);
+
+        const size_t bound = lz::CompressBound(size);
+        if (lz::Compress(input.data(), size, compressed.data(), bound - 1)) {
+            failures.Fail("Compress wrote to a buffer below the bound", size);
+        }
+
+        const size_t compressedSize =
+            lz::Compress(input.data(), size, compressed.data(), bound);
+        if (!compressedSize || compressedSize > bound) {
+            failures.Fail("Compress returned a bad size", compressedSize);
+            continue;
+        }
+
+        size_t outputSize = 0;
+        if (!lz::Decompress(compressed.data(), compressedSize, output.data(),
+                            size, outputSize) ||
+            outputSize != size ||
+            !std::equal(input.begin(), input.begin() + size,
+                        output.begin())) {
+            failures.Fail("Decompress didn't restore the input", size);
+        }
+
+        if (size &&
+            lz::Decompress(compressed.data(), compressedSize, output.data(),
+                           size - 1, outputSize)) {
+            failures.Fail("Decompress overran a short buffer", size);
+        }
+
+        // Cut short or corrupted, it has to fail or stay within the output.
+        const size_t cut = random() % compressedSize;
+        if (lz::Decompress(compressed.data(), cut, output.data(), size,
+                           outputSize) &&
+            outputSize > size) {
+            failures.Fail("Decompress overran on truncated input", cut);
+        }
+
+        compressed[random() % compressedSize] ^=
+            static_cast<uint8_t>(1 + random() % 255);
+        if (lz::Decompress(compressed.data(), compressedSize, output.data(),
+                           size, outputSize) &&
+            outputSize > size) {
+            failures.Fail("Decompress overran on corrupted input", size);
+        }
+    }
+}
+
+// Mostly a few elements and small steps, as in a real history, with the
+// odd far handle, invalid id and long run, so that the deltas take every
+// varint length and sign.
+HistoryItem MakeItem(uint64_t index, uint32_t revision) {
+    const uint64_t mixed = Mix(index);
+    return {
+        .timestamp = static_cast<int64_t>(index) * kTicksPerPush +
+                     static_cast<int64_t>(mixed % 997),
+        .handle = mixed % 8 ? 0x7FF000000000ull + (mixed >> 8) % 16 * 0x40
+                            : Mix(mixed),
+        .pathId = mixed % 13 ? static_cast<uint32_t>(mixed >> 16) % 50
+                             : UINT32_MAX,
+        .stackId = mixed % 5 ? static_cast<uint32_t>(mixed >> 24) % 20
+                             : UINT32_MAX,
+        .repeats = mixed % 31 ? revision
+                              : revision + static_cast<uint32_t>(mixed >> 32),
+        .kind = static_cast<EventKind>(mixed % trace::kEventKindCount),
+        .period = static_cast<uint8_t>(mixed >> 40),
+    };
+}
+
+bool SameItem(const HistoryItem& a, const HistoryItem& b) {
+    return a.timestamp == b.timestamp && a.handle == b.handle &&
+           a.pathId == b.pathId && a.stackId == b.stackId &&
+           a.repeats == b.repeats && a.kind == b.kind && a.period == b.period;
+}
+
+// What a dump saw: the records, which have to be the pushed ones, and the
+// range of indices they cover, which has to be contiguous but for the
+// blocks the archive dropped while the compressor was behind.
+struct Dump {
+    uint64_t sealed = 0;
+    uint64_t records = 0;
+    uint64_t first = 0;
+    uint64_t next = 0;
+    uint64_t skipped = 0;
+
+    void Check(Failures& failures, HistoryArchive& archive) {
+        records = 0;
+        skipped = 0;
+        sealed = archive.ForEach([&](const HistoryItem& item) {
+            const uint64_t index = item.timestamp / kTicksPerPush;
+            if (records == 0) {
+                first = index;
+            } else if (index > next &&
+                       next % HistoryArchive::kBlockRecords == 0 &&
+                       index % HistoryArchive::kBlockRecords == 0) {
+                skipped += index - next;
+            } else if (index != next) {
+                failures.Fail("Dump skipped or repeated records", index);
+            }
+            next = index + 1;
+            records++;
+
+            const bool replaced = index % kReplaceEvery == 0;
+            if (!SameItem(item, MakeItem(index, 0)) &&
+                !(replaced &&
+                  SameItem(item, MakeItem(index, kReplacements)))) {
+                failures.Fail("Dump returned a record never pushed", index);
+            }
+        });
+
+        if (records && sealed > next &&
+            next % HistoryArchive::kBlockRecords == 0) {
+            skipped += sealed - next;
+        } else if (records && next != sealed) {
+            failures.Fail("Dump doesn't end at the sealed count", next);
+        }
+        if (skipped >
+            archive.DroppedBlocks() * HistoryArchive::kBlockRecords) {
+            failures.Fail("Dump skipped blocks that weren't dropped",
+                          skipped);
+        }
+    }
+};
+
+void CheckArchive(Failures& failures, uint64_t pushes) {
+    // Large, and only touched by its own threads.
+    auto archive = std::make_unique<HistoryArchive>();
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> dumps{0};
+
+    std::thread reader([&] {
+        Dump dump;
+        while (!done.load(std::memory_order_acquire)) {
+            dump.Check(failures, *archive);
+            dumps.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    for (uint64_t index = 0; index < pushes; index++) {
+        archive->Push(MakeItem(index, 0));
+        if (index % kReplaceEvery == 0) {
+            for (uint32_t revision = 1; revision <= kReplacements;
+                 revision++) {
+                archive->ReplaceBack(MakeItem(index, revision));
+            }
+        }
+    }
+
+    done.store(true, std::memory_order_release);
+    reader.join();
+
+    // The oldest blocks are dropped once the compressed ones are over
+    // budget, which shows that the compressor got to all the ones before.
+    Dump dump;
+    const auto deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    do {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        dump.Check(failures, *archive);
+    } while (dump.first == 0 && std::chrono::steady_clock::now() < deadline);
+
+    const uint64_t expectedSealed =
+        pushes ? (pushes - 1) / HistoryArchive::kBlockRecords *
+                     HistoryArchive::kBlockRecords
+               : 0;
+    if (dump.sealed != expectedSealed) {
+        failures.Fail("Wrong sealed count", dump.sealed);
+    }
+    if (dump.first == 0) {
+        failures.Fail("No block was dropped", dump.records);
+    }
+    if (archive->CompressedBytes() > HistoryArchive::kMaxCompressedBytes) {
+        failures.Fail("Compressed blocks over budget",
+                      archive->CompressedBytes());
+    }
+
+    printf("%llu dumps, %llu records kept of %llu sealed, %zu bytes, "
+           "%llu blocks dropped\n",
+           static_cast<unsigned long long>(dumps.load()),
+           static_cast<unsigned long long>(dump.records),
+           static_cast<unsigned long long>(dump.sealed),
+           archive->CompressedBytes(),
+           static_cast<unsigned long long>(archive->DroppedBlocks()));
+}
+
+bool ParseCount(const char* text, uint64_t& value) {
+    char* end;
+    const unsigned long long parsed = strtoull(text, &end, 10);
+    if (end == text || *end || !parsed) {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint64_t pushes = 100'000;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg != "--pushes" || i + 1 == argc ||
+            !ParseCount(argv[++i], pushes)) {
+            fprintf(stderr, "usage: archivecheck [--pushes N]\n");
+            return 2;
+        }
+    }
+
+    Failures failures;
+    CheckLz(failures);
+    CheckArchive(failures, pushes);
+
+    printf("%llu failures\n",
+           static_cast<unsigned long long>(failures.count.load()));
+    return failures.count.load() ? 1 : 0;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+// Stands in for Telegram.Diagnostics/stdafx.h, which is Windows only, for
+// the sources built here, with the few thread pool functions they use.
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CALLBACK
+#define TRUE 1
+#define FALSE 0
+
+using BOOL = int;
+using PVOID = void*;
+using InstanceHandle = uint64_t;
+
+struct TP_CALLBACK_INSTANCE;
+using PTP_CALLBACK_INSTANCE = TP_CALLBACK_INSTANCE*;
+
+struct TP_WORK;
+using PTP_WORK = TP_WORK*;
+using PTP_WORK_CALLBACK = void (*)(PTP_CALLBACK_INSTANCE, PVOID, PTP_WORK);
+
+// Every submission runs on a new thread, so callbacks overlap as freely as
+// the thread pool lets them.
+struct TP_WORK {
+    static constexpr size_t kMaxThreads = 8;
+
+    PTP_WORK_CALLBACK callback;
+    PVOID context;
+    std::mutex mutex;
+    std::deque<std::thread> threads;
+};
+
+inline PTP_WORK CreateThreadpoolWork(PTP_WORK_CALLBACK callback,
+                                     PVOID context,
+                                     void*) {
+    const auto work = new TP_WORK;
+    work->callback = callback;
+    work->context = context;
+    return work;
+}
+
+inline void SubmitThreadpoolWork(PTP_WORK work) {
+    std::scoped_lock lock(work->mutex);
+
+    if (work->threads.size() == TP_WORK::kMaxThreads) {
+        work->threads.front().join();
+        work->threads.pop_front();
+    }
+
+    work->threads.emplace_back(
+        [work] { work->callback(nullptr, work->context, work); });
+}
+
+inline void WaitForThreadpoolWorkCallbacks(PTP_WORK work, BOOL) {
+    std::deque<std::thread> threads;
+    {
+        std::scoped_lock lock(work->mutex);
+        threads.swap(work->threads);
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+inline void CloseThreadpoolWork(PTP_WORK work) {
+    WaitForThreadpoolWorkCallbacks(work, FALSE);
+    delete work;
+}
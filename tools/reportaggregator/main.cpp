@@ -0,0 +1,248 @@
+// Buckets a corpus of LayoutCycle.jsonl and LayoutSnapshot-<n>.jsonl
+// reports, and LayoutCycle.txt reports of older versions, by the set of
+// elements taking part in the cycle, and prints the buckets with the most
+// reports first.
+//
+//     reportaggregator [--threads N] [--top N] [--participants N] <path>...
+//
+// Each path is a report or a directory searched recursively for *.jsonl and
+// *.txt.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "mappedfile.hpp"
+#include "report.hpp"
+#include "workstealingpool.hpp"
+
+namespace {
+
+struct Bucket {
+    uint64_t reports = 0;
+    uint64_t crashes = 0;
+    std::unordered_set<uint64_t> fingerprints;
+    // Of the report with the smallest file index, so the output doesn't
+    // depend on scheduling.
+    size_t example = SIZE_MAX;
+    std::vector<std::string> participants;
+};
+
+// Filled by one worker, merged once all reports are parsed.
+struct WorkerResult {
+    ReportParser parser;
+    ReportSummary summary;
+    MappedFile file;
+    std::unordered_map<uint64_t, Bucket> buckets;
+    uint64_t bytes = 0;
+    uint64_t unreadable = 0;
+    uint64_t invalid = 0;
+};
+
+struct Options {
+    unsigned int threads = std::thread::hardware_concurrency();
+    size_t top = 20;
+    size_t participants = 8;
+    std::vector<std::string> inputs;
+};
+
+bool ParseCount(const char* text, size_t& value) {
+    char* end;
+    const unsigned long long parsed = strtoull(text, &end, 10);
+    if (end == text || *end) {
+        return false;
+    }
+
+    value = static_cast<size_t>(parsed);
+    return true;
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        size_t value;
+        if (arg == "--threads" && i + 1 < argc && ParseCount(argv[++i], value)) {
+            options.threads = static_cast<unsigned int>(value);
+        } else if (arg == "--top" && i + 1 < argc &&
+                   ParseCount(argv[++i], value)) {
+            options.top = value;
+        } else if (arg == "--participants" && i + 1 < argc &&
+                   ParseCount(argv[++i], value)) {
+            options.participants = value;
+        } else if (arg.starts_with("--")) {
+            return false;
+        } else {
+            options.inputs.emplace_back(arg);
+        }
+    }
+
+    return !options.inputs.empty();
+}
+
+std::vector<std::string> ListReports(const std::vector<std::string>& inputs) {
+    namespace fs = std::filesystem;
+
+    std::vector<std::string> files;
+    for (const auto& input : inputs) {
+        std::error_code error;
+        if (!fs::is_directory(input, error)) {
+            files.push_back(input);
+            continue;
+        }
+
+        for (fs::recursive_directory_iterator it(
+                 input, fs::directory_options::skip_permission_denied, error),
+             end;
+             it != end; it.increment(error)) {
+            if (it->is_regular_file(error) &&
+                (it->path().extension() == ".jsonl" ||
+                 it->path().extension() == ".txt")) {
+                files.push_back(it->path().string());
+            }
+        }
+    }
+
+    // Sorted so that bucket examples are stable between runs.
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void ProcessReport(const std::string& path, size_t index, WorkerResult& out) {
+    if (!out.file.Open(path.c_str())) {
+        out.unreadable++;
+        return;
+    }
+
+    const std::string_view data = out.file.Data();
+    out.bytes += data.size();
+
+    ReportSummary& summary = out.summary;
+    const bool parsed = path.ends_with(".txt")
+                            ? out.parser.ParseLegacy(data, summary)
+                            : out.parser.Parse(data, summary);
+    if (!parsed) {
+        out.invalid++;
+        return;
+    }
+
+    Bucket& bucket = out.buckets[summary.key];
+    bucket.reports++;
+    if (summary.trigger == "layoutCycle") {
+        bucket.crashes++;
+    }
+    if (summary.fingerprint) {
+        bucket.fingerprints.insert(summary.fingerprint);
+    }
+    if (index < bucket.example) {
+        bucket.example = index;
+        bucket.participants = std::move(summary.participants);
+    }
+}
+
+void Merge(Bucket& into, Bucket& from) {
+    into.reports += from.reports;
+    into.crashes += from.crashes;
+    into.fingerprints.merge(from.fingerprints);
+    if (from.example < into.example) {
+        into.example = from.example;
+        into.participants = std::move(from.participants);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        fprintf(stderr,
+                "Usage: %s [--threads N] [--top N] [--participants N] "
+                "<report or directory>...\n",
+                argv[0]);
+        return 2;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    const std::vector<std::string> files = ListReports(options.inputs);
+
+    WorkStealingPool pool(options.threads);
+    std::vector<WorkerResult> results(pool.Threads());
+    pool.Run(files.size(), [&](size_t index, unsigned int worker) {
+        ProcessReport(files[index], index, results[worker]);
+    });
+
+    std::unordered_map<uint64_t, Bucket> buckets;
+    uint64_t bytes = 0;
+    uint64_t unreadable = 0;
+    uint64_t invalid = 0;
+    for (auto& result : results) {
+        for (auto& [key, bucket] : result.buckets) {
+            Merge(buckets[key], bucket);
+        }
+
+        bytes += result.bytes;
+        unreadable += result.unreadable;
+        invalid += result.invalid;
+    }
+
+    std::vector<const Bucket*> ranked;
+    ranked.reserve(buckets.size());
+    for (const auto& [key, bucket] : buckets) {
+        ranked.push_back(&bucket);
+    }
+
+    std::sort(ranked.begin(), ranked.end(),
+              [](const Bucket* a, const Bucket* b) {
+                  if (a->reports != b->reports) {
+                      return a->reports > b->reports;
+                  }
+                  return a->example < b->example;
+              });
+
+    const uint64_t reports = files.size() - unreadable - invalid;
+    const double seconds = std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count();
+
+    printf("%llu reports in %zu buckets, %.1f MB in %.2f s on %u threads",
+           static_cast<unsigned long long>(reports), buckets.size(),
+           bytes / (1024.0 * 1024.0), seconds, pool.Threads());
+    if (unreadable || invalid) {
+        printf(" (%llu unreadable, %llu not reports)",
+               static_cast<unsigned long long>(unreadable),
+               static_cast<unsigned long long>(invalid));
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < ranked.size() && i < options.top; i++) {
+        const Bucket& bucket = *ranked[i];
+        printf(
+            "\n#%zu: %llu reports (%.1f%%), %llu crashes, %zu fingerprints, "
+            "%zu participants\n",
+            i + 1, static_cast<unsigned long long>(bucket.reports),
+            100.0 * bucket.reports / std::max<uint64_t>(reports, 1),
+            static_cast<unsigned long long>(bucket.crashes),
+            bucket.fingerprints.size(), bucket.participants.size());
+        printf("    example: %s\n", files[bucket.example].c_str());
+
+        for (size_t j = 0;
+             j < bucket.participants.size() && j < options.participants; j++) {
+            printf("    %s\n", bucket.participants[j].c_str());
+        }
+
+        if (bucket.participants.size() > options.participants) {
+            printf("    ... %zu more\n",
+                   bucket.participants.size() - options.participants);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "mappedfile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+    Close();
+}
+
+bool MappedFile::Open(const char* path) {
+    Close();
+
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return false;
+    }
+
+    if (info.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ,
+                      MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced.
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    madvise(data, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+
+    m_data = data;
+    m_size = static_cast<size_t>(info.st_size);
+    return true;
+}
+
+void MappedFile::Close() {
+    if (m_data) {
+        munmap(m_data, m_size);
+        m_data = nullptr;
+    }
+
+    m_size = 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+// A read-only memory mapping of a whole file. Reports are read once, front
+// to back, so the kernel is told to read ahead and drop pages early.
+class MappedFile {
+   public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Unmaps whatever was mapped before. Empty files map to an empty view.
+    bool Open(const char* path);
+    void Close();
+
+    std::string_view Data() const {
+        return {static_cast<const char*>(m_data), m_size};
+    }
+
+   private:
+    void* m_data = nullptr;
+    size_t m_size = 0;
+};
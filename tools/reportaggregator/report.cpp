@@ -0,0 +1,423 @@
+#include "report.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "../../Telegram.Diagnostics/pathabbreviations.hpp"
+
+namespace {
+
+constexpr uint64_t kFnvOffset = 0xCBF29CE484222325ull;
+constexpr uint64_t kFnvPrime = 0x100000001B3ull;
+
+constexpr std::string_view kLinePrefix = "{\"type\":\"";
+
+// Of every event in a LayoutCycle.txt.
+constexpr std::string_view kLegacyKind = "SizeChanged";
+
+// Splits off the first line of data, without its line break.
+std::string_view NextLine(std::string_view& data) {
+    const void* newline = memchr(data.data(), '\n', data.size());
+    const size_t length =
+        newline ? static_cast<const char*>(newline) - data.data()
+                : data.size();
+    const std::string_view line = data.substr(0, length);
+    data.remove_prefix(newline ? length + 1 : length);
+    return line;
+}
+
+void StripIndices(std::string_view path, std::string& out) {
+    out.clear();
+    out.reserve(path.size());
+
+    for (size_t i = 0; i < path.size(); i++) {
+        if (path[i] == '[') {
+            size_t end = i + 1;
+            while (end < path.size() && path[end] >= '0' && path[end] <= '9') {
+                end++;
+            }
+
+            if (end > i + 1 && end < path.size() && path[end] == ']') {
+                i = end;
+                continue;
+            }
+        }
+
+        out += path[i];
+    }
+}
+
+struct Abbreviation {
+    std::string longForm;
+    std::string shortForm;
+};
+
+// The watcher's table, narrowed (it's ASCII) and with the indices in the
+// long forms stripped like in the paths they're matched against.
+const std::vector<Abbreviation>& Abbreviations() {
+    static const std::vector<Abbreviation> abbreviations = [] {
+        std::vector<Abbreviation> result;
+        for (const auto& abbreviation : kPathAbbreviations) {
+            const std::string longForm(abbreviation.longForm.begin(),
+                                       abbreviation.longForm.end());
+            Abbreviation& narrow = result.emplace_back();
+            StripIndices(longForm, narrow.longForm);
+            narrow.shortForm.assign(abbreviation.shortForm.begin(),
+                                    abbreviation.shortForm.end());
+        }
+
+        return result;
+    }();
+
+    return abbreviations;
+}
+
+// Finds "key": in a line and returns its value: the characters between the
+// quotes, still escaped, for a string, the literal otherwise. Keys can't
+// match inside strings, where quotes are escaped.
+bool FindField(std::string_view line,
+               std::string_view key,
+               std::string_view& value) {
+    size_t position = 0;
+    while (true) {
+        position = line.find(key, position);
+        if (position == line.npos) {
+            return false;
+        }
+
+        if (position > 0 && line[position - 1] == '"' &&
+            line.substr(position + key.size(), 2) == "\":") {
+            break;
+        }
+
+        position += key.size();
+    }
+
+    size_t begin = position + key.size() + 2;
+    if (begin < line.size() && line[begin] == '"') {
+        begin++;
+        size_t end = begin;
+        while (end < line.size() && line[end] != '"') {
+            end += line[end] == '\\' ? 2 : 1;
+        }
+
+        if (end >= line.size()) {
+            return false;
+        }
+
+        value = line.substr(begin, end - begin);
+        return true;
+    }
+
+    size_t end = begin;
+    while (end < line.size() && line[end] != ',' && line[end] != '}') {
+        end++;
+    }
+
+    value = line.substr(begin, end - begin);
+    return true;
+}
+
+bool ParseUnsigned(std::string_view text, uint64_t& value) {
+    if (text.empty()) {
+        return false;
+    }
+
+    value = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+
+        value = value * 10 + static_cast<uint64_t>(c - '0');
+    }
+
+    return true;
+}
+
+bool ParseHex(std::string_view text, uint64_t& value) {
+    if (!text.starts_with("0x") || text.size() == 2) {
+        return false;
+    }
+
+    value = 0;
+    for (char c : text.substr(2)) {
+        uint64_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint64_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint64_t>(c - 'a' + 10);
+        } else {
+            return false;
+        }
+
+        value = value << 4 | digit;
+    }
+
+    return true;
+}
+
+// Sorts and dedups the participants, and hashes them into the key.
+void FinishSummary(ReportSummary& summary) {
+    // Different ids can normalize to the same path.
+    std::sort(summary.participants.begin(), summary.participants.end());
+    summary.participants.erase(std::unique(summary.participants.begin(),
+                                           summary.participants.end()),
+                               summary.participants.end());
+
+    uint64_t key = kFnvOffset;
+    for (const auto& participant : summary.participants) {
+        for (char c : participant) {
+            key ^= static_cast<uint8_t>(c);
+            key *= kFnvPrime;
+        }
+
+        key ^= '\n';
+        key *= kFnvPrime;
+    }
+
+    summary.key = key;
+}
+
+void PutUtf8(std::string& out, uint32_t c) {
+    if (c < 0x80) {
+        out += static_cast<char>(c);
+    } else if (c < 0x800) {
+        out += static_cast<char>(0xC0 | (c >> 6));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else if (c < 0x10000) {
+        out += static_cast<char>(0xE0 | (c >> 12));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (c >> 18));
+        out += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (c & 0x3F));
+    }
+}
+
+bool ParseHex4(std::string_view text, size_t position, uint32_t& value) {
+    if (position + 4 > text.size()) {
+        return false;
+    }
+
+    value = 0;
+    for (char c : text.substr(position, 4)) {
+        uint32_t digit;
+        if (c >= '0' && c <= '9') {
+            digit = static_cast<uint32_t>(c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            digit = static_cast<uint32_t>(c - 'a' + 10);
+        } else if (c >= 'A' && c <= 'F') {
+            digit = static_cast<uint32_t>(c - 'A' + 10);
+        } else {
+            return false;
+        }
+
+        value = value << 4 | digit;
+    }
+
+    return true;
+}
+
+void Unescape(std::string_view text, std::string& out) {
+    out.clear();
+
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != '\\' || i + 1 == text.size()) {
+            out += text[i];
+            continue;
+        }
+
+        const char c = text[++i];
+        switch (c) {
+            case 'b':
+                out += '\b';
+                break;
+            case 'f':
+                out += '\f';
+                break;
+            case 'n':
+                out += '\n';
+                break;
+            case 'r':
+                out += '\r';
+                break;
+            case 't':
+                out += '\t';
+                break;
+            case 'u': {
+                uint32_t unit;
+                if (!ParseHex4(text, i + 1, unit)) {
+                    out += c;
+                    break;
+                }
+
+                i += 4;
+                uint32_t low;
+                if (unit >= 0xD800 && unit <= 0xDBFF &&
+                    text.substr(i + 1, 2) == "\\u" &&
+                    ParseHex4(text, i + 3, low) && low >= 0xDC00 &&
+                    low <= 0xDFFF) {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    i += 6;
+                }
+
+                PutUtf8(out, unit);
+                break;
+            }
+            default:
+                out += c;
+                break;
+        }
+    }
+}
+
+}  // namespace
+
+std::string NormalizePath(std::string_view path) {
+    std::string normalized;
+    StripIndices(path, normalized);
+
+    for (const auto& abbreviation : Abbreviations()) {
+        const size_t position = normalized.find(abbreviation.longForm);
+        if (position != normalized.npos) {
+            normalized.replace(position, abbreviation.longForm.size(),
+                               abbreviation.shortForm);
+        }
+    }
+
+    return normalized;
+}
+
+bool ReportParser::Parse(std::string_view data, ReportSummary& summary) {
+    paths.clear();
+    summary = ReportSummary{};
+
+    // Kind and path id of the last kMaxEvents events.
+    std::pair<std::string_view, uint64_t> events[kMaxEvents];
+    size_t eventCount = 0;
+    bool header = false;
+
+    while (!data.empty()) {
+        const std::string_view line = NextLine(data);
+        if (!line.starts_with(kLinePrefix)) {
+            continue;
+        }
+
+        const std::string_view rest = line.substr(kLinePrefix.size());
+        std::string_view value;
+        if (rest.starts_with("event\"")) {
+            uint64_t pathId;
+            std::string_view kind;
+            if (FindField(line, "path", value) &&
+                ParseUnsigned(value, pathId) && FindField(line, "kind", kind)) {
+                events[eventCount++ % kMaxEvents] = {kind, pathId};
+            }
+        } else if (rest.starts_with("repeat\"")) {
+            // The last period events went around repeats more times, only
+            // as many as still fit matter.
+            uint64_t period, repeats;
+            if (FindField(line, "period", value) &&
+                ParseUnsigned(value, period) &&
+                FindField(line, "repeats", value) &&
+                ParseUnsigned(value, repeats) && period &&
+                period <= std::min(eventCount, kMaxEvents)) {
+                const uint64_t replayed =
+                    std::min<uint64_t>(repeats * period, kMaxEvents);
+                for (uint64_t i = 0; i < replayed; i++) {
+                    events[eventCount % kMaxEvents] =
+                        events[(eventCount - period) % kMaxEvents];
+                    eventCount++;
+                }
+            }
+        } else if (rest.starts_with("path\"")) {
+            uint64_t id;
+            std::string_view path;
+            if (FindField(line, "id", value) && ParseUnsigned(value, id) &&
+                FindField(line, "path", path)) {
+                paths.emplace(id, path);
+            }
+        } else if (rest.starts_with("header\"")) {
+            header = true;
+            summary.trigger = FindField(line, "trigger", value)
+                                  ? std::string(value)
+                                  : "layoutCycle";
+            if (FindField(line, "fingerprint", value)) {
+                ParseHex(value, summary.fingerprint);
+            }
+        }
+    }
+
+    if (!header) {
+        return false;
+    }
+
+    // The same few elements go around the cycle, normalize each path once.
+    const size_t count = std::min(eventCount, kMaxEvents);
+    std::sort(events, events + count);
+    const size_t unique = std::unique(events, events + count) - events;
+
+    for (size_t i = 0; i < unique; i++) {
+        auto find = paths.find(events[i].second);
+        if (find == paths.end()) {
+            continue;
+        }
+
+        Unescape(find->second, unescaped);
+
+        std::string participant(events[i].first);
+        participant += ' ';
+        participant += NormalizePath(unescaped);
+        summary.participants.push_back(std::move(participant));
+    }
+
+    FinishSummary(summary);
+    return true;
+}
+
+bool ReportParser::ParseLegacy(std::string_view data, ReportSummary& summary) {
+    summary = ReportSummary{};
+    summary.trigger = "layoutCycle";
+
+    // Paths of the last kMaxEvents events. Those versions kept 200.
+    std::string_view events[kMaxEvents];
+    size_t eventCount = 0;
+
+    while (!data.empty()) {
+        std::string_view line = NextLine(data);
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+
+        // Paths have spaces, the handle is after the last one.
+        const size_t separator = line.rfind(" 0x");
+        uint64_t handle;
+        if (separator == line.npos || separator == 0 ||
+            !ParseHex(line.substr(separator + 1), handle)) {
+            continue;
+        }
+
+        events[eventCount++ % kMaxEvents] = line.substr(0, separator);
+    }
+
+    if (!eventCount) {
+        return false;
+    }
+
+    const size_t count = std::min(eventCount, kMaxEvents);
+    std::sort(events, events + count);
+    const size_t unique = std::unique(events, events + count) - events;
+
+    for (size_t i = 0; i < unique; i++) {
+        std::string participant(kLegacyKind);
+        participant += ' ';
+        participant += NormalizePath(events[i]);
+        summary.participants.push_back(std::move(participant));
+    }
+
+    FinishSummary(summary);
+    return true;
+}
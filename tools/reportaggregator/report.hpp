@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// What the aggregator keeps of one LayoutCycle.jsonl or
+// LayoutSnapshot-<n>.jsonl report, or of a LayoutCycle.txt of the watcher's
+// first versions.
+struct ReportSummary {
+    std::string trigger;
+    uint64_t fingerprint = 0;
+    // Participants of the cycle, sorted and unique: the event kind and the
+    // normalized path of every element among the last kMaxEvents events,
+    // as in "SizeChanged MainPage/.../Grid/TextBlock".
+    std::vector<std::string> participants;
+    // Hash of the participants, the bucket the report goes to.
+    uint64_t key = 0;
+};
+
+// Same window as the watcher's fingerprint.
+constexpr size_t kMaxEvents = 256;
+
+// Strips the "[childIndex]" parts and replaces the long, always identical
+// prefixes of Unigram's tree by the short forms the watcher writes, so a
+// path compares equal whichever form and item index a report has.
+std::string NormalizePath(std::string_view path);
+
+// Scratch space reused between reports parsed on the same thread.
+struct ReportParser {
+    std::unordered_map<uint64_t, std::string_view> paths;
+    std::string unescaped;
+
+    // Returns false if data isn't a report.
+    bool Parse(std::string_view data, ReportSummary& summary);
+
+    // LayoutCycle.txt: a line per SizeChanged event, the only kind those
+    // versions recorded, with the element's path and handle, as in
+    // "MainPage/.../Grid[2]/TextBlock 0x1f2e3d4c". Those reports have no
+    // fingerprint. Returns false if no line is an event.
+    bool ParseLegacy(std::string_view data, ReportSummary& summary);
+};
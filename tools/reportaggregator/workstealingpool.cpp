@@ -0,0 +1,93 @@
+#include "workstealingpool.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+WorkStealingPool::WorkStealingPool(unsigned int threads)
+    : m_threads(std::max(threads, 1u)),
+      m_shares(std::make_unique<Share[]>(m_threads)) {}
+
+void WorkStealingPool::Run(size_t count, const Task& task) {
+    for (unsigned int i = 0; i < m_threads; i++) {
+        std::lock_guard lock(m_shares[i].mutex);
+        m_shares[i].begin = count * i / m_threads;
+        m_shares[i].end = count * (i + 1) / m_threads;
+    }
+
+    auto work = [&](unsigned int worker) {
+        size_t index;
+        while (Next(worker, index) || (Steal(worker) && Next(worker, index))) {
+            task(index, worker);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(m_threads - 1);
+    for (unsigned int i = 1; i < m_threads; i++) {
+        threads.emplace_back(work, i);
+    }
+
+    work(0);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+bool WorkStealingPool::Next(unsigned int worker, size_t& index) {
+    Share& share = m_shares[worker];
+    std::lock_guard lock(share.mutex);
+    if (share.begin == share.end) {
+        return false;
+    }
+
+    index = share.begin++;
+    return true;
+}
+
+bool WorkStealingPool::Steal(unsigned int worker) {
+    // Loops because the victim may have drained its share by the time it's
+    // locked. Shares only shrink, so this ends once they're all empty.
+    while (true) {
+        unsigned int victim = worker;
+        size_t largest = 0;
+        for (unsigned int i = 0; i < m_threads; i++) {
+            if (i == worker) {
+                continue;
+            }
+
+            std::lock_guard lock(m_shares[i].mutex);
+            const size_t left = m_shares[i].end - m_shares[i].begin;
+            if (left > largest) {
+                largest = left;
+                victim = i;
+            }
+        }
+
+        if (victim == worker) {
+            return false;
+        }
+
+        size_t begin;
+        size_t end;
+        {
+            Share& share = m_shares[victim];
+            std::lock_guard lock(share.mutex);
+            const size_t left = share.end - share.begin;
+            if (left == 0) {
+                continue;
+            }
+
+            end = share.end;
+            begin = share.end - (left + 1) / 2;
+            share.end = begin;
+        }
+
+        Share& own = m_shares[worker];
+        std::lock_guard lock(own.mutex);
+        own.begin = begin;
+        own.end = end;
+        return true;
+    }
+}
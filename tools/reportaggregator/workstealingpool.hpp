@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Runs a fixed set of tasks, indices 0 to count - 1, on a number of
+// threads. Each worker starts with a contiguous share of the indices and
+// takes them from the front; a worker that runs out steals the back half of
+// the largest share left. Report sizes vary by orders of magnitude, so a
+// static split alone would leave most threads idle at the end.
+class WorkStealingPool {
+   public:
+    using Task = std::function<void(size_t index, unsigned int worker)>;
+
+    explicit WorkStealingPool(unsigned int threads);
+
+    unsigned int Threads() const { return m_threads; }
+
+    // Returns once every task ran. worker is below Threads(), and tasks
+    // with the same worker never run concurrently.
+    void Run(size_t count, const Task& task);
+
+   private:
+    struct Share {
+        std::mutex mutex;
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    bool Next(unsigned int worker, size_t& index);
+    bool Steal(unsigned int worker);
+
+    const unsigned int m_threads;
+    std::unique_ptr<Share[]> m_shares;
+};
@@ -0,0 +1,281 @@
+// Runs readers of SeqlockCell, SeqlockRing and PathTable against a writer,
+// and checks that everything they read is something the writer wrote as a
+// whole. Built with ThreadSanitizer, which also reports any access the
+// lock-free paths don't order.
+//
+//     seqlockstress [--readers N] [--pushes N]
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "pathtable.hpp"
+#include "seqlock.hpp"
+
+namespace {
+
+// Every field derives from value and revision, so a torn copy shows.
+struct Item {
+    uint64_t value;
+    uint32_t revision;
+    uint32_t low;
+    uint64_t check;
+};
+
+// Bigger than a cache line, so a cell spans several.
+struct Wide {
+    uint64_t value;
+    uint64_t words[9];
+};
+
+constexpr size_t kRingCapacity = 64;
+// Pushes after which the last item is replaced, and how many times.
+constexpr uint64_t kReplaceEvery = 3;
+constexpr uint32_t kReplacements = 4;
+// Pushes per interned path.
+constexpr uint64_t kInternEvery = 4;
+// Every this many paths is too long for a shared chunk.
+constexpr uint32_t kLongPathEvery = 1024;
+constexpr size_t kLongPathLength = 20000;
+
+uint64_t Mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    return value;
+}
+
+Item MakeItem(uint64_t value, uint32_t revision) {
+    return {.value = value,
+            .revision = revision,
+            .low = static_cast<uint32_t>(value),
+            .check = Mix(value * 31 + revision)};
+}
+
+bool Consistent(const Item& item) {
+    return item.low == static_cast<uint32_t>(item.value) &&
+           item.check == Mix(item.value * 31 + item.revision) &&
+           item.revision <= kReplacements;
+}
+
+Wide MakeWide(uint64_t value) {
+    Wide wide{};
+    wide.value = value;
+    for (size_t i = 0; i < std::size(wide.words); i++) {
+        wide.words[i] = Mix(value + i);
+    }
+
+    return wide;
+}
+
+bool Consistent(const Wide& wide) {
+    for (size_t i = 0; i < std::size(wide.words); i++) {
+        if (wide.words[i] != Mix(wide.value + i)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::wstring PathOf(uint32_t id) {
+    std::wstring path = L"MainPage/Grid/ListView/ListViewItem[" +
+                        std::to_wstring(id) + L"]/TextBlock";
+    if (id % kLongPathEvery == kLongPathEvery - 1) {
+        path.append(kLongPathLength, L'x');
+    }
+
+    return path;
+}
+
+struct Shared {
+    SeqlockRing<Item, kRingCapacity> ring;
+    SeqlockCell<Wide> cell;
+    PathTable paths;
+    std::atomic<bool> done{false};
+
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> snapshots{0};
+    std::atomic<uint64_t> loads{0};
+    std::atomic<uint64_t> lookups{0};
+    std::mutex printMutex;
+
+    void Fail(const char* what, uint64_t value) {
+        if (failures.fetch_add(1, std::memory_order_relaxed) < 10) {
+            std::lock_guard lock(printMutex);
+            fprintf(stderr, "%s (%llu)\n", what,
+                    static_cast<unsigned long long>(value));
+        }
+    }
+};
+
+void Write(Shared& shared, uint64_t pushes) {
+    uint32_t interned = 0;
+    bool tableFull = false;
+
+    for (uint64_t value = 0; value < pushes; value++) {
+        shared.ring.Push(MakeItem(value, 0));
+        if (value % kReplaceEvery == 0) {
+            for (uint32_t revision = 1; revision <= kReplacements;
+                 revision++) {
+                shared.ring.ReplaceBack(MakeItem(value, revision));
+            }
+        }
+
+        shared.cell.Store(MakeWide(value));
+
+        if (!tableFull && value % kInternEvery == 0) {
+            const uint32_t id = shared.paths.Intern(PathOf(interned));
+            if (id == PathTable::kInvalidId) {
+                tableFull = true;
+                if (shared.paths.Dropped() != 1) {
+                    shared.Fail("Dropped path not counted",
+                                shared.paths.Dropped());
+                }
+            } else if (id != interned) {
+                shared.Fail("Intern returned an unexpected id", id);
+            } else {
+                interned++;
+            }
+        }
+    }
+
+    shared.done.store(true, std::memory_order_release);
+}
+
+void Read(Shared& shared, unsigned int seed) {
+    std::minstd_rand random(seed);
+    std::vector<Item> items(kRingCapacity);
+    uint64_t lastCount = 0;
+    uint64_t lastWide = 0;
+
+    uint64_t snapshots = 0;
+    uint64_t loads = 0;
+    uint64_t lookups = 0;
+
+    while (!shared.done.load(std::memory_order_acquire)) {
+        const uint64_t count = shared.ring.Count();
+        if (count < lastCount) {
+            shared.Fail("Count went backwards", count);
+        }
+        lastCount = count;
+
+        const size_t maxItems = 1 + random() % kRingCapacity;
+        const uint64_t fromIndex =
+            random() % 4 == 0 && count > 8 ? count - 8 : 0;
+        const size_t copied =
+            shared.ring.Snapshot(items.data(), maxItems, fromIndex);
+        if (copied > maxItems) {
+            shared.Fail("Snapshot copied more than asked", copied);
+        }
+
+        for (size_t i = 0; i < copied; i++) {
+            const Item& item = items[i];
+            if (!Consistent(item)) {
+                shared.Fail("Snapshot returned a torn item", item.value);
+            }
+            if (item.value < fromIndex) {
+                shared.Fail("Snapshot returned an item before fromIndex",
+                            item.value);
+            }
+            if (i && item.value <= items[i - 1].value) {
+                shared.Fail("Snapshot returned items out of order",
+                            item.value);
+            }
+            if (item.revision && item.value % kReplaceEvery) {
+                shared.Fail("Snapshot returned an item never replaced",
+                            item.value);
+            }
+        }
+        snapshots++;
+
+        Wide wide;
+        if (shared.cell.TryLoad(wide)) {
+            if (!Consistent(wide)) {
+                shared.Fail("TryLoad returned a torn value", wide.value);
+            }
+            if (wide.value < lastWide) {
+                shared.Fail("TryLoad went backwards", wide.value);
+            }
+            lastWide = wide.value;
+            loads++;
+        }
+
+        const uint32_t size = shared.paths.Size();
+        if (size) {
+            const uint32_t id = random() % size;
+            if (shared.paths.Get(id) != PathOf(id)) {
+                shared.Fail("Get returned the wrong path", id);
+            }
+            lookups++;
+        }
+    }
+
+    shared.snapshots.fetch_add(snapshots, std::memory_order_relaxed);
+    shared.loads.fetch_add(loads, std::memory_order_relaxed);
+    shared.lookups.fetch_add(lookups, std::memory_order_relaxed);
+}
+
+bool ParseCount(const char* text, uint64_t& value) {
+    char* end;
+    const unsigned long long parsed = strtoull(text, &end, 10);
+    if (end == text || *end || !parsed) {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    uint64_t readers = 4;
+    uint64_t pushes = 500'000;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        uint64_t* value = arg == "--readers"  ? &readers
+                          : arg == "--pushes" ? &pushes
+                                              : nullptr;
+        if (!value || i + 1 == argc || !ParseCount(argv[++i], *value)) {
+            fprintf(stderr, "usage: seqlockstress [--readers N] "
+                            "[--pushes N]\n");
+            return 2;
+        }
+    }
+
+    // Large, and only touched by its own threads.
+    auto shared = std::make_unique<Shared>();
+    // So that the cell never holds anything the writer didn't store.
+    shared->cell.Store(MakeWide(0));
+
+    std::vector<std::thread> threads;
+    for (uint64_t i = 0; i < readers; i++) {
+        threads.emplace_back(Read, std::ref(*shared),
+                             static_cast<unsigned int>(i + 1));
+    }
+
+    Write(*shared, pushes);
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    printf("%llu snapshots, %llu loads, %llu lookups, %u paths, "
+           "%llu failures\n",
+           static_cast<unsigned long long>(shared->snapshots.load()),
+           static_cast<unsigned long long>(shared->loads.load()),
+           static_cast<unsigned long long>(shared->lookups.load()),
+           shared->paths.Size(),
+           static_cast<unsigned long long>(shared->failures.load()));
+
+    return shared->failures.load() ? 1 : 0;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// Stands in for Telegram.Diagnostics/stdafx.h, which is Windows only, for
+// the sources built here.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
@@ -0,0 +1,313 @@
+// Checks the string kernels of Telegram.Diagnostics/stringkernels.cpp
+// against scalar references on random inputs, then times them against
+// libstdc++ on a 200-unit element path.
+//
+//     stringbench [--check] [--iterations N]
+//
+// Built with -fshort-wchar, so that wchar_t is UTF-16 and the SSE2 paths
+// run as on Windows. libstdc++'s wchar_t functions assume 32 bits, so the
+// libstdc++ side of the timings uses char16_t.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <string_view>
+
+#include "stringkernels.hpp"
+
+namespace {
+
+constexpr size_t kNpos = std::wstring_view::npos;
+
+// Where timed results go, so that they're computed.
+volatile size_t g_sink;
+
+// Scalar references, plain loops over code units.
+
+bool ReferenceStartsWith(std::wstring_view text, std::wstring_view prefix) {
+    if (prefix.size() > text.size()) {
+        return false;
+    }
+
+    for (size_t i = 0; i < prefix.size(); i++) {
+        if (text[i] != prefix[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t ReferenceFind(std::wstring_view text, std::wstring_view needle) {
+    for (size_t i = 0; i + needle.size() <= text.size(); i++) {
+        if (ReferenceStartsWith(text.substr(i), needle)) {
+            return i;
+        }
+    }
+
+    return kNpos;
+}
+
+size_t ReferenceFindLast(std::wstring_view text, wchar_t c) {
+    for (size_t i = text.size(); i > 0; i--) {
+        if (text[i - 1] == c) {
+            return i - 1;
+        }
+    }
+
+    return kNpos;
+}
+
+size_t ReferencePlainAsciiLength(std::wstring_view text) {
+    size_t i = 0;
+    while (i < text.size() && text[i] >= 0x20 && text[i] < 0x80 &&
+           text[i] != '"' && text[i] != '\\') {
+        i++;
+    }
+
+    return i;
+}
+
+size_t ReferenceFormatHex(uint64_t value, char* out) {
+    size_t significant = 1;
+    for (int i = 15; i >= 0; i--) {
+        const unsigned int digit = value & 0xF;
+        out[i] = "0123456789abcdef"[digit];
+        if (digit) {
+            significant = 16 - i;
+        }
+        value >>= 4;
+    }
+
+    return significant;
+}
+
+// Mostly path characters, with the units the kernels treat specially:
+// controls, '"', '\\', DEL, the first non-ASCII ones and the units whose
+// sign bit is set.
+wchar_t RandomUnit(std::mt19937& random) {
+    static constexpr wchar_t kSpecial[] = {0x00, 0x1F,   0x20,   '"',
+                                           '\\', 0x7F,   0x80,   0xFF,
+                                           0x100, 0x7FFF, 0x8000, 0xFFFF};
+    static constexpr char kPath[] = "abcAB/[]() 0123.";
+
+    const unsigned int pick = random() % 16;
+    if (pick == 0) {
+        return kSpecial[random() % std::size(kSpecial)];
+    }
+
+    return static_cast<wchar_t>(kPath[random() % (std::size(kPath) - 1)]);
+}
+
+struct Checker {
+    uint64_t checks = 0;
+    uint64_t failures = 0;
+
+    void Expect(bool ok, const char* what, size_t length) {
+        checks++;
+        if (!ok && failures++ < 10) {
+            fprintf(stderr, "%s differs from the reference, length %zu\n",
+                    what, length);
+        }
+    }
+};
+
+bool Check() {
+    std::mt19937 random(1);
+    Checker checker;
+
+    // Room for the kernels' blocks to start at any alignment.
+    wchar_t text[320 + 8];
+    wchar_t other[320 + 8];
+    char narrow[320 + 16];
+
+    for (int round = 0; round < 200000; round++) {
+        const size_t length = random() % 320;
+        const size_t offset = random() % 8;
+        wchar_t* units = text + offset;
+
+        // A small alphabet half the time, so needles and prefixes match.
+        const bool small = random() % 2;
+        for (size_t i = 0; i < length; i++) {
+            units[i] = small ? static_cast<wchar_t>('a' + random() % 2)
+                             : RandomUnit(random);
+        }
+
+        const std::wstring_view view(units, length);
+
+        // Prefixes of the text, some changed at a random unit.
+        const size_t prefixLength = length ? random() % (length + 2) : 0;
+        for (size_t i = 0; i < prefixLength && i < length; i++) {
+            other[i] = units[i];
+        }
+        if (prefixLength && random() % 2) {
+            other[random() % prefixLength] ^= 1;
+        }
+        const std::wstring_view prefix(other, prefixLength);
+        checker.Expect(StartsWith(view, prefix) ==
+                           ReferenceStartsWith(view, prefix),
+                       "StartsWith", length);
+
+        // Needles cut from the text, so they're found, or with one unit
+        // changed, so they mostly aren't.
+        const size_t needleStart = length ? random() % length : 0;
+        const size_t needleLength =
+            length ? random() % (length - needleStart + 1) : 0;
+        for (size_t i = 0; i < needleLength; i++) {
+            other[i] = units[needleStart + i];
+        }
+        if (needleLength && random() % 2) {
+            other[random() % needleLength] ^= 1;
+        }
+        const std::wstring_view needle(other, needleLength);
+        const size_t expected =
+            needle.empty() ? 0 : ReferenceFind(view, needle);
+        checker.Expect(Find(view, needle) == expected, "Find", length);
+
+        const wchar_t c = random() % 2 ? RandomUnit(random) : L'a';
+        checker.Expect(FindLast(view, c) == ReferenceFindLast(view, c),
+                       "FindLast", length);
+
+        const size_t plain = PlainAsciiLength(view);
+        checker.Expect(plain == ReferencePlainAsciiLength(view),
+                       "PlainAsciiLength", length);
+
+        NarrowAscii(units, plain, narrow);
+        bool narrowed = true;
+        for (size_t i = 0; i < plain; i++) {
+            narrowed &= narrow[i] == static_cast<char>(units[i]);
+        }
+        checker.Expect(narrowed, "NarrowAscii", plain);
+
+        const uint64_t value = random() % 4 == 0
+                                   ? random() % 256
+                                   : (uint64_t{random()} << 32 | random()) >>
+                                         (random() % 64);
+        char hex[16];
+        char expectedHex[16];
+        const size_t digits = FormatHex(value, hex);
+        checker.Expect(digits == ReferenceFormatHex(value, expectedHex) &&
+                           !memcmp(hex, expectedHex, sizeof(hex)),
+                       "FormatHex", 16);
+    }
+
+    printf("%llu checks, %llu failures\n",
+           static_cast<unsigned long long>(checker.checks),
+           static_cast<unsigned long long>(checker.failures));
+    return !checker.failures;
+}
+
+// Nanoseconds per call of f, which returns something to keep it from
+// being optimized out.
+template <typename F>
+double Time(uint64_t iterations, F&& f) {
+    size_t sink = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += f();
+    }
+    const auto end = std::chrono::steady_clock::now();
+
+    g_sink = sink;
+
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           static_cast<double>(iterations);
+}
+
+void Bench(uint64_t iterations) {
+    static constexpr char kPath[] =
+        "MainPage/Grid[4]/MasterDetail (MasterDetailView)/AdaptivePanel "
+        "(MasterDetailPanel)[1]/";
+    constexpr size_t kLength = 200;
+
+    wchar_t text[kLength];
+    char16_t text16[kLength];
+    wchar_t copy[kLength];
+    char16_t copy16[kLength];
+    for (size_t i = 0; i < kLength; i++) {
+        text[i] = copy[i] = kPath[i % (std::size(kPath) - 1)];
+        text16[i] = copy16[i] = kPath[i % (std::size(kPath) - 1)];
+    }
+
+    // Read back, so that the compiler can't fold the lengths in.
+    volatile size_t length = kLength;
+    const std::wstring_view view(text, length);
+    const std::u16string_view view16(text16, length);
+    // The path of a sibling: the same but for the last units.
+    const std::wstring_view prefix(copy, length - 10);
+    const std::u16string_view prefix16(copy16, length - 10);
+    const std::wstring_view needle = view.substr(150, 30);
+    const std::u16string_view needle16 = view16.substr(150, 30);
+
+    printf("%-18s %10s %10s\n", "", "libstdc++", "kernel");
+    printf("%-18s %8.1f ns %7.1f ns\n", "starts_with",
+           Time(iterations,
+                [&] { return size_t{view16.starts_with(prefix16)}; }),
+           Time(iterations, [&] { return size_t{StartsWith(view, prefix)}; }));
+    // Not there, the whole path is searched.
+    printf("%-18s %8.1f ns %7.1f ns\n", "find_last_of",
+           Time(iterations, [&] { return view16.find_last_of(u'#'); }),
+           Time(iterations, [&] { return FindLast(view, L'#'); }));
+    printf("%-18s %8.1f ns %7.1f ns\n", "find",
+           Time(iterations, [&] { return view16.find(needle16); }),
+           Time(iterations, [&] { return Find(view, needle); }));
+
+    char narrow[kLength];
+    printf("%-18s %8.1f ns %7.1f ns\n", "plain ascii length",
+           Time(iterations, [&] { return ReferencePlainAsciiLength(view); }),
+           Time(iterations, [&] { return PlainAsciiLength(view); }));
+    printf("%-18s %8s    %7.1f ns\n", "narrow ascii", "",
+           Time(iterations, [&] {
+               NarrowAscii(view.data(), view.size(), narrow);
+               return size_t(narrow[length - 1]);
+           }));
+    char hex[16];
+    printf("%-18s %8s    %7.1f ns\n", "format hex", "",
+           Time(iterations, [&] {
+               return FormatHex(length * 0x123456789ull, hex) + hex[0];
+           }));
+}
+
+bool ParseCount(const char* text, uint64_t& value) {
+    char* end;
+    const unsigned long long parsed = strtoull(text, &end, 10);
+    if (end == text || *end || !parsed) {
+        return false;
+    }
+
+    value = parsed;
+    return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    bool checkOnly = false;
+    uint64_t iterations = 2'000'000;
+
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "--check") {
+            checkOnly = true;
+        } else if (arg != "--iterations" || i + 1 == argc ||
+                   !ParseCount(argv[++i], iterations)) {
+            fprintf(stderr,
+                    "usage: stringbench [--check] [--iterations N]\n");
+            return 2;
+        }
+    }
+
+    if (!Check()) {
+        return 1;
+    }
+
+    if (!checkOnly) {
+        Bench(iterations);
+    }
+
+    return 0;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+// Stands in for Telegram.Diagnostics/stdafx.h, which is Windows only, for
+// the sources built here.
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>